@@ -0,0 +1,101 @@
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "carve.h"
+#include "der_decode_x509.h"
+#include "journal.h"
+#include "parallel.h"
+
+#define CARVE_SEGMENT_SIZE (4*1024*1024) // data scanned by a thread at a time
+#define CARVE_HEADER_SIZE 6              // 30 82 xx xx 30 82
+#define CARVE_MIN_LENGTH 256             // smaller lengths are not encoded on 2 bytes in DER
+
+static bool is_candidate(const unsigned char *p)
+{
+    return p[0] == 0x30 && p[1] == 0x82 && p[4] == 0x30 && p[5] == 0x82;
+}
+
+/**
+ * @brief Find the positions in [begin, end) that start like a certificate:
+ *        a SEQUENCE (the Certificate) containing a SEQUENCE (the TBSCertificate),
+ *        both with a length on 2 bytes
+ */
+static void find_candidates(const unsigned char *data, size_t size, size_t begin, size_t end, std::vector<size_t> &candidates)
+{
+    if (size < CARVE_HEADER_SIZE) return;
+    size_t last = std::min(end, size - CARVE_HEADER_SIZE + 1); // positions before last have a full header
+    size_t pos = begin;
+#ifdef __SSE2__
+    // Compare 16 positions at a time
+    const __m128i sequence = _mm_set1_epi8(0x30);
+    const __m128i length_2_bytes = _mm_set1_epi8((char)0x82);
+    while (pos < last && pos + 16 + CARVE_HEADER_SIZE - 1 <= size) {
+        __m128i tag0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + pos)), sequence);
+        __m128i len0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + pos + 1)), length_2_bytes);
+        __m128i tag1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + pos + 4)), sequence);
+        __m128i len1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + pos + 5)), length_2_bytes);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(tag0, len0), _mm_and_si128(tag1, len1)));
+        while (mask) {
+            size_t candidate = pos + __builtin_ctz(mask);
+            if (candidate < last) candidates.push_back(candidate);
+            mask &= mask - 1;
+        }
+        pos += 16;
+    }
+#endif
+    for (; pos < last; pos++) {
+        if (is_candidate(data + pos)) candidates.push_back(pos);
+    }
+}
+
+/**
+ * @brief Try to decode a certificate at a candidate position
+ * @return 0 on success, -1 otherwise
+ */
+static int try_decode(const unsigned char *data, size_t size, size_t offset, Certificate &cert)
+{
+    const unsigned char *p = data + offset;
+    size_t length = (p[2] << 8) | p[3];
+    size_t tbs_length = (p[6] << 8) | p[7];
+    if (length < CARVE_MIN_LENGTH || tbs_length < CARVE_MIN_LENGTH) return -1;
+    if (tbs_length + 4 > length) return -1;
+    if (length + 4 > size - offset) return -1;
+
+    OctetString der_bytes(p, length + 4);
+    journal.set_muted(true); // most candidates are not certificates
+    int err = der_decode_x509_certificate(der_bytes, cert);
+    journal.set_muted(false);
+    return err;
+}
+
+/**
+ * @brief Find the DER certificates embedded in arbitrary binary data
+ * @param[in]  data
+ * @param[in]  size
+ * @param[out] found  Certificates, ordered by offset
+ *
+ * The data is split in segments, scanned by several threads for
+ * plausible certificate headers. The candidates are validated by
+ * decoding them.
+ */
+void carve_certificates(const unsigned char *data, size_t size, std::vector<Carved_certificate> &found)
+{
+    size_t n_segments = (size + CARVE_SEGMENT_SIZE - 1) / CARVE_SEGMENT_SIZE;
+    std::vector<std::vector<Carved_certificate>> segment_found(n_segments);
+    parallel_for(n_segments, [&](size_t i) {
+        std::vector<size_t> candidates;
+        size_t begin = i * CARVE_SEGMENT_SIZE;
+        find_candidates(data, size, begin, std::min(size, begin + CARVE_SEGMENT_SIZE), candidates);
+        for (size_t offset: candidates) {
+            Certificate cert;
+            if (try_decode(data, size, offset, cert)) continue;
+            segment_found[i].push_back({offset, std::move(cert)});
+        }
+    });
+
+    for (auto &certs: segment_found) {
+        for (auto &carved: certs) found.push_back(std::move(carved));
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef CARVE_H
+#define CARVE_H
+
+#include <vector>
+
+#include "certificate.h"
+
+struct Carved_certificate {
+    size_t offset; // in the scanned data
+    Certificate cert;
+};
+
+void carve_certificates(const unsigned char *data, size_t size, std::vector<Carved_certificate> &found);
+
+#endif // CARVE_H
@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+
+#include "cert_framer.h"
+#include "der_tape.h"
+
+#define PEM_BEGIN_SIZE (sizeof(PEM_CERTIFICATE_BEGIN) - 1)
+#define PEM_END_SIZE (sizeof(PEM_CERTIFICATE_END) - 1)
+
+bool is_pem_begin(const unsigned char *data, size_t size)
+{
+    return size >= PEM_BEGIN_SIZE && 0 == memcmp(data, PEM_CERTIFICATE_BEGIN, PEM_BEGIN_SIZE);
+}
+
+/**
+ * @brief Find the next position of a buffer that may start a certificate
+ * @return The position of the next BEGIN marker, or of the next DER
+ *         header "30 82 xx xx 30 82" (a certificate and its TBSCertificate,
+ *         both longer than 255 bytes), or the size of the buffer if none
+ */
+size_t resync_cert_boundary(const unsigned char *data, size_t size, size_t pos)
+{
+    for (; pos < size; pos++) {
+        if (data[pos] == '-' && is_pem_begin(data + pos, size - pos)) return pos;
+        if (data[pos] == 0x30 && size - pos >= 6 && data[pos + 1] == 0x82 && data[pos + 4] == 0x30 && data[pos + 5] == 0x82) {
+            return pos;
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief Give the next chunk of the stream
+ * @param[out] frames  The certificates completed by this chunk are appended
+ */
+void Cert_framer::feed(const unsigned char *data, size_t size, std::vector<Framed_cert> &frames)
+{
+    if (stopped) return;
+    buffer.append(data, size);
+    process(false, frames);
+}
+
+/**
+ * @brief Tell that the stream has ended
+ * @param[out] frames  The last certificate, or an error if the stream ends in the middle of a certificate
+ */
+void Cert_framer::finish(std::vector<Framed_cert> &frames)
+{
+    if (stopped) return;
+    process(true, frames);
+    buffer.clear();
+}
+
+/**
+ * @brief Get the length of the PEM certificate at a position of the buffer
+ * @return The length, or 0 if more data is needed or on error
+ */
+size_t Cert_framer::frame_pem(size_t pos, bool at_end, Frame_error &error)
+{
+    const unsigned char *data = buffer.data();
+    size_t size = buffer.size();
+    if (resync) {
+        size_t n = std::min(size - pos, PEM_BEGIN_SIZE);
+        if (memcmp(data + pos, PEM_CERTIFICATE_BEGIN, n)) {
+            error = FRAME_UNKNOWN_FORMAT;
+            return 0;
+        }
+        if (n < PEM_BEGIN_SIZE) {
+            if (at_end) error = FRAME_PEM_WITHOUT_END;
+            return 0;
+        }
+    }
+
+    size_t from = std::max(pos, end_search - std::min(end_search, buffer_offset));
+    const unsigned char *marker = (const unsigned char *)memmem(data + from, size - from, PEM_CERTIFICATE_END, PEM_END_SIZE);
+    if (resync) {
+        // Do not swallow the next certificate if this one has no END marker
+        const unsigned char *limit = marker ? marker : data + size;
+        if (memmem(data + pos + 1, limit - data - pos - 1, PEM_CERTIFICATE_BEGIN, PEM_BEGIN_SIZE)) {
+            error = FRAME_PEM_WITHOUT_END;
+            return 0;
+        }
+    }
+    if (!marker) {
+        // The base64 text of a certificate is less than twice its size
+        if (der_check_limit(DER_LIMIT_CERT_SIZE, (size - pos) / 2)) error = FRAME_TOO_LARGE;
+        else if (at_end) error = FRAME_PEM_WITHOUT_END;
+        else end_search = buffer_offset + std::max(pos, size - std::min(size, PEM_END_SIZE - 1));
+        return 0;
+    }
+    const unsigned char *eol = (const unsigned char *)memchr(marker, '\n', data + size - marker);
+    if (!eol) {
+        if (at_end) return size - pos;
+        end_search = buffer_offset + (marker - data);
+        return 0;
+    }
+    return eol - data + 1 - pos;
+}
+
+/**
+ * @brief Get the length of the DER TLV at a position of the buffer
+ * @return The length, or 0 if more data is needed or on error
+ */
+size_t Cert_framer::frame_der(size_t pos, bool at_end, Frame_error &error)
+{
+    const unsigned char *data = buffer.data() + pos;
+    size_t available = buffer.size() - pos;
+    if (available < 2) {
+        if (at_end) error = FRAME_INVALID_DER_LENGTH;
+        return 0;
+    }
+    size_t header_size = 2;
+    size_t length = 0;
+    if (data[1] & 0x80) {
+        size_t n_bytes = data[1] & 0x7f;
+        if (available < 2 + n_bytes) {
+            if (at_end) error = FRAME_INVALID_DER_LENGTH;
+            return 0;
+        }
+        for (size_t i=0; i<n_bytes; i++) {
+            if (length > (INT_MAX >> 8)) { // same limit as get_der_sequence
+                error = FRAME_INVALID_DER_LENGTH;
+                return 0;
+            }
+            length = (length << 8) + data[2 + i];
+        }
+        header_size += n_bytes;
+    } else {
+        length = data[1];
+    }
+    if (der_check_limit(DER_LIMIT_CERT_SIZE, header_size + length)) {
+        error = FRAME_TOO_LARGE; // rather than buffering it
+        return 0;
+    }
+    if (length > available - header_size) {
+        if (at_end) error = FRAME_INVALID_DER_LENGTH;
+        return 0;
+    }
+    return header_size + length;
+}
+
+/**
+ * @brief Split the buffered data into certificates, and keep the incomplete rest
+ */
+void Cert_framer::process(bool at_end, std::vector<Framed_cert> &frames)
+{
+    size_t pos = 0;
+    while (!stopped) {
+        size_t size = buffer.size();
+        if (resyncing) {
+            size_t skipped = pos;
+            pos = resync_cert_boundary(buffer.data(), size, pos);
+            if (pos == size) {
+                // Keep what may be the beginning of a BEGIN marker or of a DER header
+                if (!at_end) pos = std::max(skipped, size - std::min(size, PEM_BEGIN_SIZE - 1));
+                break;
+            }
+            resyncing = false;
+        }
+        if (resync) {
+            while (pos < size && isspace(buffer[pos])) pos++; // between certificates
+        }
+        if (pos == size) break;
+
+        Frame_error error = FRAME_OK;
+        size_t length = 0;
+        if (buffer[pos] == '-') length = frame_pem(pos, at_end, error);
+        else if (buffer[pos] == 0x30) length = frame_der(pos, at_end, error);
+        else error = FRAME_UNKNOWN_FORMAT;
+
+        if (error != FRAME_OK) {
+            frames.push_back({OctetString(), buffer_offset + pos, error});
+            end_search = 0;
+            if (!resync) {
+                stopped = true;
+                break;
+            }
+            resyncing = true;
+            pos++;
+            continue;
+        }
+        if (!length) break; // wait for more data
+
+        frames.push_back({OctetString(buffer.data() + pos, length), buffer_offset + pos, FRAME_OK});
+        pos += length;
+        end_search = 0;
+    }
+    if (stopped) pos = buffer.size();
+    buffer.erase(0, pos);
+    buffer_offset += pos;
+}
@@ -0,0 +1,59 @@
+#ifndef CERT_FRAMER_H
+#define CERT_FRAMER_H
+
+#include <vector>
+
+#include "util.h"
+
+#define PEM_CERTIFICATE_BEGIN "-----BEGIN CERTIFICATE-----"
+#define PEM_CERTIFICATE_END "-----END CERTIFICATE-----"
+
+enum Frame_error {
+    FRAME_OK,
+    FRAME_UNKNOWN_FORMAT,     // neither PEM nor DER
+    FRAME_PEM_WITHOUT_END,
+    FRAME_INVALID_DER_LENGTH, // invalid, or longer than the stream
+    FRAME_TOO_LARGE,          // exceeds DER_LIMIT_CERT_SIZE
+};
+
+/* Certificate delimited in a stream, not decoded yet */
+struct Framed_cert {
+    OctetString bytes;  // PEM text (from the BEGIN marker to the end of the END line) or DER
+    size_t offset;      // in the stream
+    Frame_error error;  // if not FRAME_OK, bytes is empty
+};
+
+/* Incremental splitter of a stream of concatenated PEM and DER certificates
+ *
+ * The stream is given by chunks of any size, as they arrive (eg: from a pipe),
+ * and the certificates are returned as soon as they are complete, so that they
+ * can be decoded while the next ones are being received.
+ *
+ * At the first invalid position, an error is returned and the rest of the
+ * stream is ignored, unless resync is set: then the data is skipped up to the
+ * next BEGIN marker or plausible DER header, and whitespace between the
+ * certificates is ignored.
+ */
+class Cert_framer {
+public:
+    Cert_framer(bool resync): resync(resync), stopped(false), resyncing(false), buffer_offset(0), end_search(0) {}
+    void feed(const unsigned char *data, size_t size, std::vector<Framed_cert> &frames);
+    void finish(std::vector<Framed_cert> &frames);
+
+private:
+    void process(bool at_end, std::vector<Framed_cert> &frames);
+    size_t frame_pem(size_t pos, bool at_end, Frame_error &error);
+    size_t frame_der(size_t pos, bool at_end, Frame_error &error);
+
+    bool resync;
+    bool stopped;       // after an error, if not resync
+    bool resyncing;     // skipping data after an error
+    OctetString buffer; // data received, not framed yet
+    size_t buffer_offset; // offset of the buffer in the stream
+    size_t end_search;    // offset in the stream from which the END marker remains to be searched
+};
+
+bool is_pem_begin(const unsigned char *data, size_t size);
+size_t resync_cert_boundary(const unsigned char *data, size_t size, size_t pos);
+
+#endif // CERT_FRAMER_H
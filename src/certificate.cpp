@@ -1,5 +1,10 @@
-#include "certificate.h"
+#include <algorithm>
+#include <functional>
+#include <vector>
 
+#include "certificate.h"
+#include "charset.h"
+#include "oid_name.h"
 
 bool AttributeTypeAndValue::operator<(const AttributeTypeAndValue& other) const
 {
@@ -13,5 +18,242 @@ bool AttributeTypeAndValue::operator==(const AttributeTypeAndValue& other) const
 
 bool GeneralNames::empty() const
 {
-    return stringvalue.empty() && namevalue.empty() && othervalue.empty();
+    return items.empty();
+}
+
+static Name_match name_match = NAME_MATCH_CANONICAL;
+
+/**
+ * @brief Select the comparison of names, for the keys computed afterwards
+ */
+void set_name_match(Name_match mode)
+{
+    name_match = mode;
+}
+
+/**
+ * @brief Decode the UTF-8 character at a position of a string
+ * @param[out] valid  false if the byte does not start a valid character
+ * @return The code point, or the byte itself if it does not start a valid character
+ *
+ * Overlong encodings, surrogates and code points beyond U+10FFFF are not valid.
+ */
+static uint32_t next_code_point(const std::string &str, size_t &pos, bool &valid)
+{
+    static const uint32_t MIN_CODE_POINT[] = { 0, 0x80, 0x800, 0x10000 };
+    unsigned char c = str[pos++];
+    valid = (c < 0x80);
+    int n_bytes = 0;
+    uint32_t code_point = c;
+    if (c >= 0xF0 && c < 0xF8) { n_bytes = 3; code_point = c & 0x07; }
+    else if (c >= 0xE0) { n_bytes = 2; code_point = c & 0x0F; }
+    else if (c >= 0xC0) { n_bytes = 1; code_point = c & 0x1F; }
+    if (c < 0xC0 || c >= 0xF8 || pos + n_bytes > str.size()) return c;
+    for (int i=0; i<n_bytes; i++) {
+        unsigned char next = str[pos + i];
+        if ((next & 0xC0) != 0x80) return c;
+        code_point = (code_point << 6) | (next & 0x3F);
+    }
+    if (code_point < MIN_CODE_POINT[n_bytes] || code_point > 0x10FFFF
+        || (code_point >= 0xD800 && code_point <= 0xDFFF)) return c;
+    pos += n_bytes;
+    valid = true;
+    return code_point;
+}
+
+/**
+ * @brief Prepare a string for comparison, as RFC 4518 (caseIgnoreMatch)
+ *
+ * - characters mapped to nothing (soft hyphen, zero width spaces, ...) are removed,
+ *   as the controls other than U+0009-000D and U+0085
+ * - the spaces, and U+0009-000D and U+0085, are mapped to SPACE
+ * - case folding (ASCII, Latin-1, Greek and Cyrillic)
+ * - insignificant spaces: leading and trailing spaces are removed,
+ *   and inner sequences of spaces are replaced by one
+ *
+ * The string types do not matter, as all the strings are decoded to UTF-8.
+ * The bytes that are not valid UTF-8 are kept as they are.
+ * Unicode normalization (NFKC) is not done.
+ */
+static std::string canonicalize_string(const std::string &value)
+{
+    std::string result;
+    result.reserve(value.size());
+    bool pending_space = false;
+    size_t pos = 0;
+    while (pos < value.size()) {
+        bool valid;
+        uint32_t c = next_code_point(value, pos, valid);
+        if (!valid) {
+            if (pending_space) result += ' ';
+            pending_space = false;
+            result += (char)c;
+            continue;
+        }
+        if (c == 0x00AD || c == 0x1806 || (c >= 0x180B && c <= 0x180E) || (c >= 0x200B && c <= 0x200D)
+            || c == 0x2060 || c == 0xFEFF || (c >= 0xFE00 && c <= 0xFE0F) || c == 0x034F || c == 0xFFFC) {
+            continue; // mapped to nothing
+        }
+        if (c < 0x09 || (c > 0x0D && c < 0x20) || (c >= 0x7F && c <= 0x9F && c != 0x85)) {
+            continue; // other controls: mapped to nothing
+        }
+        if (c == 0x20 || (c >= 0x09 && c <= 0x0D) || c == 0x85 || c == 0xA0 || c == 0x1680 || (c >= 0x2000 && c <= 0x200A)
+            || c == 0x2028 || c == 0x2029 || c == 0x202F || c == 0x205F || c == 0x3000) {
+            pending_space = !result.empty();
+            continue;
+        }
+        if ((c >= 'A' && c <= 'Z') || (c >= 0xC0 && c <= 0xDE && c != 0xD7) || (c >= 0x391 && c <= 0x3AB && c != 0x3A2)
+            || (c >= 0x410 && c <= 0x42F)) {
+            c += 0x20;
+        } else if (c >= 0x400 && c <= 0x40F) {
+            c += 0x50;
+        }
+        if (pending_space) result += ' ';
+        pending_space = false;
+        append_utf8(c, result);
+    }
+    return result;
+}
+
+/**
+ * @brief Compute the key of a Name, according to the mode set by set_name_match()
+ *
+ * Two names match if their keys are equal. The values are length-prefixed,
+ * so that no value can be confused with a separator, and the attributes
+ * of each RDN are sorted after canonicalization.
+ */
+Name_key compute_name_key(const Name &name)
+{
+    Name_key result;
+    std::vector<std::string> attributes;
+    for (const auto &rdn: name) {
+        attributes.clear();
+        for (const auto &attribute: rdn) {
+            std::string value = attribute.value;
+            if (name_match == NAME_MATCH_CANONICAL && value.compare(0, 5, "[der]")) value = canonicalize_string(value);
+            attributes.push_back(attribute.type + "=" + std::to_string(value.size()) + ":" + value);
+        }
+        std::sort(attributes.begin(), attributes.end());
+        result.key += std::to_string(attributes.size()) + "{";
+        for (const auto &attribute: attributes) result.key += attribute;
+        result.key += "}";
+    }
+    result.hash = std::hash<std::string>()(result.key);
+    return result;
+}
+
+static const char *KEY_USAGE_NAMES[KEY_USAGE_BITS] = {
+    "digitalSignature",
+    "nonRepudiation",
+    "keyEncipherment",
+    "dataEncipherment",
+    "keyAgreement",
+    "keyCertSign",
+    "cRLSign",
+    "encipherOnly",
+    "decipherOnly",
+};
+
+/* Well-known purposes of ExtKeyUsage, in the order of Ext_key_usage_bit */
+static const struct {
+    const char *oid;
+    const char *name;
+} EXT_KEY_USAGES[EXT_KEY_USAGE_BITS] = {
+    { "1.3.6.1.5.5.7.3.1", "serverAuth" },
+    { "1.3.6.1.5.5.7.3.2", "clientAuth" },
+    { "1.3.6.1.5.5.7.3.3", "codeSigning" },
+    { "1.3.6.1.5.5.7.3.4", "emailProtection" },
+    { "1.3.6.1.5.5.7.3.8", "timeStamping" },
+    { "1.3.6.1.5.5.7.3.9", "OCSPSigning" },
+    { "2.5.29.37.0", "anyExtendedKeyUsage" },
+    { NULL, "other" },
+};
+
+/**
+ * @brief Get the name of a bit of KeyUsage (eg: 5 -> "keyCertSign")
+ * @return NULL if the bit is out of range
+ */
+const char *key_usage_name(int bit)
+{
+    if (bit < 0 || bit >= KEY_USAGE_BITS) return NULL;
+    return KEY_USAGE_NAMES[bit];
+}
+
+/**
+ * @brief Get the bit of KeyUsage of a name (eg: "keyCertSign" -> 5)
+ * @return -1 if the name is unknown
+ */
+int key_usage_bit(const std::string &name)
+{
+    for (int bit=0; bit<KEY_USAGE_BITS; bit++) {
+        if (name == KEY_USAGE_NAMES[bit]) return bit;
+    }
+    return -1;
+}
+
+/**
+ * @brief Get the name of a bit of ExtKeyUsage (eg: 0 -> "serverAuth")
+ * @return NULL if the bit is out of range
+ */
+const char *ext_key_usage_name(int bit)
+{
+    if (bit < 0 || bit >= EXT_KEY_USAGE_BITS) return NULL;
+    return EXT_KEY_USAGES[bit].name;
+}
+
+/**
+ * @brief Get the bit of ExtKeyUsage of a name (eg: "serverAuth" -> 0)
+ * @return -1 if the name is unknown
+ */
+int ext_key_usage_bit(const std::string &name)
+{
+    for (int bit=0; bit<EXT_KEY_USAGE_BITS; bit++) {
+        if (name == EXT_KEY_USAGES[bit].name) return bit;
+    }
+    return -1;
+}
+
+/**
+ * @brief Get the bit of ExtKeyUsage of a purpose (eg: "1.3.6.1.5.5.7.3.1" -> 0)
+ *
+ * The purposes that are not well-known get the bit of EXT_KEY_USAGE_OTHER.
+ */
+int ext_key_usage_bit_of_oid(const ObjectIdentifier &oid)
+{
+    int bit = 0;
+    while (EXT_KEY_USAGES[bit].oid && oid != EXT_KEY_USAGES[bit].oid) bit++;
+    return bit;
+}
+
+/**
+ * @brief Summarize the usages and policies of a certificate, for the filters
+ */
+Usage_bits compute_usage_bits(const Extensions &extensions)
+{
+    static const ObjectIdentifier key_usage_oid = oid_get_id("id-ce-keyUsage");
+    static const ObjectIdentifier ext_key_usage_oid = oid_get_id("id-ce-extKeyUsage");
+    static const ObjectIdentifier policies_oid = oid_get_id("id-ce-certificatePolicies");
+    static const ObjectIdentifier basic_constraints_oid = oid_get_id("id-ce-basicConstraints");
+
+    Usage_bits result;
+    for (const auto &item: extensions.items) {
+        const std::any &value = item.second.extn_value;
+        if (item.first == key_usage_oid) {
+            if (const KeyUsage *key_usage = std::any_cast<KeyUsage>(&value)) result.usages |= *key_usage;
+        } else if (item.first == ext_key_usage_oid) {
+            if (const ExtKeyUsage *eku = std::any_cast<ExtKeyUsage>(&value)) {
+                result.usages |= (uint64_t)eku->bits << USAGE_EXT_KEY_USAGE_SHIFT;
+            }
+        } else if (item.first == policies_oid) {
+            if (const CertificatePolicies *policies = std::any_cast<CertificatePolicies>(&value)) {
+                for (uint32_t policy: policies->policies) {
+                    if (policy < USAGE_MAX_POLICIES) result.policies |= 1ULL << policy;
+                }
+            }
+        } else if (item.first == basic_constraints_oid) {
+            const BasicConstraints *basic_constraints = std::any_cast<BasicConstraints>(&value);
+            if (basic_constraints && basic_constraints->ca) result.usages |= USAGE_CA;
+        }
+    }
+    return result;
 }
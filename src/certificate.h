@@ -3,9 +3,11 @@
 
 #include <list>
 #include <map>
+#include <stdint.h>
 #include <set>
 #include <string>
 #include <any>
+#include <vector>
 
 #include "util.h"
 
@@ -27,15 +29,51 @@ struct AttributeTypeAndValue {
 
 typedef std::list<std::set<AttributeTypeAndValue>> Name;
 
-struct GeneralNames {
+/* Comparison of the names of issuers and subjects */
+enum Name_match {
+    NAME_MATCH_EXACT,     // same decoded strings
+    NAME_MATCH_CANONICAL, // same strings after RFC 4518 preparation (case, spaces, ...)
+};
+
+/* Key of a Name, computed once, so that names are compared in O(1) in most cases */
+struct Name_key {
+    std::string key; // serialization of the (canonicalized) attributes
+    size_t hash;     // of the key
+    Name_key(): hash(0) {}
+    bool operator==(const Name_key &other) const { return hash == other.hash && key == other.key; }
+    bool operator!=(const Name_key &other) const { return !(*this == other); }
+};
+
+void set_name_match(Name_match mode);
+Name_key compute_name_key(const Name &name);
+
+/* Choices of GeneralName */
+enum GeneralName_tag {
+    GENERAL_NAME_OTHER = 0,
+    GENERAL_NAME_RFC822 = 1,
+    GENERAL_NAME_DNS = 2,
+    GENERAL_NAME_X400 = 3,
+    GENERAL_NAME_DIRECTORY = 4,
+    GENERAL_NAME_EDI_PARTY = 5,
+    GENERAL_NAME_URI = 6,
+    GENERAL_NAME_IP_ADDRESS = 7,
+    GENERAL_NAME_REGISTERED_ID = 8,
+};
+
+struct GeneralName {
     enum {
         TYPE_STR,
         TYPE_NAME,
         TYPE_OTHER
     } type;
-    std::string stringvalue;
-    Name namevalue;
-    OctetString othervalue;
+    unsigned char tag;       // see GeneralName_tag
+    std::string stringvalue; // TYPE_STR (rfc822Name, dNSName, URI)
+    Name namevalue;          // TYPE_NAME (directoryName)
+    OctetString othervalue;  // TYPE_OTHER (DER encoded)
+};
+
+struct GeneralNames {
+    std::vector<GeneralName> items; // all the entries, in order
     bool empty() const;
 };
 
@@ -55,8 +93,58 @@ struct BasicConstraints {
     Integer path_len_constraint; // empty if not present
 };
 
+/* The minimum and maximum of the GeneralSubtrees are not kept (RFC 5280: 0 and absent) */
+struct NameConstraints {
+    GeneralNames permitted_subtrees; // empty if not present
+    GeneralNames excluded_subtrees;  // empty if not present
+};
+
 typedef OctetString SubjectKeyIdentifier;
-typedef std::set<std::string> KeyUsage;
+
+/* Bits of KeyUsage (bit 0 of the BIT STRING is the least significant) */
+enum Key_usage_bit {
+    KEY_USAGE_DIGITAL_SIGNATURE = 1 << 0,
+    KEY_USAGE_NON_REPUDIATION = 1 << 1,
+    KEY_USAGE_KEY_ENCIPHERMENT = 1 << 2,
+    KEY_USAGE_DATA_ENCIPHERMENT = 1 << 3,
+    KEY_USAGE_KEY_AGREEMENT = 1 << 4,
+    KEY_USAGE_KEY_CERT_SIGN = 1 << 5,
+    KEY_USAGE_CRL_SIGN = 1 << 6,
+    KEY_USAGE_ENCIPHER_ONLY = 1 << 7,
+    KEY_USAGE_DECIPHER_ONLY = 1 << 8,
+};
+#define KEY_USAGE_BITS 9
+
+typedef uint16_t KeyUsage;
+
+/* Bits of the well-known purposes of ExtKeyUsage */
+enum Ext_key_usage_bit {
+    EXT_KEY_USAGE_SERVER_AUTH = 1 << 0,
+    EXT_KEY_USAGE_CLIENT_AUTH = 1 << 1,
+    EXT_KEY_USAGE_CODE_SIGNING = 1 << 2,
+    EXT_KEY_USAGE_EMAIL_PROTECTION = 1 << 3,
+    EXT_KEY_USAGE_TIME_STAMPING = 1 << 4,
+    EXT_KEY_USAGE_OCSP_SIGNING = 1 << 5,
+    EXT_KEY_USAGE_ANY = 1 << 6,
+    EXT_KEY_USAGE_OTHER = 1 << 7, // at least one purpose not listed above
+};
+#define EXT_KEY_USAGE_BITS 8
+
+struct ExtKeyUsage {
+    uint32_t bits;                 // see Ext_key_usage_bit
+    std::vector<uint32_t> purposes; // all the purposes, in order, as interned OIDs (see oid_intern())
+};
+
+struct CertificatePolicies {
+    std::vector<uint32_t> policies; // policyIdentifier of each PolicyInformation, as interned OIDs
+};
+
+const char *key_usage_name(int bit);
+int key_usage_bit(const std::string &name);
+const char *ext_key_usage_name(int bit);
+int ext_key_usage_bit(const std::string &name);
+int ext_key_usage_bit_of_oid(const ObjectIdentifier &oid);
+
 typedef GeneralNames SubjectAltName;
 typedef GeneralNames IssuerAltName;
 
@@ -70,6 +158,27 @@ struct Extensions {
     std::map<ObjectIdentifier, Extension> items;
 };
 
+#define USAGE_EXT_KEY_USAGE_SHIFT 16
+#define USAGE_CA (1ULL << 48) // basicConstraints with cA true
+#define USAGE_MAX_POLICIES 64 // interned policies that fit in Usage_bits::policies
+
+/* Usages and policies of a certificate, packed so that a filter is a couple of AND operations
+ *
+ * Only the policies interned first (ids below USAGE_MAX_POLICIES) are in the mask:
+ * the policies of the filters are interned before any certificate is decoded.
+ */
+struct Usage_bits {
+    uint64_t usages;   // KeyUsage bits, ExtKeyUsage bits << USAGE_EXT_KEY_USAGE_SHIFT, USAGE_CA
+    uint64_t policies; // bit n set for the policy whose interned id is n
+    Usage_bits(): usages(0), policies(0) {}
+    bool empty() const { return !usages && !policies; }
+    bool covers(const Usage_bits &wanted) const {
+        return (usages & wanted.usages) == wanted.usages && (policies & wanted.policies) == wanted.policies;
+    }
+};
+
+Usage_bits compute_usage_bits(const Extensions &extensions);
+
 
 struct AlgorithmIdentifier {
     std::string algorithm;
@@ -85,6 +194,8 @@ struct Validity {
 struct SubjectPublicKeyInfo {
     AlgorithmIdentifier algorithm;
     OctetString subject_public_key;
+    size_t der_offset; // of the whole SubjectPublicKeyInfo, in the DER of the certificate (or request)
+    size_t der_size;
 };
 
 struct TBSCertificate {
@@ -94,18 +205,39 @@ struct TBSCertificate {
     Name issuer;
     Validity validity;
     Name subject;
+    Name_key issuer_key;  // see compute_name_key()
+    Name_key subject_key;
+    Usage_bits usage_bits; // see compute_usage_bits()
     SubjectPublicKeyInfo subject_public_key_info;
     OctetString issuer_unique_id; // emtpy if not present
     OctetString subject_unique_id; // empty if not present
     Extensions extensions;
 };
 
+/* PKCS#10 certification request (the attributes are not decoded) */
+struct CertificationRequest {
+    Integer version;
+    Name subject;
+    SubjectPublicKeyInfo subject_public_key_info;
+    AlgorithmIdentifier signature_algorithm;
+    OctetString der_bytes;
+};
+
+/* Digests of the DER encoding of a certificate (see compute_fingerprints()) */
+struct Fingerprints {
+    unsigned char sha1[20];
+    unsigned char sha256[32];
+    bool computed;
+    Fingerprints(): computed(false) {}
+};
+
 class Certificate {
 public:
     TBSCertificate tbs_certificate;
     AlgorithmIdentifier signature_algorithm;
     OctetString signature_value;
     OctetString der_bytes; // Full der encoded value, containing the 3 fields above
+    Fingerprints fingerprints;
 };
 
 #endif
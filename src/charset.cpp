@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "charset.h"
+
+/*
+ * The strings of certificates are mostly ASCII: the converters first
+ * check whole 64-bit words (SWAR), and copy the ASCII characters of a
+ * word at once. The other characters are converted one by one.
+ */
+
+static inline uint64_t load_u64(const unsigned char *data)
+{
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+/* Bits that are zero in a word of ASCII characters, in the order of the bytes in memory */
+static const unsigned char ASCII_MASK_8[8]  = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
+static const unsigned char ASCII_MASK_16[8] = { 0xFF, 0x80, 0xFF, 0x80, 0xFF, 0x80, 0xFF, 0x80 }; // big endian
+static const unsigned char ASCII_MASK_32[8] = { 0xFF, 0xFF, 0xFF, 0x80, 0xFF, 0xFF, 0xFF, 0x80 }; // big endian
+
+/**
+ * @brief Append the UTF-8 encoding of a code point
+ */
+void append_utf8(uint32_t c, std::string &utf8)
+{
+    if (c < 0x80) {
+        utf8 += (char)c;
+    } else if (c < 0x800) {
+        utf8 += (char)(0xC0 | (c >> 6));
+        utf8 += (char)(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+        utf8 += (char)(0xE0 | (c >> 12));
+        utf8 += (char)(0x80 | ((c >> 6) & 0x3F));
+        utf8 += (char)(0x80 | (c & 0x3F));
+    } else {
+        utf8 += (char)(0xF0 | (c >> 18));
+        utf8 += (char)(0x80 | ((c >> 12) & 0x3F));
+        utf8 += (char)(0x80 | ((c >> 6) & 0x3F));
+        utf8 += (char)(0x80 | (c & 0x3F));
+    }
+}
+
+/**
+ * @brief Convert a BMPString (UTF-16, big endian) to UTF-8
+ * @return 0 on success, -1 if the size is odd or a surrogate is unpaired
+ *
+ * The surrogate pairs, not part of the BMP strictly speaking,
+ * are accepted as some encoders produce them.
+ */
+int bmp_to_utf8(const unsigned char *data, size_t size, std::string &utf8)
+{
+    if (size % 2) return -1;
+    utf8.clear();
+    utf8.reserve(size / 2);
+    const uint64_t mask = load_u64(ASCII_MASK_16);
+    size_t i = 0;
+    while (i < size) {
+        if (size - i >= 8 && !(load_u64(data + i) & mask)) {
+            utf8 += (char)data[i + 1];
+            utf8 += (char)data[i + 3];
+            utf8 += (char)data[i + 5];
+            utf8 += (char)data[i + 7];
+            i += 8;
+            continue;
+        }
+        uint32_t c = (data[i] << 8) | data[i + 1];
+        i += 2;
+        if (c >= 0xDC00 && c <= 0xDFFF) return -1;
+        if (c >= 0xD800 && c <= 0xDBFF) {
+            if (size - i < 2) return -1;
+            uint32_t low = (data[i] << 8) | data[i + 1];
+            if (low < 0xDC00 || low > 0xDFFF) return -1;
+            c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+            i += 2;
+        }
+        append_utf8(c, utf8);
+    }
+    return 0;
+}
+
+/**
+ * @brief Convert a UniversalString (UCS-4, big endian) to UTF-8
+ * @return 0 on success, -1 if the size is not a multiple of 4 or a character is invalid
+ */
+int universal_to_utf8(const unsigned char *data, size_t size, std::string &utf8)
+{
+    if (size % 4) return -1;
+    utf8.clear();
+    utf8.reserve(size / 4);
+    const uint64_t mask = load_u64(ASCII_MASK_32);
+    size_t i = 0;
+    while (i < size) {
+        if (size - i >= 8 && !(load_u64(data + i) & mask)) {
+            utf8 += (char)data[i + 3];
+            utf8 += (char)data[i + 7];
+            i += 8;
+            continue;
+        }
+        uint32_t c = ((uint32_t)data[i] << 24) | (data[i + 1] << 16) | (data[i + 2] << 8) | data[i + 3];
+        i += 4;
+        if (c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) return -1;
+        append_utf8(c, utf8);
+    }
+    return 0;
+}
+
+/**
+ * @brief Convert a T61String to UTF-8
+ *
+ * As most implementations (eg: openssl), the T61String is taken as ISO-8859-1.
+ */
+void latin1_to_utf8(const unsigned char *data, size_t size, std::string &utf8)
+{
+    utf8.clear();
+    utf8.reserve(size);
+    const uint64_t mask = load_u64(ASCII_MASK_8);
+    size_t i = 0;
+    while (i < size) {
+        if (size - i >= 8 && !(load_u64(data + i) & mask)) {
+            utf8.append((const char *)data + i, 8);
+            i += 8;
+            continue;
+        }
+        append_utf8(data[i], utf8);
+        i++;
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef CHARSET_H
+#define CHARSET_H
+
+#include <stdint.h>
+#include <string>
+
+void append_utf8(uint32_t code_point, std::string &utf8);
+int bmp_to_utf8(const unsigned char *data, size_t size, std::string &utf8);
+int universal_to_utf8(const unsigned char *data, size_t size, std::string &utf8);
+void latin1_to_utf8(const unsigned char *data, size_t size, std::string &utf8);
+
+#endif // CHARSET_H
@@ -0,0 +1,317 @@
+/*
+ */
+
+#include <argp.h>
+#include <assert.h>
+#include <ctype.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string.h>
+
+#include "cmd_asn1dump.h"
+#include "decompress.h"
+#include "der_tape.h"
+#include "journal.h"
+#include "oid_name.h"
+#include "pem_scan.h"
+#include "util.h"
+
+#define DUMP_CHUNK_SIZE 4096   // primitive values are read by chunks of this size
+
+struct Arguments_asn1dump {
+    std::string path; // empty for stdin
+    size_t max_bytes;
+    Arguments_asn1dump(): max_bytes(32) {}
+};
+
+static error_t parse_opt(int key, char* arg, struct argp_state* state)
+{
+    struct Arguments_asn1dump *arguments = (struct Arguments_asn1dump *)state->input;
+    int level;
+    char *end;
+
+    switch(key) {
+    case 'h':
+        argp_state_help(state, state->out_stream, ARGP_HELP_STD_HELP);
+        break;
+    case 'n':
+        arguments->max_bytes = strtoul(arg, &end, 10);
+        if (*end || !*arg) argp_error(state, "Invalid number of bytes: '%s'", arg);
+        break;
+    case 'v':
+        level = journal.get_log_level();
+        level++;
+        journal.set_log_level(level);
+        break;
+    case ARGP_KEY_ARG:
+        assert(arg);
+        if (!arguments->path.empty()) argp_error(state, "Only one file can be dumped");
+        if (strcmp(arg, "-")) arguments->path = arg;
+        break;
+    case ARGP_KEY_END:
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp_option options[] = {
+    { "bytes",       'n', "N",  0, "Show at most N bytes of each primitive value (default: 32, 0 for all)", 1 },
+    { "verbose",     'v', 0,    0, "Be verbose (repeat for more verbosity)", 1 },
+    { "",  0, 0,  OPTION_DOC, 0, 1 },
+    { 0,  'h', 0, 0, 0, -1 },
+    { 0 }
+};
+
+static char doc[] =
+    "\n"
+    "Dump the ASN.1 structure of DER data (eg: a certificate that cannot be decoded).\n"
+    "\n"
+    "Options:"
+    "\v"
+    "The input may be DER, PEM (the contents of all the PEM blocks are dumped),\n"
+    "and compressed. It is read as a stream: its size is not limited by the memory.\n"
+    "Several concatenated values are dumped one after the other.\n"
+    "\n"
+    "Each line gives the offset, depth, size of the header, length of the value,\n"
+    "and the tag, followed for primitive values by their contents."
+    ;
+
+static char args_doc[] = "[FILE]";
+
+/* Entry point for command line parsing */
+static struct argp argp = { options, parse_opt, args_doc, doc, 0 };
+
+/**
+ * @brief Get the name of a tag: name of the universal types, or [n] for other classes
+ */
+static std::string tag_name(unsigned char tag)
+{
+    static const char *UNIVERSAL_NAMES[] = {
+        "EOC", "BOOLEAN", "INTEGER", "BIT STRING", "OCTET STRING", "NULL", "OBJECT IDENTIFIER",
+        "ObjectDescriptor", "EXTERNAL", "REAL", "ENUMERATED", "EMBEDDED PDV", "UTF8String",
+        "RELATIVE-OID", "TIME", "[UNIVERSAL 15]", "SEQUENCE", "SET", "NumericString",
+        "PrintableString", "T61String", "VideotexString", "IA5String", "UTCTime",
+        "GeneralizedTime", "GraphicString", "VisibleString", "GeneralString",
+        "UniversalString", "CHARACTER STRING", "BMPString"
+    };
+    int number = tag & DER_TAG_NUMBER_MASK;
+    switch (tag & DER_CLASS_MASK) {
+    case 0x00: return UNIVERSAL_NAMES[number];
+    case 0x40: return "[APPLICATION " + std::to_string(number) + "]";
+    case DER_CLASS_CONTEXT: return "[" + std::to_string(number) + "]";
+    default: return "[PRIVATE " + std::to_string(number) + "]";
+    }
+}
+
+static bool is_string_type(int number)
+{
+    switch (number) {
+    case 12: // UTF8String
+    case 18: // NumericString
+    case 19: // PrintableString
+    case 20: // T61String
+    case 22: // IA5String
+    case 23: // UTCTime
+    case 24: // GeneralizedTime
+    case 26: // VisibleString
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Print a string value, with the non printable characters escaped */
+static void print_string(const unsigned char *data, size_t size)
+{
+    putchar('\'');
+    for (size_t i=0; i<size; i++) {
+        if (data[i] == '\'' || data[i] == '\\') printf("\\%c", data[i]);
+        else if (data[i] >= 0x20 && data[i] < 0x7f) putchar(data[i]);
+        else printf("\\x%02X", data[i]);
+    }
+    putchar('\'');
+}
+
+static std::string oid_to_string(const unsigned char *value, size_t size)
+{
+    if (!size) return "";
+    std::string result = std::to_string(value[0] / 40) + "." + std::to_string(value[0] % 40);
+    unsigned long long current = 0;
+    for (size_t i=1; i<size; i++) {
+        current = (current << 7) | (value[i] & 0x7f);
+        if (!(value[i] & 0x80)) {
+            result += "." + std::to_string(current);
+            current = 0;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Read and print the contents of a primitive value
+ * @return 0 on success, -1 if the input is truncated
+ *
+ * Only the first chunk of the value is kept in memory, the rest is
+ * printed in hexadecimal as it is read (up to max_bytes), or skipped.
+ */
+static int dump_primitive(std::streambuf *input, const Der_header &header, size_t max_bytes)
+{
+    unsigned char chunk[DUMP_CHUNK_SIZE];
+    size_t remaining = header.length;
+    size_t n = std::min(remaining, sizeof(chunk));
+    if ((size_t)input->sgetn((char *)chunk, n) != n) return -1;
+    remaining -= n;
+
+    int number = header.tag & DER_TAG_NUMBER_MASK;
+    bool universal = (header.tag & DER_CLASS_MASK) == 0;
+    size_t shown = 0;
+    if (universal && number == 1 && n == 1) {
+        printf(":%s", chunk[0] ? "TRUE" : "FALSE");
+        shown = n;
+    } else if (universal && number == 6 && remaining == 0) {
+        std::string oid = oid_to_string(chunk, n);
+        std::string name = oid_get_name(oid);
+        printf(":%s", oid.c_str());
+        if (name != oid) printf(" (%s)", name.c_str());
+        shown = n;
+    } else if (universal && is_string_type(number)) {
+        shown = max_bytes ? std::min(n, max_bytes) : n;
+        putchar(':');
+        print_string(chunk, shown);
+    } else if (n) {
+        shown = max_bytes ? std::min(n, max_bytes) : n;
+        printf(":%s", hexlify(chunk, shown).c_str());
+    }
+
+    // Rest of the value
+    bool hex = shown == n && !(universal && (number == 1 || number == 6 || is_string_type(number)));
+    while (remaining) {
+        n = std::min(remaining, sizeof(chunk));
+        if ((size_t)input->sgetn((char *)chunk, n) != n) return -1;
+        remaining -= n;
+        if (hex && (!max_bytes || shown < max_bytes)) {
+            size_t k = max_bytes ? std::min(n, max_bytes - shown) : n;
+            printf("%s", hexlify(chunk, k).c_str());
+            shown += k;
+        }
+    }
+    if (shown < header.length) printf("...");
+    return 0;
+}
+
+/**
+ * @brief Dump the TLVs of a stream
+ * @return 0 on success, -1 on error
+ *
+ * Only the ends of the constructed values being dumped are kept,
+ * so that the memory used does not depend on the input.
+ */
+static int asn1dump(std::streambuf *input, size_t max_bytes)
+{
+    size_t open_end[DER_MAX_DEPTH]; // ends of the constructed values being dumped
+    size_t depth = 0;
+    size_t offset = 0;
+    while (1) {
+        // Close the constructed values that end here
+        while (depth && offset == open_end[depth - 1]) depth--;
+
+        // Values are streamed, so that lengths are not limited to INT_MAX
+        unsigned char bytes[10];
+        size_t n = input->sgetn((char *)bytes, 2);
+        if (n == 0 && depth == 0) break; // end of the input
+        Der_header header;
+        int header_size = (n == 2) ? der_parse_header(bytes, 2, header, UINT64_MAX) : 0;
+        if (header_size == 0 && n == 2) {
+            size_t n_bytes = std::min(bytes[1] & 0x7f, 8);
+            n += input->sgetn((char *)bytes + 2, n_bytes);
+            header_size = der_parse_header(bytes, n, header, UINT64_MAX);
+        }
+        if (header_size <= 0) {
+            fflush(stdout);
+            if (header_size == 0) LOGERROR("Truncated header at offset %lu", offset);
+            else LOGERROR("Invalid header at offset %lu", offset);
+            return -1;
+        }
+        if (header.length > SIZE_MAX - offset - header_size) {
+            fflush(stdout);
+            LOGERROR("Invalid length at offset %lu", offset);
+            return -1;
+        }
+        size_t end = offset + header_size + header.length;
+        if (depth && end > open_end[depth - 1]) {
+            fflush(stdout);
+            LOGERROR("Length at offset %lu exceeds the enclosing value", offset);
+            return -1;
+        }
+
+        bool constructed = header.tag & DER_CONSTRUCTED;
+        printf("%8lu d=%-2lu hl=%d l=%6llu %s: %*s%s", offset, depth, header_size, (unsigned long long)header.length,
+               constructed ? "cons" : "prim", (int)depth, "", tag_name(header.tag).c_str());
+        offset += header_size;
+        if (constructed) {
+            if (depth == DER_MAX_DEPTH) {
+                printf("\n");
+                fflush(stdout);
+                LOGERROR("Nesting too deep at offset %lu", offset - header_size);
+                return -1;
+            }
+            open_end[depth++] = end;
+        } else {
+            if (dump_primitive(input, header, max_bytes)) {
+                printf("\n");
+                fflush(stdout);
+                LOGERROR("Truncated value at offset %lu", offset - header_size);
+                return -1;
+            }
+            offset = end;
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+int cmd_asn1dump(int argc, char **argv)
+{
+    struct Arguments_asn1dump arguments;
+
+    argp_parse(&argp, argc, argv, ARGP_IN_ORDER, 0, &arguments);
+
+    std::ifstream file;
+    std::streambuf *input = std::cin.rdbuf();
+    if (!arguments.path.empty()) {
+        file.open(arguments.path, std::ifstream::in | std::ifstream::binary);
+        if (!file.good()) {
+            LOGERROR("Cannot read from '%s': %s", arguments.path.c_str(), strerror(errno));
+            return 1;
+        }
+        input = file.rdbuf();
+    }
+
+    unsigned char magic[COMPRESSION_MAGIC_MAX_SIZE];
+    size_t magic_size;
+    Compression compression = peek_compression(input, magic, magic_size);
+    Prefixed_streambuf prefixed(magic, magic_size, input);
+    input = &prefixed;
+    std::unique_ptr<Decompress_streambuf> decompress;
+    if (compression != COMPRESSION_NONE) {
+        decompress.reset(new Decompress_streambuf(compression, input));
+        input = decompress.get();
+    }
+    std::unique_ptr<Pem_decode_streambuf> pem;
+    if (input->sgetc() == '-') {
+        pem.reset(new Pem_decode_streambuf(input));
+        input = pem.get();
+    }
+
+    int err = asn1dump(input, arguments.max_bytes);
+    if (decompress && decompress->failed()) {
+        LOGERROR("Cannot decompress the input");
+        err = -1;
+    }
+    if (err) return 1;
+    return 0;
+}
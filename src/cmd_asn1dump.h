@@ -0,0 +1,6 @@
+#ifndef CMD_ASN1DUMP_H
+#define CMD_ASN1DUMP_H
+
+int cmd_asn1dump(int argc, char **argv);
+
+#endif
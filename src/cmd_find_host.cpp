@@ -0,0 +1,182 @@
+/*
+ */
+
+#include <algorithm>
+#include <argp.h>
+#include <assert.h>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string.h>
+
+#include "cmd_find_host.h"
+#include "host_index.h"
+#include "journal.h"
+#include "load.h"
+#include "oid_name.h"
+#include "parallel.h"
+
+struct Arguments_find_host {
+    std::list<std::string> hostnames;
+    std::string names_from; // empty if not given
+    std::list<std::string> certificates_paths;
+    Load_options load_options;
+    Arguments_find_host() { load_options.recursive = true; } // eg: xfon find-host HOSTNAME DIR
+};
+
+static error_t parse_opt(int key, char* arg, struct argp_state* state)
+{
+    struct Arguments_find_host *arguments = (struct Arguments_find_host *)state->input;
+    int level;
+
+    switch(key) {
+    case ARGP_KEY_INIT:
+        state->child_inputs[0] = &arguments->load_options;
+        break;
+    case 'h':
+        argp_state_help(state, state->out_stream, ARGP_HELP_STD_HELP);
+        break;
+    case 'n':
+        arguments->names_from = arg;
+        break;
+    case 'v':
+        level = journal.get_log_level();
+        level++;
+        journal.set_log_level(level);
+        break;
+    case ARGP_KEY_ARG:
+        assert(arg);
+        // The first argument is the hostname, unless given by --names-from
+        if (arguments->names_from.empty() && arguments->hostnames.empty()) arguments->hostnames.push_back(arg);
+        else arguments->certificates_paths.push_back(arg);
+        break;
+    case ARGP_KEY_END:
+        if (arguments->names_from.empty() && arguments->hostnames.empty()) argp_error(state, "Missing hostname");
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp_option options[] = {
+    { "names-from",  'n',  "FILE", 0, "Look for the hostnames listed in FILE (one per line, or - for stdin)", 1 },
+    { "verbose",     'v',  0,      0, "Be verbose (repeat for more verbosity)", 1 },
+    { "",  0, 0,  OPTION_DOC, 0, 1 },
+    { 0,  'h', 0, 0, 0, -1 },
+    { 0 }
+};
+
+static char doc[] =
+    "\n"
+    "Find the certificates that cover hostnames.\n"
+    "\n"
+    "Options:"
+    "\v"
+    "The DNS names of the subjectAltName and the common names of the subjects\n"
+    "are indexed, including wildcards (eg: *.example.com covers www.example.com,\n"
+    "but neither example.com nor a.b.example.com).\n"
+    "\n"
+    "For each certificate that covers a hostname, a line is printed:\n"
+    "HOSTNAME: LOCATION (NAME IN THE CERTIFICATE)\n"
+    "\n"
+    "Directories are walked recursively.\n"
+    "\n"
+    "The exit status is 0 if at least one hostname is covered, 1 otherwise."
+    ;
+
+static char args_doc[] = "HOSTNAME CERT ...\n--names-from=FILE CERT ...";
+
+static struct argp_child children[] = {
+    { &argp_load, 0, 0, 2 },
+    { 0 }
+};
+
+/* Entry point for command line parsing */
+static struct argp argp = { options, parse_opt, args_doc, doc, children };
+
+/**
+ * @brief Index the DNS names and common names of the certificates selected by the options
+ */
+static void index_certificates(const std::vector<Certificate_with_links> &certificates, const Load_options &options,
+                               Host_index &index)
+{
+    const ObjectIdentifier subject_alt_name = oid_get_id("id-ce-subjectAltName");
+    const ObjectIdentifier common_name = oid_get_id("id-at-commonName");
+    for (size_t i=0; i<certificates.size(); i++) {
+        if (!options.selects(certificates[i])) continue;
+        const TBSCertificate &tbs = certificates[i].tbs_certificate;
+        for (const auto &rdn: tbs.subject) {
+            for (const auto &attribute: rdn) {
+                if (attribute.type == common_name) index.add(attribute.value, i);
+            }
+        }
+        auto it = tbs.extensions.items.find(subject_alt_name);
+        if (it == tbs.extensions.items.end()) continue;
+        const GeneralNames *names = std::any_cast<GeneralNames>(&it->second.extn_value);
+        if (!names) continue;
+        for (const auto &name: names->items) {
+            if (name.tag == GENERAL_NAME_DNS) index.add(name.stringvalue, i);
+        }
+    }
+}
+
+static int read_hostnames(const std::string &path, std::list<std::string> &hostnames)
+{
+    std::ifstream file;
+    std::istream *input = &std::cin;
+    if (path != "-") {
+        file.open(path);
+        if (!file.good()) {
+            LOGERROR("Cannot read from '%s': %s", path.c_str(), strerror(errno));
+            return -1;
+        }
+        input = &file;
+    }
+    std::string line;
+    while (std::getline(*input, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) hostnames.push_back(line);
+    }
+    return 0;
+}
+
+int cmd_find_host(int argc, char **argv)
+{
+    Arguments_find_host arguments;
+
+    argp_parse(&argp, argc, argv, ARGP_IN_ORDER, 0, &arguments);
+
+    if (!arguments.names_from.empty() && read_hostnames(arguments.names_from, arguments.hostnames)) return 1;
+
+    std::vector<Certificate_with_links> certificates;
+    int err = load_certificates(arguments.certificates_paths, arguments.load_options, certificates);
+    if (err) return 1;
+
+    Host_index index;
+    index_certificates(certificates, arguments.load_options, index);
+
+    // Look up the hostnames by several threads, and print the results in order
+    std::vector<std::string> hostnames(arguments.hostnames.begin(), arguments.hostnames.end());
+    std::vector<std::vector<Host_match>> matches(hostnames.size());
+    parallel_for(hostnames.size(), [&](size_t i) {
+        index.find(hostnames[i], matches[i]);
+        std::stable_sort(matches[i].begin(), matches[i].end(), [](const Host_match &a, const Host_match &b) {
+            return a.cert < b.cert;
+        });
+    });
+
+    bool found = false;
+    for (size_t i=0; i<hostnames.size(); i++) {
+        std::set<uint32_t> printed; // a certificate may cover a hostname by several names (eg: CN and SAN)
+        for (const auto &match: matches[i]) {
+            if (!printed.insert(match.cert).second) continue;
+            printf("%s: %s (%s)\n", hostnames[i].c_str(), certificates[match.cert].get_file_location().c_str(), match.name.c_str());
+            found = true;
+        }
+    }
+
+    if (!found) return 1;
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef CMD_FIND_HOST_H
+#define CMD_FIND_HOST_H
+
+int cmd_find_host(int argc, char **argv);
+
+#endif
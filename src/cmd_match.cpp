@@ -0,0 +1,292 @@
+/*
+ */
+
+#include <argp.h>
+#include <assert.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <string.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "cmd_match.h"
+#include "der_decode_x509.h"
+#include "file_reader.h"
+#include "journal.h"
+#include "load.h"
+#include "pem_scan.h"
+#include "render_text.h"
+#include "walk.h"
+
+struct Arguments_match {
+    std::list<std::string> paths;
+    bool all; // also print the certificates that match no key nor CSR
+    Load_options load_options;
+    Arguments_match(): all(false) { load_options.recursive = true; }
+};
+
+static error_t parse_opt(int key, char* arg, struct argp_state* state)
+{
+    struct Arguments_match *arguments = (struct Arguments_match *)state->input;
+    int level;
+
+    switch(key) {
+    case ARGP_KEY_INIT:
+        state->child_inputs[0] = &arguments->load_options;
+        break;
+    case 'a':
+        arguments->all = true;
+        break;
+    case 'h':
+        argp_state_help(state, state->out_stream, ARGP_HELP_STD_HELP);
+        break;
+    case 'v':
+        level = journal.get_log_level();
+        level++;
+        journal.set_log_level(level);
+        break;
+    case ARGP_KEY_ARG:
+        assert(arg);
+        arguments->paths.push_back(arg);
+        break;
+    case ARGP_KEY_END:
+        if (arguments->paths.empty() && arguments->load_options.files_from.empty()) argp_error(state, "Missing path");
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp_option options[] = {
+    { "all",         'a',  0, 0, "Also print the certificates that match no key nor CSR", 1 },
+    { "verbose",     'v',  0, 0, "Be verbose (repeat for more verbosity)", 1 },
+    { "",  0, 0,  OPTION_DOC, 0, 1 },
+    { 0,  'h', 0, 0, 0, -1 },
+    { 0 }
+};
+
+static char doc[] =
+    "\n"
+    "Match private keys and certificate signing requests (CSR) with certificates.\n"
+    "\n"
+    "Options:"
+    "\v"
+    "The files may be PEM (several blocks per file) or DER. Directories are\n"
+    "walked recursively. Encrypted private keys cannot be matched.\n"
+    "Of the loading options, --ct, --carve, --scan-text, --scan-base64 and\n"
+    "--stats do not apply. The selection options (eg: --ext-key-usage) apply\n"
+    "to the certificates.\n"
+    "\n"
+    "Keys, CSRs and certificates are matched by their public keys (SHA-256 of\n"
+    "the SubjectPublicKeyInfo). For each key, a line is printed for each CSR\n"
+    "and certificate of the same public key, and for each CSR, a line is\n"
+    "printed for each certificate:\n"
+    "KEY-OR-CSR: LOCATION (SUBJECT)\n"
+    "The keys and CSRs that match nothing are printed with '(no match)'.\n"
+    "With --all, the certificates of no key nor CSR are printed likewise."
+    ;
+
+static char args_doc[] = "PATH ...";
+
+static struct argp_child children[] = {
+    { &argp_load, 0, 0, 2 },
+    { 0 }
+};
+
+/* Entry point for command line parsing */
+static struct argp argp = { options, parse_opt, args_doc, doc, children };
+
+enum Match_kind {
+    MATCH_KEY,
+    MATCH_CSR,
+    MATCH_CERT,
+};
+
+/* Private key, CSR or certificate found in a file */
+struct Match_item {
+    Match_kind kind;
+    std::string location;
+    std::string subject;   // of CSRs and certificates
+    std::string spki_hash; // SHA-256 of the SubjectPublicKeyInfo
+};
+
+static std::string sha256(const unsigned char *data, size_t size)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size = 0;
+    EVP_Digest(data, size, digest, &digest_size, EVP_sha256(), NULL);
+    return std::string((const char *)digest, digest_size);
+}
+
+/**
+ * @return 0 on success, 1 if the certificate is not selected by the options, -1 on error
+ */
+static int get_certificate(const OctetString &der_bytes, const Load_options &options, Match_item &item)
+{
+    Certificate cert;
+    if (der_decode_x509_certificate(der_bytes, cert)) return -1;
+    if (!options.selects(cert)) return 1;
+    const SubjectPublicKeyInfo &spki = cert.tbs_certificate.subject_public_key_info;
+    item.kind = MATCH_CERT;
+    item.subject = to_string(cert.tbs_certificate.subject);
+    item.spki_hash = sha256(cert.der_bytes.data() + spki.der_offset, spki.der_size);
+    return 0;
+}
+
+static int get_csr(const OctetString &der_bytes, Match_item &item)
+{
+    CertificationRequest csr;
+    if (der_decode_pkcs10_request(der_bytes, csr)) return -1;
+    const SubjectPublicKeyInfo &spki = csr.subject_public_key_info;
+    item.kind = MATCH_CSR;
+    item.subject = to_string(csr.subject);
+    item.spki_hash = sha256(csr.der_bytes.data() + spki.der_offset, spki.der_size);
+    return 0;
+}
+
+/**
+ * @brief Get the public key of a private key (PKCS#8, or traditional RSA, DSA, EC)
+ */
+static int get_private_key(const OctetString &der_bytes, Match_item &item)
+{
+    const unsigned char *der = der_bytes.data();
+    EVP_PKEY *pkey = d2i_AutoPrivateKey(NULL, &der, der_bytes.size());
+    if (!pkey) return -1;
+    unsigned char *spki = NULL;
+    int spki_size = i2d_PUBKEY(pkey, &spki);
+    EVP_PKEY_free(pkey);
+    if (spki_size <= 0) return -1;
+    item.kind = MATCH_KEY;
+    item.spki_hash = sha256(spki, spki_size);
+    OPENSSL_free(spki);
+    return 0;
+}
+
+/**
+ * @brief Get the private keys, CSRs and certificates of a file
+ *
+ * Other PEM blocks and other files are ignored.
+ */
+static void get_match_items(const std::string &path, const OctetString &data, const Load_options &options,
+                            std::vector<Match_item> &items)
+{
+    std::vector<Pem_block> pem_items;
+    scan_pem_blocks_of_any_type(data.data(), data.size(), path.c_str(), pem_items);
+
+    // Decoding failures are expected (eg: DER files that are not certificates)
+    journal.set_muted(true);
+    if (pem_items.empty()) {
+        Match_item item;
+        int err = get_certificate(data, options, item);
+        if (err < 0) err = get_csr(data, item);
+        if (err < 0) err = get_private_key(data, item);
+        if (!err) items.push_back(item);
+    }
+    for (const auto &pem_item: pem_items) {
+        Match_item item;
+        int err = -1;
+        if (pem_item.type == "CERTIFICATE" || pem_item.type == "X509 CERTIFICATE") {
+            err = get_certificate(pem_item.der_bytes, options, item);
+        } else if (pem_item.type == "CERTIFICATE REQUEST" || pem_item.type == "NEW CERTIFICATE REQUEST") {
+            err = get_csr(pem_item.der_bytes, item);
+        } else if (pem_item.type == "ENCRYPTED PRIVATE KEY" || pem_item.encrypted) {
+            journal.set_muted(false);
+            LOGWARNING("%s: encrypted private key cannot be matched", path.c_str());
+            journal.set_muted(true);
+        } else if (pem_item.type.size() >= 11 && 0 == pem_item.type.compare(pem_item.type.size() - 11, 11, "PRIVATE KEY")) {
+            err = get_private_key(pem_item.der_bytes, item);
+        } else {
+            continue;
+        }
+        if (!err) items.push_back(item);
+    }
+    journal.set_muted(false);
+
+    for (size_t i=0; i<items.size(); i++) {
+        items[i].location = items.size() > 1 ? path + ":" + std::to_string(i) : path;
+    }
+}
+
+static void print_match(const Match_item &left, const Match_item &right)
+{
+    printf("%s: %s (%s)\n", left.location.c_str(), right.location.c_str(), right.subject.c_str());
+}
+
+int cmd_match(int argc, char **argv)
+{
+    Arguments_match arguments;
+
+    argp_parse(&argp, argc, argv, ARGP_IN_ORDER, 0, &arguments);
+    const Load_options &load_options = arguments.load_options;
+
+    std::list<std::string> all_paths = arguments.paths;
+    if (!load_options.files_from.empty()) {
+        if (read_files_from(load_options.files_from, load_options.null_separated, all_paths)) return 1;
+    }
+    std::vector<Input_file> files;
+    std::vector<std::string> skipped_paths;
+    if (walk_paths(all_paths, load_options.recursive, files, load_options.keep_going ? &skipped_paths : 0)) return 1;
+    for (const auto &location: skipped_paths) LOGWARNING("Cannot load file: %s (skipped)", location.c_str());
+
+    // Read and decode the files by several threads
+    std::vector<std::string> paths;
+    for (const auto &file: files) paths.push_back(file.path);
+    std::vector<std::vector<Match_item>> file_items(files.size());
+    std::vector<int> file_errors(files.size(), 0);
+    Read_stats stats;
+    int err = read_files(paths, load_options.io_backend, [&](size_t i, const OctetString &data, int read_err) {
+        if (read_err && load_options.keep_going) {
+            LOGWARNING("Cannot load file: %s: %s (skipped)", paths[i].c_str(), strerror(read_err));
+            return;
+        }
+        if (read_err) {
+            LOGERROR("Cannot read from '%s': %s", paths[i].c_str(), strerror(read_err));
+            file_errors[i] = -1;
+            return;
+        }
+        get_match_items(paths[i], data, load_options, file_items[i]);
+    }, stats);
+    if (err) return 1;
+    for (int file_error: file_errors) {
+        if (file_error) return 1;
+    }
+
+    // Index the CSRs and certificates by public key
+    std::vector<const Match_item*> items;
+    std::unordered_map<std::string, std::vector<const Match_item*>> csrs;
+    std::unordered_map<std::string, std::vector<const Match_item*>> certs;
+    std::unordered_set<std::string> keys;
+    for (const auto &items_of_file: file_items) {
+        for (const auto &item: items_of_file) {
+            items.push_back(&item);
+            if (item.kind == MATCH_KEY) keys.insert(item.spki_hash);
+            else if (item.kind == MATCH_CSR) csrs[item.spki_hash].push_back(&item);
+            else if (item.kind == MATCH_CERT) certs[item.spki_hash].push_back(&item);
+        }
+    }
+
+    static const std::vector<const Match_item*> none;
+    std::unordered_set<std::string> matched; // public keys of the keys and CSRs
+    for (const Match_item *item: items) {
+        if (item->kind == MATCH_CERT) continue;
+        auto it_csrs = csrs.find(item->spki_hash);
+        auto it_certs = certs.find(item->spki_hash);
+        const auto &item_csrs = (item->kind == MATCH_KEY && it_csrs != csrs.end()) ? it_csrs->second : none;
+        const auto &item_certs = (it_certs != certs.end()) ? it_certs->second : none;
+        for (const Match_item *csr: item_csrs) print_match(*item, *csr);
+        for (const Match_item *cert: item_certs) print_match(*item, *cert);
+        bool has_key = item->kind == MATCH_CSR && keys.count(item->spki_hash);
+        if (item_csrs.empty() && item_certs.empty() && !has_key) printf("%s: (no match)\n", item->location.c_str());
+        matched.insert(item->spki_hash);
+    }
+    if (arguments.all) {
+        for (const Match_item *item: items) {
+            if (item->kind == MATCH_CERT && !matched.count(item->spki_hash)) {
+                printf("%s: (no match) (%s)\n", item->location.c_str(), item->subject.c_str());
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef CMD_MATCH_H
+#define CMD_MATCH_H
+
+int cmd_match(int argc, char **argv);
+
+#endif
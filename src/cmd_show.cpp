@@ -6,6 +6,7 @@
 
 #include "cli.h"
 #include "cmd_show.h"
+#include "fingerprint.h"
 #include "hierarchy.h"
 #include "journal.h"
 #include "load.h"
@@ -14,6 +15,7 @@
 struct Arguments_show {
     std::string command;
     std::list<std::string> certificates_paths;
+    Load_options load_options;
 };
 
 static error_t parse_opt(int key, char* arg, struct argp_state* state)
@@ -22,6 +24,9 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state)
     int level;
 
     switch(key) {
+    case ARGP_KEY_INIT:
+        state->child_inputs[0] = &arguments->load_options;
+        break;
     case 'h':
         argp_state_help(state, state->out_stream, ARGP_HELP_STD_HELP);
         break;
@@ -69,13 +74,19 @@ static char doc[] =
     "\n"
     "Options:"
     "\v"
-    "Certificates can be bundles of several concatenated certificates."
+    "Certificates can be bundles of several concatenated certificates.\n"
+    "Directories are walked with --recursive."
     ;
 
 static char args_doc[] = "CERT ...";
 
+static struct argp_child children[] = {
+    { &argp_load, 0, 0, 2 },
+    { 0 }
+};
+
 /* Entry point for command line parsing */
-struct argp argp = { options, parse_opt, args_doc, doc };
+struct argp argp = { options, parse_opt, args_doc, doc, children };
 
 int cmd_show(int argc, char **argv)
 {
@@ -85,13 +96,20 @@ int cmd_show(int argc, char **argv)
 
     std::vector<Certificate_with_links> certificates;
 
-    int err = load_certificates(arguments.certificates_paths, certificates);
+    int err = load_certificates(arguments.certificates_paths, arguments.load_options, certificates);
 
     if (err) return 1;
 
-    bool single_cert = (certificates.size() == 1);
-    for (auto cert: certificates) {
-        print_cert(cert, single_cert);
+    compute_fingerprints(certificates);
+
+    std::vector<const Certificate_with_links*> selected;
+    for (const auto &cert: certificates) {
+        if (arguments.load_options.selects(cert)) selected.push_back(&cert);
+    }
+
+    bool single_cert = (selected.size() == 1);
+    for (const Certificate_with_links *cert: selected) {
+        print_cert(*cert, single_cert);
     }
 
     if (err) return 1;
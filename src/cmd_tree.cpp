@@ -6,16 +6,27 @@
 
 #include "cli.h"
 #include "cmd_tree.h"
+#include "crl.h"
 #include "hierarchy.h"
 #include "journal.h"
 #include "load.h"
+#include "path_validation.h"
 #include "render_text.h"
 
+enum {
+    OPT_VALIDATE = 0x200, // after the options of argp_load
+    OPT_AT,
+};
+
 struct Arguments_tree {
     std::string command;
     std::list<std::string> certificates_paths;
+    std::list<std::string> crl_paths;
+    Load_options load_options;
     bool minimal;
-    Arguments_tree(): minimal(false) {}
+    bool validate;
+    std::string validation_time; // empty for the current time
+    Arguments_tree(): minimal(false), validate(false) {}
 };
 
 static error_t parse_opt(int key, char* arg, struct argp_state* state)
@@ -24,12 +35,25 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state)
     int level;
 
     switch(key) {
+    case ARGP_KEY_INIT:
+        state->child_inputs[0] = &arguments->load_options;
+        break;
     case 'h':
         argp_state_help(state, state->out_stream, ARGP_HELP_STD_HELP);
         break;
+    case 'c':
+        arguments->crl_paths.push_back(arg);
+        break;
     case 'm':
         arguments->minimal = true;
         break;
+    case OPT_VALIDATE:
+        arguments->validate = true;
+        break;
+    case OPT_AT:
+        if (parse_validation_time(arg, arguments->validation_time)) argp_error(state, "Invalid time '%s'", arg);
+        arguments->validate = true;
+        break;
     case 'v':
         level = journal.get_log_level();
         level++;
@@ -49,8 +73,11 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state)
 }
 
 static struct argp_option options[] = {
+    { "crl",         'c',  "FILE", 0, "Flag the certificates revoked by the CRLs of FILE (may be repeated)", 1 },
     { "minimal",     'm',  0, 0, "Print a minimal tree", 1 },
     { "properties",  'p',  "PROP[,PROP]...",  0, "Properties to show (implies not minimal)", 1 },
+    { "validate",    OPT_VALIDATE, 0,         0, "Validate the path of each certificate (RFC 5280)", 1 },
+    { "at",          OPT_AT, "TIME",          0, "Validate at TIME (YYYY-MM-DD[ hh:mm:ss], UTC) instead of now (implies --validate)", 1 },
     { "verbose",     'v',  0,                 0, "Be verbose (repeat for more verbosity)", 1 },
     { "",  0, 0,  OPTION_DOC, 0, 1 },
     { 0,  'h', 0, 0, 0, -1 },
@@ -63,13 +90,32 @@ static char doc[] =
     "\n"
     "Options:"
     "\v"
-    "Certificates can be bundles of several concatenated certificates (DER or PEM)."
+    "Certificates can be bundles of several concatenated certificates (DER or PEM).\n"
+    "Directories are walked with --recursive.\n"
+    "\n"
+    "The CRLs (DER or PEM, possibly compressed) must be signed by one of the\n"
+    "certificates. They are read as streams: their size is not limited by the memory.\n"
+    "\n"
+    "With --validate, the roots of the tree are the trust anchors, and each\n"
+    "certificate is flagged valid or invalid, with the reason: validity dates,\n"
+    "revocation (with --crl), basicConstraints, keyUsage keyCertSign,\n"
+    "pathLenConstraint, unsupported critical extensions, or invalid issuer.\n"
+    "The exit status is then 1 if a certificate is not valid.\n"
+    "\n"
+    "With --key-usage, --ext-key-usage, --policy or --ca, the selected\n"
+    "certificates are printed with their ancestors. The hierarchy and its\n"
+    "validation take all the certificates into account."
     ;
 
 static char args_doc[] = "CERT ...";
 
+static struct argp_child children[] = {
+    { &argp_load, 0, 0, 2 },
+    { 0 }
+};
+
 /* Entry point for command line parsing */
-static struct argp argp = { options, parse_opt, args_doc, doc };
+static struct argp argp = { options, parse_opt, args_doc, doc, children };
 
 int cmd_tree(int argc, char **argv)
 {
@@ -79,7 +125,7 @@ int cmd_tree(int argc, char **argv)
 
     std::vector<Certificate_with_links> certificates;
 
-    int err = load_certificates(arguments.certificates_paths, certificates);
+    int err = load_certificates(arguments.certificates_paths, arguments.load_options, certificates);
 
     if (err) return 1;
 
@@ -87,8 +133,22 @@ int cmd_tree(int argc, char **argv)
 
     compute_hierarchy(certificates);
 
-    print_tree(certificates, arguments.minimal);
+    if (!arguments.crl_paths.empty()) {
+        Revocation_index revocations;
+        for (const auto &path: arguments.crl_paths) {
+            if (load_crl(path, certificates, revocations)) return 1;
+        }
+        mark_revoked(certificates, revocations);
+    }
+
+    size_t n_invalid = 0;
+    if (arguments.validate) {
+        if (arguments.validation_time.empty()) arguments.validation_time = get_current_time();
+        n_invalid = validate_paths(certificates, arguments.validation_time);
+    }
+
+    print_tree(certificates, arguments.minimal, arguments.load_options.filter);
 
-    if (err) return EXIT_FAILURE;
+    if (err || n_invalid) return EXIT_FAILURE;
     return EXIT_SUCCESS;
 }
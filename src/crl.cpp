@@ -0,0 +1,507 @@
+#include <errno.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <openssl/evp.h>
+#include <openssl/objects.h>
+#include <openssl/x509.h>
+#include <string.h>
+#include <string_view>
+
+#include "crl.h"
+#include "decompress.h"
+#include "der_decode_x509.h"
+#include "der_tape.h"
+#include "journal.h"
+#include "oid_name.h"
+#include "pem_scan.h"
+
+#define SERIAL_SET_MIN_SLOTS 1024
+#define CRL_MAX_ENTRY_SIZE 65536     // an entry of revokedCertificates (serial, date, extensions)
+#define CRL_DIGEST_CHUNK_SIZE 65536  // bytes passed at once to the message digest
+
+static uint64_t hash_serial(const unsigned char *serial, size_t size)
+{
+    return std::hash<std::string_view>()(std::string_view((const char *)serial, size));
+}
+
+/**
+ * @brief Find the slot of a serial, or the empty slot where it would be inserted
+ */
+size_t Serial_set::find(const unsigned char *serial, size_t size, uint64_t hash) const
+{
+    size_t mask = slots.size() - 1;
+    uint32_t tag = hash >> 32;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        const Slot &slot = slots[i];
+        if (!slot.offset) return i;
+        if (slot.tag == tag && serials[slot.offset - 1] == size
+            && 0 == memcmp(serials.data() + slot.offset, serial, size)) {
+            return i;
+        }
+    }
+}
+
+void Serial_set::grow()
+{
+    std::vector<Slot> old_slots(std::max(slots.size() * 2, (size_t)SERIAL_SET_MIN_SLOTS));
+    old_slots.swap(slots);
+    for (const Slot &slot: old_slots) {
+        if (!slot.offset) continue;
+        const unsigned char *serial = serials.data() + slot.offset;
+        size_t size = serials[slot.offset - 1];
+        slots[find(serial, size, hash_serial(serial, size))] = slot;
+    }
+}
+
+/**
+ * @brief Insert a serial number, if not already in the set
+ * @return 0 on success, -1 if the serial is too long
+ */
+int Serial_set::insert(const unsigned char *serial, size_t size)
+{
+    if (size > UINT8_MAX || serials.size() + 1 + size >= UINT32_MAX) return -1;
+    if ((count + 1) * 4 > slots.size() * 3) grow();
+    uint64_t hash = hash_serial(serial, size);
+    size_t i = find(serial, size, hash);
+    if (slots[i].offset) return 0;
+    serials += (unsigned char)size;
+    slots[i].tag = hash >> 32;
+    slots[i].offset = serials.size();
+    serials.append(serial, size);
+    count++;
+    return 0;
+}
+
+bool Serial_set::contains(const unsigned char *serial, size_t size) const
+{
+    if (slots.empty()) return false;
+    return slots[find(serial, size, hash_serial(serial, size))].offset != 0;
+}
+
+void Serial_set::merge(const Serial_set &other)
+{
+    size_t pos = 0;
+    while (pos < other.serials.size()) {
+        size_t size = other.serials[pos];
+        insert(other.serials.data() + pos + 1, size);
+        pos += 1 + size;
+    }
+}
+
+void Revocation_index::add(const Certificate_with_links *issuer, Serial_set &&serials)
+{
+    auto it = revoked.find(issuer);
+    if (it == revoked.end()) revoked.emplace(issuer, std::move(serials));
+    else it->second.merge(serials);
+}
+
+/**
+ * @brief Get back the contents of an INTEGER, from its representation (eg: "0x0102", "-0x01")
+ */
+static OctetString integer_bytes(const Integer &value)
+{
+    bool negative = !value.empty() && value[0] == '-';
+    OctetString bytes;
+    for (size_t i = negative ? 3 : 2; i + 1 < value.size(); i += 2) {
+        bytes += (unsigned char)strtoul(value.substr(i, 2).c_str(), NULL, 16);
+    }
+    if (negative) {
+        // Two's complement: flip all bits and add 1
+        for (auto &byte: bytes) byte = ~byte;
+        for (size_t i = bytes.size(); i-- > 0; ) {
+            if (++bytes[i]) break;
+        }
+    }
+    return bytes;
+}
+
+/**
+ * @brief Tell if a certificate is listed in a verified CRL of one of its parents
+ */
+bool Revocation_index::is_revoked(const Certificate_with_links &cert) const
+{
+    if (revoked.empty()) return false;
+    OctetString serial = integer_bytes(cert.tbs_certificate.serial_number);
+    for (const Certificate_with_links *parent: cert.parents) {
+        auto it = revoked.find(parent);
+        if (it != revoked.end() && it->second.contains(serial.data(), serial.size())) return true;
+    }
+    return false;
+}
+
+void mark_revoked(std::vector<Certificate_with_links> &certificates, const Revocation_index &index)
+{
+    for (auto &cert: certificates) cert.revoked = index.is_revoked(cert);
+}
+
+/* Reader of the TLVs of a DER stream
+ *
+ * The bytes read are passed to a message digest while digesting is on.
+ * They are kept until the digest is known (see set_digest()), as the
+ * algorithm is given in the tbsCertList itself.
+ */
+class Der_stream_reader {
+public:
+    Der_stream_reader(std::streambuf *input): offset(0), input(input), digesting(false), md_ctx(0) {}
+    size_t offset; // of the next byte to read
+
+    int peek() { return input->sgetc(); }
+    int read(unsigned char *data, size_t size);
+    int read_header(Der_header &header);
+    int read_value(const Der_header &header, size_t max, OctetString &value);
+    int read_tlv(size_t max, Der_header &header, OctetString &tlv);
+    void start_digest() { digesting = true; }
+    int set_digest(EVP_MD_CTX *ctx);
+    int stop_digest();
+
+private:
+    std::streambuf *input;
+    bool digesting;
+    EVP_MD_CTX *md_ctx;  // null until the algorithm is known
+    OctetString pending; // bytes not digested yet
+};
+
+int Der_stream_reader::read(unsigned char *data, size_t size)
+{
+    if ((size_t)input->sgetn((char *)data, size) != size) return -1;
+    offset += size;
+    if (!digesting) return 0;
+    pending.append(data, size);
+    if (md_ctx && pending.size() >= CRL_DIGEST_CHUNK_SIZE) {
+        if (1 != EVP_DigestUpdate(md_ctx, pending.data(), pending.size())) return -1;
+        pending.clear();
+    }
+    return 0;
+}
+
+/**
+ * @return 0 on success, -1 on error (truncated or invalid header)
+ */
+int Der_stream_reader::read_header(Der_header &header)
+{
+    unsigned char bytes[6];
+    if (read(bytes, 2)) return -1;
+    int header_size = der_parse_header(bytes, 2, header);
+    if (header_size == 0) {
+        size_t n_bytes = bytes[1] & 0x7f;
+        if (n_bytes > sizeof(bytes) - 2 || read(bytes + 2, n_bytes)) return -1;
+        header_size = der_parse_header(bytes, 2 + n_bytes, header);
+    }
+    if (header_size <= 0) return -1;
+    return 0;
+}
+
+/**
+ * @brief Read the value of a TLV whose header has been read
+ * @return 0 on success, -1 if the value is truncated or longer than max
+ */
+int Der_stream_reader::read_value(const Der_header &header, size_t max, OctetString &value)
+{
+    if (header.length > max) return -1;
+    value.resize(header.length);
+    return read(&value[0], header.length);
+}
+
+/**
+ * @brief Read a whole TLV (header and value)
+ */
+int Der_stream_reader::read_tlv(size_t max, Der_header &header, OctetString &tlv)
+{
+    size_t start = offset;
+    if (read_header(header)) return -1;
+    OctetString value;
+    if (read_value(header, max, value)) return -1;
+    // Re-encode the header, as it is not kept
+    unsigned char bytes[6];
+    size_t header_size = offset - start - value.size();
+    bytes[0] = header.tag;
+    if (header_size == 2) {
+        bytes[1] = header.length;
+    } else {
+        bytes[1] = 0x80 | (header_size - 2);
+        for (size_t i = 0; i < header_size - 2; i++) bytes[header_size - 1 - i] = header.length >> (8 * i);
+    }
+    tlv.assign(bytes, header_size);
+    tlv += value;
+    return 0;
+}
+
+int Der_stream_reader::set_digest(EVP_MD_CTX *ctx)
+{
+    md_ctx = ctx;
+    if (1 != EVP_DigestUpdate(md_ctx, pending.data(), pending.size())) return -1;
+    pending.clear();
+    return 0;
+}
+
+int Der_stream_reader::stop_digest()
+{
+    digesting = false;
+    if (!md_ctx) return -1;
+    if (1 != EVP_DigestUpdate(md_ctx, pending.data(), pending.size())) return -1;
+    pending.clear();
+    return 0;
+}
+
+/**
+ * @brief Get the digest of a signature algorithm (eg: SHA-256 for sha256WithRSAEncryption)
+ * @param algorithm  DER encoded AlgorithmIdentifier
+ * @return null if not supported
+ */
+static const EVP_MD *get_signature_digest(const OctetString &algorithm)
+{
+    const unsigned char *der_bytes = algorithm.data();
+    X509_ALGOR *algor = d2i_X509_ALGOR(NULL, &der_bytes, algorithm.size());
+    if (!algor) return NULL;
+    const ASN1_OBJECT *obj;
+    X509_ALGOR_get0(&obj, NULL, NULL, algor);
+    int md_nid = NID_undef;
+    int pkey_nid;
+    const EVP_MD *md = NULL;
+    if (OBJ_find_sigid_algs(OBJ_obj2nid(obj), &md_nid, &pkey_nid) && md_nid != NID_undef) {
+        md = EVP_get_digestbynid(md_nid);
+    }
+    X509_ALGOR_free(algor);
+    return md;
+}
+
+/**
+ * @brief Verify the signature of a CRL, given the digest of its tbsCertList
+ */
+static bool verify_crl_signature(const Certificate_with_links &issuer, const EVP_MD *md,
+                                 const unsigned char *digest, size_t digest_size, const OctetString &signature)
+{
+    const unsigned char *der_bytes = issuer.der_bytes.data();
+    X509 *x509 = d2i_X509(NULL, &der_bytes, issuer.der_bytes.size());
+    if (!x509) {
+        LOGERROR("d2i_X509: Cannot load certificate %s", issuer.get_file_location().c_str());
+        return false;
+    }
+    bool result = false;
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *pubkey = X509_get0_pubkey(x509);
+    if (pubkey) ctx = EVP_PKEY_CTX_new(pubkey, NULL);
+    if (ctx && EVP_PKEY_verify_init(ctx) > 0 && EVP_PKEY_CTX_set_signature_md(ctx, md) > 0) {
+        result = (1 == EVP_PKEY_verify(ctx, signature.data(), signature.size(), digest, digest_size));
+    }
+    EVP_PKEY_CTX_free(ctx);
+    X509_free(x509);
+    return result;
+}
+
+/**
+ * @brief Tell if a certificate may sign CRLs (cRLSign, if it has a keyUsage)
+ */
+static bool may_sign_crl(const Certificate_with_links &cert)
+{
+    static const ObjectIdentifier key_usage_oid = oid_get_id("id-ce-keyUsage");
+    auto it = cert.tbs_certificate.extensions.items.find(key_usage_oid);
+    if (it == cert.tbs_certificate.extensions.items.end()) return true;
+    const KeyUsage *key_usage = std::any_cast<KeyUsage>(&it->second.extn_value);
+    return key_usage && (*key_usage & KEY_USAGE_CRL_SIGN);
+}
+
+/**
+ * @brief Decode a CRL from a stream, and verify it against its issuer
+ * @return 0 on success, -1 on error
+ *
+ * CertificateList  ::=  SEQUENCE  {
+ *      tbsCertList          TBSCertList,
+ *      signatureAlgorithm   AlgorithmIdentifier,
+ *      signatureValue       BIT STRING  }
+ *
+ * TBSCertList  ::=  SEQUENCE  {
+ *      version                 Version OPTIONAL,
+ *      signature               AlgorithmIdentifier,
+ *      issuer                  Name,
+ *      thisUpdate              Time,
+ *      nextUpdate              Time OPTIONAL,
+ *      revokedCertificates     SEQUENCE OF SEQUENCE  {
+ *           userCertificate         CertificateSerialNumber,
+ *           revocationDate          Time,
+ *           crlEntryExtensions      Extensions OPTIONAL
+ *      }  OPTIONAL,
+ *      crlExtensions           [0]  EXPLICIT Extensions OPTIONAL }
+ *
+ * The entries are read one by one, and the tbsCertList is digested as it
+ * is read, so that the memory used depends only on the number of serials.
+ */
+static int load_crl(Der_stream_reader &reader, const std::string &location,
+                    const std::vector<Certificate_with_links> &certificates, Revocation_index &index)
+{
+    size_t max_size = der_get_limit(DER_LIMIT_CERT_SIZE); // of the fields other than revokedCertificates
+    Der_header header;
+    OctetString value;
+
+    if (reader.read_header(header) || header.tag != (V_ASN1_SEQUENCE | DER_CONSTRUCTED)) {
+        LOGERROR("%s: Cannot decode CertificateList header", location.c_str());
+        return -1;
+    }
+    size_t crl_end = reader.offset + header.length;
+
+    reader.start_digest();
+    if (reader.read_header(header) || header.tag != (V_ASN1_SEQUENCE | DER_CONSTRUCTED)) {
+        LOGERROR("%s: Cannot decode tbsCertList header", location.c_str());
+        return -1;
+    }
+    size_t tbs_end = reader.offset + header.length;
+
+    OctetString algorithm;
+    if (reader.peek() == V_ASN1_INTEGER && reader.read_tlv(max_size, header, value)) {
+        LOGERROR("%s: Cannot decode version", location.c_str());
+        return -1;
+    }
+    if (reader.read_tlv(max_size, header, algorithm) || header.tag != (V_ASN1_SEQUENCE | DER_CONSTRUCTED)) {
+        LOGERROR("%s: Cannot decode signature", location.c_str());
+        return -1;
+    }
+    const EVP_MD *md = get_signature_digest(algorithm);
+    if (!md) {
+        LOGERROR("%s: Unsupported signature algorithm", location.c_str());
+        return -1;
+    }
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> md_ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    if (!md_ctx || 1 != EVP_DigestInit_ex(md_ctx.get(), md, NULL) || reader.set_digest(md_ctx.get())) {
+        LOGERROR("%s: Cannot initialize digest", location.c_str());
+        return -1;
+    }
+
+    OctetString issuer_bytes;
+    Name issuer;
+    if (reader.read_tlv(max_size, header, issuer_bytes) || der_decode_x509_name(issuer_bytes, issuer)) {
+        LOGERROR("%s: Cannot decode issuer", location.c_str());
+        return -1;
+    }
+    Name_key issuer_key = compute_name_key(issuer);
+
+    // thisUpdate, and nextUpdate if present
+    if (reader.read_tlv(max_size, header, value)) {
+        LOGERROR("%s: Cannot decode thisUpdate", location.c_str());
+        return -1;
+    }
+    int tag = reader.peek();
+    if (reader.offset < tbs_end && (tag == V_ASN1_UTCTIME || tag == V_ASN1_GENERALIZEDTIME)
+        && reader.read_tlv(max_size, header, value)) {
+        LOGERROR("%s: Cannot decode nextUpdate", location.c_str());
+        return -1;
+    }
+
+    Serial_set serials;
+    if (reader.offset < tbs_end && reader.peek() == (V_ASN1_SEQUENCE | DER_CONSTRUCTED)) {
+        if (reader.read_header(header)) {
+            LOGERROR("%s: Cannot decode revokedCertificates", location.c_str());
+            return -1;
+        }
+        size_t list_end = reader.offset + header.length;
+        while (reader.offset < list_end) {
+            size_t entry_offset = reader.offset;
+            Der_header serial_header;
+            int serial_header_size = -1;
+            if (!reader.read_header(header) && !reader.read_value(header, CRL_MAX_ENTRY_SIZE, value)) {
+                serial_header_size = der_parse_header(value.data(), value.size(), serial_header);
+            }
+            if (serial_header_size <= 0 || serial_header.tag != V_ASN1_INTEGER
+                || serial_header_size + serial_header.length > value.size()
+                || serials.insert(value.data() + serial_header_size, serial_header.length)) {
+                LOGERROR("%s: Cannot decode revoked certificate at offset %lu", location.c_str(), entry_offset);
+                return -1;
+            }
+        }
+        if (reader.offset != list_end) {
+            LOGERROR("%s: Invalid length of revokedCertificates", location.c_str());
+            return -1;
+        }
+    }
+
+    // crlExtensions
+    if (reader.offset < tbs_end && reader.read_tlv(max_size, header, value)) {
+        LOGERROR("%s: Cannot decode crlExtensions", location.c_str());
+        return -1;
+    }
+    if (reader.offset != tbs_end || reader.stop_digest()) {
+        LOGERROR("%s: Invalid length of tbsCertList", location.c_str());
+        return -1;
+    }
+
+    OctetString signature;
+    if (reader.read_tlv(max_size, header, value) || reader.read_header(header) || header.tag != V_ASN1_BIT_STRING
+        || reader.read_value(header, max_size, signature) || signature.empty() || reader.offset != crl_end) {
+        LOGERROR("%s: Cannot decode signature", location.c_str());
+        return -1;
+    }
+    signature.erase(0, 1); // number of unused bits
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size;
+    if (1 != EVP_DigestFinal_ex(md_ctx.get(), digest, &digest_size)) {
+        LOGERROR("%s: Cannot compute digest", location.c_str());
+        return -1;
+    }
+
+    // Verify against the certificates whose subject is the issuer of the CRL
+    for (const auto &cert: certificates) {
+        if (cert.tbs_certificate.subject_key != issuer_key || !may_sign_crl(cert)) continue;
+        if (verify_crl_signature(cert, md, digest, digest_size, signature)) {
+            LOGINFO("%s: %lu revoked certificates, verified by %s", location.c_str(), serials.size(),
+                    cert.get_file_location().c_str());
+            index.add(&cert, std::move(serials));
+            return 0;
+        }
+    }
+    LOGERROR("%s: CRL not verified by any issuer", location.c_str());
+    return -1;
+}
+
+/**
+ * @brief Load the CRLs of a file (DER or PEM, possibly compressed), and index their revoked serials
+ * @param certificates  The candidate issuers
+ * @return 0 on success, -1 on error
+ */
+int load_crl(const std::string &path, const std::vector<Certificate_with_links> &certificates, Revocation_index &index)
+{
+    std::ifstream file;
+    std::streambuf *input = std::cin.rdbuf();
+    if (path != "-") {
+        file.open(path, std::ifstream::in | std::ifstream::binary);
+        if (!file.good()) {
+            LOGERROR("Cannot read from '%s': %s", path.c_str(), strerror(errno));
+            return -1;
+        }
+        input = file.rdbuf();
+    }
+
+    unsigned char magic[COMPRESSION_MAGIC_MAX_SIZE];
+    size_t magic_size;
+    Compression compression = peek_compression(input, magic, magic_size);
+    Prefixed_streambuf prefixed(magic, magic_size, input);
+    input = &prefixed;
+    std::unique_ptr<Decompress_streambuf> decompress;
+    if (compression != COMPRESSION_NONE) {
+        decompress.reset(new Decompress_streambuf(compression, input));
+        input = decompress.get();
+    }
+    std::unique_ptr<Pem_decode_streambuf> pem;
+    if (input->sgetc() == '-') {
+        pem.reset(new Pem_decode_streambuf(input));
+        input = pem.get();
+    }
+
+    // Several CRLs may be concatenated
+    size_t n_crls = 0;
+    while (input->sgetc() != std::char_traits<char>::eof()) {
+        Der_stream_reader reader(input);
+        std::string location = n_crls ? path + ":" + std::to_string(n_crls) : path;
+        if (load_crl(reader, location, certificates, index)) return -1;
+        n_crls++;
+    }
+    if (decompress && decompress->failed()) {
+        LOGERROR("%s: Cannot decompress", path.c_str());
+        return -1;
+    }
+    if (!n_crls) {
+        LOGERROR("%s: No CRL", path.c_str());
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef CRL_H
+#define CRL_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hierarchy.h"
+#include "util.h"
+
+/* Set of serial numbers (contents of their INTEGER)
+ *
+ * The serials are stored one after the other in a single buffer, and
+ * found by open addressing, so that CRLs of millions of entries take
+ * little more memory than their serials, and each lookup is O(1).
+ */
+class Serial_set {
+public:
+    Serial_set(): count(0) {}
+    int insert(const unsigned char *serial, size_t size);
+    bool contains(const unsigned char *serial, size_t size) const;
+    size_t size() const { return count; }
+    void merge(const Serial_set &other);
+
+private:
+    struct Slot {
+        uint32_t tag;    // high bits of the hash
+        uint32_t offset; // of the serial in the buffer, plus 1 (0 if the slot is empty)
+    };
+    size_t find(const unsigned char *serial, size_t size, uint64_t hash) const;
+    void grow();
+
+    OctetString serials; // each serial: 1 byte of size, then its bytes
+    std::vector<Slot> slots;
+    size_t count;
+};
+
+/* Serial numbers revoked by each issuer, from their verified CRLs */
+class Revocation_index {
+public:
+    void add(const Certificate_with_links *issuer, Serial_set &&serials);
+    bool is_revoked(const Certificate_with_links &cert) const;
+    bool empty() const { return revoked.empty(); }
+
+private:
+    std::unordered_map<const Certificate_with_links*, Serial_set> revoked;
+};
+
+int load_crl(const std::string &path, const std::vector<Certificate_with_links> &certificates, Revocation_index &index);
+void mark_revoked(std::vector<Certificate_with_links> &certificates, const Revocation_index &index);
+
+#endif // CRL_H
@@ -0,0 +1,294 @@
+#include <ctype.h>
+#include <string.h>
+
+#include "ct.h"
+#include "journal.h"
+
+// RFC 6962
+#define CT_LEAF_VERSION_V1 0
+#define CT_LEAF_TIMESTAMPED_ENTRY 0
+#define CT_X509_ENTRY 0
+#define CT_PRECERT_ENTRY 1
+#define CT_ISSUER_KEY_HASH_SIZE 32
+
+// static-ct-api
+#define CT_EXTENSION_LEAF_INDEX 0
+#define CT_LEAF_INDEX_SIZE 5
+#define CT_FINGERPRINT_SIZE 32
+#define CT_TILE_WIDTH 256
+
+/* Reader of TLS encoded structures (RFC 8446 section 3), from memory or from a stream */
+class Tls_reader {
+public:
+    Tls_reader(const OctetString &data): data(data.data()), size(data.size()), pos(0), stream(0) {}
+    Tls_reader(std::streambuf *stream): data(0), size(0), pos(0), stream(stream) {}
+
+    bool at_end() {
+        if (stream) return stream->sgetc() == std::char_traits<char>::eof();
+        return pos >= size;
+    }
+
+    int get_bytes(size_t n, unsigned char *bytes) {
+        if (stream) {
+            if ((size_t)stream->sgetn((char *)bytes, n) != n) return -1;
+            return 0;
+        }
+        if (n > size - pos) return -1;
+        memcpy(bytes, data + pos, n);
+        pos += n;
+        return 0;
+    }
+
+    /* Get a big-endian unsigned integer of n bytes (n <= 8) */
+    int get_uint(size_t n, unsigned long long &value) {
+        unsigned char bytes[8];
+        if (get_bytes(n, bytes)) return -1;
+        value = 0;
+        for (size_t i=0; i<n; i++) value = (value << 8) | bytes[i];
+        return 0;
+    }
+
+    /* Get a variable-length vector, whose length is encoded on length_size bytes */
+    int get_vector(size_t length_size, OctetString &vector) {
+        unsigned long long length;
+        if (get_uint(length_size, length)) return -1;
+        vector.resize(length);
+        if (length && get_bytes(length, &vector[0])) return -1;
+        return 0;
+    }
+
+    /* Get a list of ASN.1Cert<1..2^24-1>, preceded by its total length */
+    int get_cert_list(size_t length_size, std::vector<OctetString> &certs) {
+        OctetString list;
+        if (get_vector(length_size, list)) return -1;
+        Tls_reader reader(list);
+        while (!reader.at_end()) {
+            certs.push_back(OctetString());
+            if (reader.get_vector(3, certs.back())) return -1;
+        }
+        return 0;
+    }
+
+private:
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+    std::streambuf *stream; // null if reading from memory
+};
+
+/**
+ * @brief Get the index of the first entry of a CT dump, from its path
+ * @param[in]  path
+ * @param[out] found  Tell if the index could be deduced from the path
+ *
+ * The path of a static-ct-api data tile gives its tile index
+ * (eg: ".../tile/data/x001/x234/067" is the tile 1234067, and
+ * ".../tile/data/005.p/17" is the partial tile 5).
+ * Otherwise, the name of a get-entries page may start with the
+ * index of its first entry (eg: "1000-1999.json").
+ */
+unsigned long long ct_first_index_from_path(const std::string &path, bool &found)
+{
+    static const char TILE_DATA[] = "tile/data/";
+    found = false;
+    unsigned long long index = 0;
+    size_t pos = path.rfind(TILE_DATA);
+    if (pos != std::string::npos) {
+        pos += sizeof(TILE_DATA) - 1;
+        while (pos < path.size()) {
+            if (path[pos] == 'x') pos++;
+            size_t n_digits = 0;
+            while (pos < path.size() && path[pos] >= '0' && path[pos] <= '9') {
+                index = index * 10 + (path[pos] - '0');
+                pos++;
+                n_digits++;
+            }
+            if (!n_digits) return 0;
+            if (pos == path.size() || 0 == path.compare(pos, 2, ".p")) break; // last element of the tile path
+            if (path[pos] != '/') return 0;
+            pos++;
+        }
+        found = true;
+        return index * CT_TILE_WIDTH;
+    }
+
+    size_t name = path.rfind('/');
+    name = (name == std::string::npos) ? 0 : name + 1;
+    for (pos = name; pos < path.size() && path[pos] >= '0' && path[pos] <= '9'; pos++) {
+        index = index * 10 + (path[pos] - '0');
+        found = true;
+    }
+    return index;
+}
+
+/**
+ * @brief Parse the leaf_input and extra_data of a get-entries response (RFC 6962 section 4.6)
+ * @return 0 on success, -1 on error
+ */
+static int parse_json_entry(const OctetString &leaf_input, const OctetString &extra_data, Ct_entry &entry)
+{
+    Tls_reader leaf(leaf_input);
+    unsigned long long version, leaf_type, timestamp, entry_type;
+    if (leaf.get_uint(1, version) || leaf.get_uint(1, leaf_type)) return -1;
+    if (version != CT_LEAF_VERSION_V1 || leaf_type != CT_LEAF_TIMESTAMPED_ENTRY) return -1;
+    if (leaf.get_uint(8, timestamp) || leaf.get_uint(2, entry_type)) return -1;
+
+    Tls_reader extra(extra_data);
+    if (entry_type == CT_X509_ENTRY) {
+        if (leaf.get_vector(3, entry.certificate)) return -1;
+        if (extra.get_cert_list(3, entry.chain)) return -1;
+    } else if (entry_type == CT_PRECERT_ENTRY) {
+        unsigned char issuer_key_hash[CT_ISSUER_KEY_HASH_SIZE];
+        OctetString tbs_certificate; // see Ct_entry
+        if (leaf.get_bytes(sizeof(issuer_key_hash), issuer_key_hash)) return -1;
+        if (leaf.get_vector(3, tbs_certificate)) return -1;
+        // PrecertChainEntry
+        if (extra.get_vector(3, entry.certificate)) return -1;
+        if (extra.get_cert_list(3, entry.chain)) return -1;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read a JSON string, after its opening quote
+ *
+ * Escaped characters are unescaped (base64 data may contain "\/").
+ */
+static int read_json_string(std::streambuf *input, std::string &value)
+{
+    value.clear();
+    while (1) {
+        int c = input->sbumpc();
+        if (c == EOF) return -1;
+        if (c == '"') return 0;
+        if (c == '\\') {
+            c = input->sbumpc();
+            if (c == EOF) return -1;
+            if (c == 'n') c = '\n';
+            else if (c == 'r') c = '\r';
+            else if (c == 't') c = '\t';
+        }
+        value += (char)c;
+    }
+}
+
+/**
+ * @brief Read the entries of a get-entries JSON response
+ * @param input        Stream of one or more JSON documents
+ * @param filename     Name of the input (for the messages)
+ * @param first_index  Index in the log of the first entry
+ * @param callback     Called for each entry
+ * @return 0 on success, -1 on error
+ *
+ * The JSON is scanned as a stream, without being stored: only the
+ * "leaf_input" and "extra_data" members are kept, and an entry
+ * is emitted when the object containing them ends.
+ */
+int read_ct_json(std::istream &input, const char *filename, unsigned long long first_index, const Ct_callback &callback)
+{
+    std::streambuf *buffer = input.rdbuf();
+    std::string key;
+    std::string value;
+    std::string leaf_input;
+    std::string extra_data;
+    unsigned long long index = first_index;
+
+    while (1) {
+        int c = buffer->sbumpc();
+        if (c == EOF) break;
+        if (c == '"') {
+            if (read_json_string(buffer, value)) {
+                LOGERROR("Truncated JSON string in '%s'", filename);
+                return -1;
+            }
+            while (isspace(buffer->sgetc())) buffer->sbumpc();
+            if (buffer->sgetc() == ':') {
+                buffer->sbumpc();
+                key.swap(value);
+            } else if (key == "leaf_input") {
+                leaf_input.swap(value);
+            } else if (key == "extra_data") {
+                extra_data.swap(value);
+            }
+        } else if (c == '}' && !leaf_input.empty()) {
+            Ct_entry entry;
+            entry.index = index;
+            if (parse_json_entry(base64_decode(leaf_input), base64_decode(extra_data), entry)) {
+                LOGERROR("Invalid CT log entry: %s: index %llu", filename, index);
+                return -1;
+            }
+            if (callback(entry)) return -1;
+            leaf_input.clear();
+            extra_data.clear();
+            index++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the leaf_index extension of a static-ct-api entry
+ * @return 0 if found, -1 otherwise
+ */
+static int get_leaf_index(const OctetString &extensions, unsigned long long &index)
+{
+    Tls_reader reader(extensions);
+    while (!reader.at_end()) {
+        unsigned long long type;
+        OctetString data;
+        if (reader.get_uint(1, type) || reader.get_vector(2, data)) return -1;
+        if (type == CT_EXTENSION_LEAF_INDEX && data.size() == CT_LEAF_INDEX_SIZE) {
+            Tls_reader value(data);
+            return value.get_uint(CT_LEAF_INDEX_SIZE, index);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Read the entries of a static-ct-api data tile
+ * @param input        Stream of concatenated TileLeaf structures
+ * @param filename     Name of the input (for the messages)
+ * @param first_index  Index in the log of the first entry (used if the entries have no leaf_index extension)
+ * @param callback     Called for each entry
+ * @return 0 on success, -1 on error
+ *
+ * The chains are given by the fingerprints of the issuers only, and are
+ * therefore not returned. The issuers are to be loaded from the
+ * "issuer/" bundles of the log.
+ */
+int read_ct_tile(std::istream &input, const char *filename, unsigned long long first_index, const Ct_callback &callback)
+{
+    Tls_reader reader(input.rdbuf());
+    unsigned long long index = first_index;
+    while (!reader.at_end()) {
+        Ct_entry entry;
+        unsigned long long timestamp, entry_type;
+        OctetString extensions;
+        OctetString fingerprints;
+        int err = reader.get_uint(8, timestamp) || reader.get_uint(2, entry_type);
+        if (!err && entry_type == CT_X509_ENTRY) {
+            err = reader.get_vector(3, entry.certificate) || reader.get_vector(2, extensions)
+                || reader.get_vector(2, fingerprints);
+        } else if (!err && entry_type == CT_PRECERT_ENTRY) {
+            unsigned char issuer_key_hash[CT_ISSUER_KEY_HASH_SIZE];
+            OctetString tbs_certificate; // see Ct_entry
+            err = reader.get_bytes(sizeof(issuer_key_hash), issuer_key_hash) || reader.get_vector(3, tbs_certificate)
+                || reader.get_vector(2, extensions) || reader.get_vector(3, entry.certificate)
+                || reader.get_vector(2, fingerprints);
+        } else {
+            err = -1;
+        }
+        if (err || fingerprints.size() % CT_FINGERPRINT_SIZE) {
+            LOGERROR("Invalid CT tile entry: %s: index %llu", filename, index);
+            return -1;
+        }
+
+        if (get_leaf_index(extensions, entry.index)) entry.index = index;
+        index = entry.index + 1;
+        if (callback(entry)) return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef CT_H
+#define CT_H
+
+#include <functional>
+#include <istream>
+#include <vector>
+
+#include "util.h"
+
+/* Entry of a Certificate Transparency log (RFC 6962, static-ct-api)
+ *
+ * For a precertificate, the logged TBSCertificate (without the poison
+ * extension, and possibly with another issuer) is skipped: the whole
+ * precertificate, given by the extra data, is used instead.
+ */
+struct Ct_entry {
+    unsigned long long index;       // index of the entry in the log
+    OctetString certificate;        // leaf certificate, or precertificate (with the poison extension)
+    std::vector<OctetString> chain; // certificates of the chain (JSON only)
+};
+
+/* Called for each entry. The entry may be moved by the callee. Returns 0 on success, -1 on error. */
+typedef std::function<int(Ct_entry &entry)> Ct_callback;
+
+unsigned long long ct_first_index_from_path(const std::string &path, bool &found);
+int read_ct_json(std::istream &input, const char *filename, unsigned long long first_index, const Ct_callback &callback);
+int read_ct_tile(std::istream &input, const char *filename, unsigned long long first_index, const Ct_callback &callback);
+
+#endif // CT_H
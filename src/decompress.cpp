@@ -0,0 +1,447 @@
+#include <algorithm>
+#include <string.h>
+
+#include "config.h"
+#include "decompress.h"
+#include "journal.h"
+#include "parallel.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define INPUT_BUFFER_SIZE 65536
+#define OUTPUT_BUFFER_SIZE 65536
+#define MEMBER_MAX_CONTENT_SIZE (16*1024*1024) // larger members are not decompressed in parallel
+
+static const unsigned char GZIP_MAGIC[] = { 0x1f, 0x8b };
+static const unsigned char XZ_MAGIC[] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+static const unsigned char ZSTD_MAGIC[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+static bool has_magic(const unsigned char *data, size_t size, const unsigned char *magic, size_t magic_size)
+{
+    return size >= magic_size && 0 == memcmp(data, magic, magic_size);
+}
+
+Compression detect_compression(const unsigned char *data, size_t size)
+{
+    if (has_magic(data, size, GZIP_MAGIC, sizeof(GZIP_MAGIC))) return COMPRESSION_GZIP;
+    if (has_magic(data, size, XZ_MAGIC, sizeof(XZ_MAGIC))) return COMPRESSION_XZ;
+    if (has_magic(data, size, ZSTD_MAGIC, sizeof(ZSTD_MAGIC))) return COMPRESSION_ZSTD;
+    return COMPRESSION_NONE;
+}
+
+/**
+ * @brief Read the first bytes of a stream, enough to detect its compression
+ * @param[out] prefix  COMPRESSION_MAGIC_MAX_SIZE bytes, to be given back with a Prefixed_streambuf
+ * @param[out] size    Number of bytes read in prefix (less at the end of the stream)
+ */
+Compression peek_compression(std::streambuf *source, unsigned char *prefix, size_t &size)
+{
+    std::streamsize n = source->sgetn((char *)prefix, COMPRESSION_MAGIC_MAX_SIZE);
+    size = n > 0 ? n : 0;
+    return detect_compression(prefix, size);
+}
+
+const char *compression_name(Compression compression)
+{
+    switch (compression) {
+    case COMPRESSION_GZIP: return "gzip";
+    case COMPRESSION_XZ: return "xz";
+    case COMPRESSION_ZSTD: return "zstd";
+    default: return "none";
+    }
+}
+
+/**
+ * @brief Read the bytes of a stream buffer, without waiting for more than the first one
+ *
+ * Stream buffers that do not tell how many bytes are available (eg: std::cin)
+ * are read until the requested size.
+ */
+std::streamsize read_available(std::streambuf *source, char *data, std::streamsize size)
+{
+    if (source->sgetc() == std::char_traits<char>::eof()) return 0;
+    std::streamsize available = source->in_avail();
+    if (available <= 0 || available > size) available = size;
+    return source->sgetn(data, available);
+}
+
+Prefixed_streambuf::Prefixed_streambuf(const unsigned char *prefix, size_t size, std::streambuf *source)
+    : source(source), buffer(std::max(size, (size_t)65536))
+{
+    memcpy(buffer.data(), prefix, size);
+    setg(buffer.data(), buffer.data(), buffer.data() + size);
+}
+
+Prefixed_streambuf::int_type Prefixed_streambuf::underflow()
+{
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    std::streamsize n = read_available(source, buffer.data(), buffer.size());
+    if (n <= 0) return traits_type::eof();
+    setg(buffer.data(), buffer.data(), buffer.data() + n);
+    return traits_type::to_int_type(*gptr());
+}
+
+enum {
+    DECODE_ERROR = -1,
+    DECODE_OK = 0,
+    DECODE_END = 1, // all the input has been decompressed
+};
+
+/* Decompressor of a given format, possibly made of several concatenated members */
+class Stream_decoder {
+public:
+    virtual ~Stream_decoder() {}
+    /**
+     * @brief Decompress a part of the input
+     * @param[in]  in, in_size
+     * @param[out] consumed    Number of input bytes consumed
+     * @param[out] out, out_size
+     * @param[out] produced    Number of bytes written in out
+     * @param[in]  finish      No more input after in
+     * @return DECODE_OK, DECODE_END or DECODE_ERROR
+     */
+    virtual int decode(const unsigned char *in, size_t in_size, size_t &consumed,
+                       unsigned char *out, size_t out_size, size_t &produced, bool finish) = 0;
+};
+
+#ifdef HAVE_ZLIB
+class Gzip_decoder : public Stream_decoder {
+public:
+    Gzip_decoder(): in_member(false) {
+        memset(&strm, 0, sizeof(strm));
+        ok = (Z_OK == inflateInit2(&strm, 15 + 16)); // 16: gzip header and trailer
+    }
+    ~Gzip_decoder() {
+        if (ok) inflateEnd(&strm);
+    }
+    int decode(const unsigned char *in, size_t in_size, size_t &consumed,
+               unsigned char *out, size_t out_size, size_t &produced, bool finish) override {
+        consumed = 0;
+        produced = 0;
+        if (!ok) return DECODE_ERROR;
+        if (!in_size && finish && !in_member) return DECODE_END;
+
+        strm.next_in = (Bytef *)in;
+        strm.avail_in = in_size;
+        strm.next_out = out;
+        strm.avail_out = out_size;
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        consumed = in_size - strm.avail_in;
+        produced = out_size - strm.avail_out;
+        if (consumed) in_member = true;
+
+        if (ret == Z_STREAM_END) {
+            // Another member may follow
+            inflateReset(&strm);
+            in_member = false;
+            return DECODE_OK;
+        }
+        if (ret == Z_OK || ret == Z_BUF_ERROR) {
+            if (finish && !in_size && !produced) {
+                LOGERROR("gzip: truncated input");
+                return DECODE_ERROR;
+            }
+            return DECODE_OK;
+        }
+        LOGERROR("gzip: %s", strm.msg ? strm.msg : "invalid data");
+        return DECODE_ERROR;
+    }
+private:
+    z_stream strm;
+    bool ok;
+    bool in_member;
+};
+#endif
+
+#ifdef HAVE_LZMA
+class Xz_decoder : public Stream_decoder {
+public:
+    Xz_decoder() {
+        strm = LZMA_STREAM_INIT;
+#if LZMA_VERSION >= 50040002
+        // Blocks of multi-block streams (eg: xz -T0) are decompressed by several threads
+        lzma_mt mt;
+        memset(&mt, 0, sizeof(mt));
+        mt.flags = LZMA_CONCATENATED;
+        mt.threads = get_parallel_jobs();
+        mt.memlimit_threading = 256 * 1024 * 1024;
+        mt.memlimit_stop = UINT64_MAX;
+        ok = (LZMA_OK == lzma_stream_decoder_mt(&strm, &mt));
+#else
+        ok = (LZMA_OK == lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED));
+#endif
+    }
+    ~Xz_decoder() {
+        lzma_end(&strm);
+    }
+    int decode(const unsigned char *in, size_t in_size, size_t &consumed,
+               unsigned char *out, size_t out_size, size_t &produced, bool finish) override {
+        consumed = 0;
+        produced = 0;
+        if (!ok) return DECODE_ERROR;
+
+        strm.next_in = in;
+        strm.avail_in = in_size;
+        strm.next_out = out;
+        strm.avail_out = out_size;
+        lzma_ret ret = lzma_code(&strm, finish ? LZMA_FINISH : LZMA_RUN);
+        consumed = in_size - strm.avail_in;
+        produced = out_size - strm.avail_out;
+
+        if (ret == LZMA_STREAM_END) return produced ? DECODE_OK : DECODE_END;
+        if (ret == LZMA_OK) return DECODE_OK;
+        if (ret == LZMA_BUF_ERROR) {
+            LOGERROR("xz: truncated input");
+            return DECODE_ERROR;
+        }
+        LOGERROR("xz: invalid data (error %d)", ret);
+        return DECODE_ERROR;
+    }
+private:
+    lzma_stream strm;
+    bool ok;
+};
+#endif
+
+#ifdef HAVE_ZSTD
+class Zstd_decoder : public Stream_decoder {
+public:
+    Zstd_decoder(): in_frame(false) {
+        dstream = ZSTD_createDStream();
+        if (dstream) ZSTD_initDStream(dstream);
+    }
+    ~Zstd_decoder() {
+        if (dstream) ZSTD_freeDStream(dstream);
+    }
+    int decode(const unsigned char *in, size_t in_size, size_t &consumed,
+               unsigned char *out, size_t out_size, size_t &produced, bool finish) override {
+        consumed = 0;
+        produced = 0;
+        if (!dstream) return DECODE_ERROR;
+        if (!in_size && finish && !in_frame) return DECODE_END;
+
+        ZSTD_inBuffer input = { in, in_size, 0 };
+        ZSTD_outBuffer output = { out, out_size, 0 };
+        size_t ret = ZSTD_decompressStream(dstream, &output, &input);
+        if (ZSTD_isError(ret)) {
+            LOGERROR("zstd: %s", ZSTD_getErrorName(ret));
+            return DECODE_ERROR;
+        }
+        consumed = input.pos;
+        produced = output.pos;
+        in_frame = (ret != 0); // 0: end of a frame (another one may follow)
+        if (finish && !in_size && !produced && in_frame) {
+            LOGERROR("zstd: truncated input");
+            return DECODE_ERROR;
+        }
+        return DECODE_OK;
+    }
+private:
+    ZSTD_DStream *dstream;
+    bool in_frame;
+};
+#endif
+
+static Stream_decoder *new_decoder(Compression compression)
+{
+    switch (compression) {
+#ifdef HAVE_ZLIB
+    case COMPRESSION_GZIP: return new Gzip_decoder();
+#endif
+#ifdef HAVE_LZMA
+    case COMPRESSION_XZ: return new Xz_decoder();
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD: return new Zstd_decoder();
+#endif
+    default:
+        LOGERROR("%s decompression not supported by this build", compression_name(compression));
+        return 0;
+    }
+}
+
+/**
+ * @brief Find the members of a BGZF file (gzip members that give their size)
+ * @return true if the whole input is made of such members
+ *
+ * Each member has an extra field 'BC' with the size of the member minus 1.
+ */
+static bool find_bgzf_members(const unsigned char *data, size_t size, std::vector<Compressed_member> &members)
+{
+    size_t pos = 0;
+    while (pos < size) {
+        const unsigned char *header = data + pos;
+        if (size - pos < 18) return false;
+        if (header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || !(header[3] & 0x04)) return false;
+        size_t xlen = header[10] | (header[11] << 8);
+        if (12 + xlen > size - pos) return false;
+        size_t member_size = 0;
+        for (size_t i=12; i+4<=12+xlen; ) {
+            size_t slen = header[i+2] | (header[i+3] << 8);
+            if (header[i] == 'B' && header[i+1] == 'C' && slen == 2 && i+6 <= 12+xlen) {
+                member_size = (header[i+4] | (header[i+5] << 8)) + 1;
+                break;
+            }
+            i += 4 + slen;
+        }
+        if (!member_size || member_size > size - pos) return false;
+        // ISIZE, in the trailer: size of the uncompressed data modulo 2^32
+        const unsigned char *trailer = header + member_size - 4;
+        size_t content_size = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((size_t)trailer[3] << 24);
+        if (content_size > MEMBER_MAX_CONTENT_SIZE) return false;
+        members.push_back({pos, member_size});
+        pos += member_size;
+    }
+    return true;
+}
+
+#ifdef HAVE_ZSTD
+/**
+ * @brief Find the frames of a zstd input
+ * @return true if all frames could be delimited, with a bounded content size
+ */
+static bool find_zstd_frames(const unsigned char *data, size_t size, std::vector<Compressed_member> &members)
+{
+    size_t pos = 0;
+    while (pos < size) {
+        size_t frame_size = ZSTD_findFrameCompressedSize(data + pos, size - pos);
+        if (ZSTD_isError(frame_size)) return false;
+        unsigned long long content_size = ZSTD_getFrameContentSize(data + pos, size - pos);
+        if (content_size == ZSTD_CONTENTSIZE_ERROR) return false;
+        if (content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size > MEMBER_MAX_CONTENT_SIZE) return false;
+        members.push_back({pos, frame_size});
+        pos += frame_size;
+    }
+    return true;
+}
+#endif
+
+/**
+ * @brief Decompress a whole member
+ * @return 0 on success, -1 on error
+ */
+static int decompress_member(Compression compression, const unsigned char *in, size_t in_size, OctetString &out)
+{
+    std::unique_ptr<Stream_decoder> decoder(new_decoder(compression));
+    if (!decoder) return -1;
+    unsigned char buffer[OUTPUT_BUFFER_SIZE];
+    size_t pos = 0;
+    while (1) {
+        size_t consumed, produced;
+        int ret = decoder->decode(in + pos, in_size - pos, consumed, buffer, sizeof(buffer), produced, true);
+        if (ret == DECODE_ERROR) return -1;
+        out.append(buffer, produced);
+        pos += consumed;
+        if (ret == DECODE_END) return 0;
+    }
+}
+
+Decompress_streambuf::Decompress_streambuf(Compression compression, std::streambuf *source) :
+    compression(compression), decoder(new_decoder(compression)), error(!decoder),
+    source(source), input_buffer(INPUT_BUFFER_SIZE, 0), input(input_buffer.data()),
+    input_pos(0), input_end(0), source_eof(false), output(OUTPUT_BUFFER_SIZE, 0),
+    data(0), next_member(0), batch_pos(0)
+{
+}
+
+Decompress_streambuf::Decompress_streambuf(Compression compression, const unsigned char *data, size_t size) :
+    compression(compression), error(false),
+    source(0), input(data), input_pos(0), input_end(size), source_eof(true),
+    data(data), next_member(0), batch_pos(0)
+{
+    bool independent_members = false;
+    if (compression == COMPRESSION_GZIP) independent_members = find_bgzf_members(data, size, members);
+#ifdef HAVE_ZSTD
+    if (compression == COMPRESSION_ZSTD) independent_members = find_zstd_frames(data, size, members);
+#endif
+    if (independent_members && members.size() > 1) {
+        LOGINFO("Decompressing %lu %s members in parallel", members.size(), compression_name(compression));
+        return;
+    }
+
+    members.clear();
+    decoder.reset(new_decoder(compression));
+    error = !decoder;
+    output.resize(OUTPUT_BUFFER_SIZE);
+}
+
+Decompress_streambuf::~Decompress_streambuf()
+{
+}
+
+Decompress_streambuf::int_type Decompress_streambuf::underflow()
+{
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    if (error) return traits_type::eof();
+    if (!members.empty()) return underflow_members();
+    return underflow_stream();
+}
+
+Decompress_streambuf::int_type Decompress_streambuf::underflow_stream()
+{
+    while (1) {
+        if (input_pos == input_end && !source_eof) {
+            std::streamsize n = source->sgetn((char *)input_buffer.data(), input_buffer.size());
+            input_pos = 0;
+            input_end = n > 0 ? n : 0;
+            if (n <= 0) source_eof = true;
+        }
+
+        size_t consumed, produced;
+        int ret = decoder->decode(input + input_pos, input_end - input_pos, consumed,
+                                  &output[0], output.size(), produced, source_eof);
+        input_pos += consumed;
+        if (ret == DECODE_ERROR) {
+            error = true;
+            return traits_type::eof();
+        }
+        if (produced) {
+            char *begin = (char *)&output[0];
+            setg(begin, begin, begin + produced);
+            return traits_type::to_int_type(*gptr());
+        }
+        if (ret == DECODE_END) return traits_type::eof();
+    }
+}
+
+/* Decompress the next batch of members in parallel, and serve them in order */
+Decompress_streambuf::int_type Decompress_streambuf::underflow_members()
+{
+    while (1) {
+        while (batch_pos < batch.size()) {
+            OctetString &content = batch[batch_pos++];
+            if (content.empty()) continue;
+            char *begin = (char *)&content[0];
+            setg(begin, begin, begin + content.size());
+            return traits_type::to_int_type(*gptr());
+        }
+        if (next_member == members.size()) return traits_type::eof();
+
+        size_t n = 2 * get_parallel_jobs();
+        if (n > members.size() - next_member) n = members.size() - next_member;
+        std::vector<OctetString> contents(n);
+        std::vector<int> errors(n, 0);
+        parallel_for(n, [&](size_t i) {
+            const Compressed_member &member = members[next_member + i];
+            errors[i] = decompress_member(compression, data + member.offset, member.size, contents[i]);
+        });
+        for (size_t i=0; i<n; i++) {
+            if (errors[i]) {
+                LOGERROR("Cannot decompress %s member at offset %lu", compression_name(compression), members[next_member + i].offset);
+                error = true;
+                return traits_type::eof();
+            }
+        }
+        next_member += n;
+        batch.swap(contents);
+        batch_pos = 0;
+    }
+}
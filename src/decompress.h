@@ -0,0 +1,87 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <memory>
+#include <streambuf>
+#include <vector>
+
+#include "util.h"
+
+enum Compression {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_XZ,
+    COMPRESSION_ZSTD
+};
+
+#define COMPRESSION_MAGIC_MAX_SIZE 6
+
+Compression detect_compression(const unsigned char *data, size_t size);
+Compression peek_compression(std::streambuf *source, unsigned char *prefix, size_t &size);
+const char *compression_name(Compression compression);
+std::streamsize read_available(std::streambuf *source, char *data, std::streamsize size);
+
+/* Input stream buffer that gives back a few bytes already read from
+ * another stream buffer, followed by the rest of it.
+ */
+class Prefixed_streambuf : public std::streambuf {
+public:
+    Prefixed_streambuf(const unsigned char *prefix, size_t size, std::streambuf *source);
+protected:
+    int_type underflow() override;
+private:
+    std::streambuf *source;
+    std::vector<char> buffer;
+};
+
+class Stream_decoder;
+
+/* Member of a compressed input, that can be decompressed independently of the others */
+struct Compressed_member {
+    size_t offset;
+    size_t size;
+};
+
+/**
+ * Input stream buffer that decompresses another input, with bounded buffers.
+ *
+ * When the whole compressed input is in memory and made of independent
+ * members of known sizes (BGZF gzip blocks, zstd frames), batches of
+ * members are decompressed in parallel.
+ */
+class Decompress_streambuf : public std::streambuf {
+public:
+    Decompress_streambuf(Compression compression, std::streambuf *source);
+    Decompress_streambuf(Compression compression, const unsigned char *data, size_t size);
+    ~Decompress_streambuf();
+    bool failed() const { return error; }
+
+protected:
+    int_type underflow() override;
+
+private:
+    int_type underflow_stream();
+    int_type underflow_members();
+
+    Compression compression;
+    std::unique_ptr<Stream_decoder> decoder;
+    bool error;
+
+    // streaming mode
+    std::streambuf *source;       // null if the input is in memory
+    OctetString input_buffer;     // used if reading from source
+    const unsigned char *input;   // input_buffer, or the input in memory
+    size_t input_pos;
+    size_t input_end;
+    bool source_eof;
+    OctetString output;
+
+    // parallel mode
+    const unsigned char *data;
+    std::vector<Compressed_member> members;
+    size_t next_member;
+    std::vector<OctetString> batch;
+    size_t batch_pos;
+};
+
+#endif // DECOMPRESS_H
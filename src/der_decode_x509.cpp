@@ -1,10 +1,13 @@
+#include <algorithm>
 #include <assert.h>
 #include <climits>
 #include <string>
 #include <sstream>
 #include <vector>
 #include "certificate.h"
+#include "charset.h"
 #include "der_decode_x509.h"
+#include "der_tape.h"
 #include "journal.h"
 #include "oid_name.h"
 #include "util.h"
@@ -24,109 +27,37 @@
 # define V_ASN1_UTCTIME                  23
 # define V_ASN1_GENERALIZEDTIME          24
 # define V_ASN1_VISIBLESTRING            26
+# define V_ASN1_UNIVERSALSTRING          28
+# define V_ASN1_BMPSTRING                30
+
+#define OID_PKCS7_SIGNED_DATA "1.2.840.113549.1.7.2"
 
 /**
- * @brief Get DER tag and value
- * @param[in] der_bytes
- * @param[out] tag
- * @param[out] value
- * @return number of bytes read, or -1 on error
+ * @brief Check the TLV at the current position of a tape
+ * @param[in] index  Current position
+ * @param[in] end    End of the enclosing contents
+ * @return 0 if there is a TLV with the expected tag number, -1 otherwise
  */
-static int get_tag_length_value(const OctetString &der_bytes, int &tag, OctetString &value)
+static int der_expect(const Der_tape &tape, size_t index, size_t end, int expected_tag)
 {
-    LOGHEX("", der_bytes, 16);
-    if (der_bytes.empty()) {
-        LOGERROR("empty");
+    if (index >= end) {
+        LOGERROR("Missing value (expected tag 0x%X)", expected_tag);
         return -1;
     }
-    if (der_bytes.size() < 2) {
-        LOGERROR("missing first byte");
+    if (tape.tag_number(index) != expected_tag) {
+        LOGERROR("Unexpected tag 0x%X (expected was 0x%X)", tape.tag_number(index), expected_tag);
         return -1;
     }
-
-    tag = der_bytes[0] & 0x1f;
-
-    int size = 0;
-    size_t len_tag_size = 2; // tag and first byte of the length
-    if (der_bytes[1] & 0x80) {
-        // Length encoded on multibytes, big-endian
-        size_t n_bytes = (unsigned char)der_bytes[1] & 0x7f;
-        if (n_bytes+2 > der_bytes.size()) {
-            LOGERROR("too short for extracting the size: n_bytes+2=%lu, der_bytes.size=%lu",
-                     n_bytes+2, der_bytes.size());
-            return -1;
-        }
-        len_tag_size += n_bytes;
-
-        for (size_t i=0; i<n_bytes; i++) {
-            if (size > (INT_MAX >> 8 )) {
-                // unsigned integer overflow
-                LOGERROR("LOGERROR: overflow");
-                return -1;
-            }
-            size = (size << 8) + der_bytes[i+2];
-        }
-    } else {
-        // length encoded on a single byte
-        size = der_bytes[1];
-    }
-
-    if (len_tag_size + size > der_bytes.size()) {
-        LOGERROR("too short for extracting the payload: size of input %lu, size of tag & length %lu, size of payload %d",
-                 der_bytes.size(), len_tag_size, size);
-        return -1;
-    }
-    value = der_bytes.substr(len_tag_size, size);
-    return len_tag_size + size;
-}
-
-static int der_decode_header(const OctetString &der_bytes, int expected_tag, OctetString &value)
-{
-    LOGHEX("", der_bytes, 16);
-    int tag;
-    OctetString data;
-    int n_bytes = get_tag_length_value(der_bytes, tag, data);
-    if (n_bytes <= 0) {
-        LOGERROR("cannot decode tag and length");
-        return -1;
-    }
-    if (tag != expected_tag) {
-        LOGERROR("Unexpected tag 0x%X (expected was 0x%X)", tag, expected_tag);
-        return -1;
-    }
-    value = data;
-    return n_bytes;
+    return 0;
 }
 
 /**
- * @brief der_decode_integer
- * @param der_bytes
- * @param value
- * @return
- *     -1 error
- *     >0 number of decoded bytes
+ * @brief Convert the payload of an INTEGER to its hexadecimal representation (eg: "-0x0102")
  */
-static int der_decode_integer(const OctetString &der_bytes, Integer &value)
+static Integer integer_to_string(const unsigned char *payload, size_t size)
 {
-    LOGHEX("", der_bytes, 16);
-    int tag;
-    OctetString data;
-    int n_bytes = get_tag_length_value(der_bytes, tag, data);
-    if (n_bytes < 0) {
-        LOGERROR("cannot decode tag and length");
-        return -1;
-    }
-    if (tag != V_ASN1_INTEGER) {
-        LOGERROR("not an integer. tag=0x%X", tag);
-        return -1;
-    }
-
-    if (data.empty()) {
-        LOGERROR("empty integer");
-        return -1;
-    }
-
-    value = "";
+    OctetString data(payload, size);
+    Integer value;
     // Get the sign +/-
     if (data[0] & 0x80) {
         value += "-";
@@ -143,76 +74,83 @@ static int der_decode_integer(const OctetString &der_bytes, Integer &value)
     }
     value += "0x"; // base 16
     value += hexlify(data.data(), data.size());
+    return value;
+}
 
-    return n_bytes;
+/**
+ * @brief Decode an INTEGER
+ * @param[in]     tape
+ * @param[in,out] index  Position of the INTEGER, moved to the next value on success
+ * @param[in]     end    End of the enclosing contents
+ * @param[out]    value
+ * @return 0 on success, -1 on error
+ *
+ * The other decoders of this file follow the same pattern.
+ */
+static int der_decode_integer(const Der_tape &tape, size_t &index, size_t end, Integer &value)
+{
+    if (der_expect(tape, index, end, V_ASN1_INTEGER)) {
+        LOGERROR("not an integer");
+        return -1;
+    }
+    if (!tape[index].length) {
+        LOGERROR("empty integer");
+        return -1;
+    }
+    value = integer_to_string(tape.value(index), tape[index].length);
+    index = tape[index].next;
+    return 0;
 }
 
-static int der_decode_boolean(const OctetString &der_bytes, bool &boolean)
+static int der_decode_boolean(const Der_tape &tape, size_t &index, size_t end, bool &boolean)
 {
-    LOGHEX("", der_bytes, 16);
-    OctetString value;
-    int n_bytes = der_decode_header(der_bytes, V_ASN1_BOOLEAN, value);
-    if (n_bytes < 0) {
+    if (der_expect(tape, index, end, V_ASN1_BOOLEAN)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
-
-    if (value.size() != 1) {
-        LOGERROR("Invalid payload (size %lu)", value.size());
+    if (tape[index].length != 1) {
+        LOGERROR("Invalid payload (size %u)", tape[index].length);
         return -1;
     }
-    if (value[0]) boolean = true;
-    else boolean = false;
-
-    return n_bytes;
+    boolean = tape.value(index)[0] != 0;
+    index = tape[index].next;
+    return 0;
 }
 
 /**
  * @brief Decode a DER ASN1 OCTET STRING value
- * @param der_bytes
- * @param octetstring
- * @return
- *     -1 error
- *     >0 number of bytes consumed
  */
-static int der_decode_octet_string(const OctetString &der_bytes, OctetString &data)
+static int der_decode_octet_string(const Der_tape &tape, size_t &index, size_t end, OctetString &data)
 {
-    LOGHEX("", der_bytes, 16);
-    OctetString value;
-    int n_bytes = der_decode_header(der_bytes, V_ASN1_OCTET_STRING, value);
-    if (n_bytes < 0) {
+    if (der_expect(tape, index, end, V_ASN1_OCTET_STRING)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
-    data = value;
-    return n_bytes;
+    data = tape.value_bytes(index);
+    index = tape[index].next;
+    return 0;
 }
 
-static int der_decode_bit_string(const OctetString &der_bytes, OctetString &data)
+static int der_decode_bit_string(const Der_tape &tape, size_t &index, size_t end, OctetString &data)
 {
-    LOGHEX("", der_bytes, 16);
-    OctetString value;
-    int n_bytes = der_decode_header(der_bytes, V_ASN1_BIT_STRING, value);
-    if (n_bytes < 0) {
+    if (der_expect(tape, index, end, V_ASN1_BIT_STRING)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
-    data = value;
-    return n_bytes;
+    data = tape.value_bytes(index);
+    index = tape[index].next;
+    return 0;
 }
 
-static int der_decode_bit_string(const OctetString &der_bytes, std::vector<bool> &bits)
+static int der_decode_bit_string(const Der_tape &tape, size_t &index, size_t end, std::vector<bool> &bits)
 {
-    LOGHEX("", der_bytes, 16);
-
-    OctetString value;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_BIT_STRING, value);
-    if (n_bytes_total < 0) {
+    if (der_expect(tape, index, end, V_ASN1_BIT_STRING)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
 
-    size_t size = value.size();
+    const unsigned char *value = tape.value(index);
+    size_t size = tape[index].length;
 
     if (!size) {
         LOGERROR("Empty value");
@@ -229,25 +167,24 @@ static int der_decode_bit_string(const OctetString &der_bytes, std::vector<bool>
         }
     }
 
-    return n_bytes_total;
+    index = tape[index].next;
+    return 0;
 }
 
-int der_decode_object_identifier(const OctetString &der_bytes, ObjectIdentifier &oid)
+static int der_decode_object_identifier(const Der_tape &tape, size_t &index, size_t end, ObjectIdentifier &oid)
 {
-    LOGHEX("", der_bytes, 16);
-    OctetString value;
-    int n_bytes = der_decode_header(der_bytes, V_ASN1_OBJECT, value);
-    if (n_bytes < 0 || value.empty()) {
+    if (der_expect(tape, index, end, V_ASN1_OBJECT) || !tape[index].length) {
         LOGERROR("Cannot decode header");
         return -1;
     }
 
+    const unsigned char *value = tape.value(index);
     std::ostringstream result;
     // First byte contains 2 values
     result << value[0] / 40 << "." << value[0] % 40;
 
     // Following bytes
-    size_t len = value.size();
+    size_t len = tape[index].length;
     unsigned int current = 0;
     for (size_t i=1; i<len; i++) {
         if (value[i] & 0x80) {
@@ -266,14 +203,12 @@ int der_decode_object_identifier(const OctetString &der_bytes, ObjectIdentifier
     }
     oid = result.str();
     LOGDEBUG("oid=%s", oid.c_str());
-    return n_bytes;
+    index = tape[index].next;
+    return 0;
 }
 
 /**
  * @brief der_decode_x509_algorithm_identifier
- * @param der_bytes
- * @param algoid
- * @return
  *
  * AlgorithmIdentifier  ::=  SEQUENCE  {
  *       algorithm               OBJECT IDENTIFIER,
@@ -282,89 +217,98 @@ int der_decode_object_identifier(const OctetString &der_bytes, ObjectIdentifier
  *                                  -- registered for use with the
  *                                  -- algorithm object identifier value
  */
-static int der_decode_x509_algorithm_identifier(const OctetString &der_bytes, AlgorithmIdentifier &algoid)
+static int der_decode_x509_algorithm_identifier(const Der_tape &tape, size_t &index, size_t end, AlgorithmIdentifier &algoid)
 {
-    LOGHEX("", der_bytes, 16);
-    OctetString value;
-    int n_bytes = der_decode_header(der_bytes, V_ASN1_SEQUENCE, value);
-    if (n_bytes < 0) {
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
-    int n_bytes_algorithm = der_decode_object_identifier(value, algoid.algorithm);
-    if (n_bytes_algorithm < 0) {
+    size_t sequence_end = tape[index].next;
+    size_t field = index + 1;
+    if (der_decode_object_identifier(tape, field, sequence_end, algoid.algorithm)) {
         LOGERROR("Cannot decode algorithm");
         return -1;
     }
 
-    value.erase(0, n_bytes_algorithm);
-
-    algoid.parameters = value;
+    // The parameters are kept encoded: the rest of the SEQUENCE
+    const unsigned char *parameters = tape.value(index) + tape[index].length;
+    if (field < sequence_end) parameters = tape.data + tape[field].offset;
+    algoid.parameters.assign(parameters, tape.value(index) + tape[index].length - parameters);
 
-    return n_bytes;
+    index = sequence_end;
+    return 0;
 }
 
 /**
  * @brief der_decode_x509_attribute_value
- * @param der_bytes
- * @param attribute
- * @return
  *
  * AttributeTypeAndValue   ::= SEQUENCE {
  *         type    AttributeType,
  *         value   AttributeValue }
+ *
+ * The strings are converted to UTF-8 once here, so that the names
+ * are compared and printed without further conversion.
  */
-static int der_decode_x509_attribute_value(const OctetString &der_bytes, AttributeTypeAndValue &attribute)
+static int der_decode_x509_attribute_value(const Der_tape &tape, size_t &index, size_t end, AttributeTypeAndValue &attribute)
 {
-    OctetString sequence;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_SEQUENCE, sequence);
-    if (n_bytes_total < 0) {
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
+    size_t sequence_end = tape[index].next;
+    size_t field = index + 1;
 
     ObjectIdentifier oid;
-    int n_bytes = der_decode_object_identifier(sequence, oid);
-    if (n_bytes < 0) {
+    if (der_decode_object_identifier(tape, field, sequence_end, oid)) {
         LOGERROR("Cannot decode OID");
         return -1;
     }
-    sequence.erase(0, n_bytes);
 
     // The value can be of different types: PrintableString, UTF8String, etc.
-    int tag;
-    OctetString value;
-    n_bytes = get_tag_length_value(sequence, tag, value);
-    if (n_bytes <= 0) {
+    if (field >= sequence_end) {
         LOGERROR("cannot decode tag and length");
         return -1;
     }
 
+    int tag = tape.tag_number(field);
+    const unsigned char *value = tape.value(field);
+    size_t length = tape[field].length;
+    int err = 0;
     switch (tag) {
     case V_ASN1_UTF8STRING:
     case V_ASN1_NUMERICSTRING:
     case V_ASN1_PRINTABLESTRING:
-    case V_ASN1_T61STRING:
     case V_ASN1_IA5STRING:
     case V_ASN1_VISIBLESTRING:
-        attribute.value = std::string((char *)value.data(), value.size());
+        attribute.value = std::string((const char *)value, length);
+        break;
+    case V_ASN1_T61STRING:
+        latin1_to_utf8(value, length, attribute.value);
+        break;
+    case V_ASN1_BMPSTRING:
+        err = bmp_to_utf8(value, length, attribute.value);
+        break;
+    case V_ASN1_UNIVERSALSTRING:
+        err = universal_to_utf8(value, length, attribute.value);
         break;
     default:
-        fprintf(stderr, "der_decode_object_identifier: unsupported value with tag=0x%X\n", tag);
+        LOGWARNING("Unsupported attribute value with tag 0x%X", tag);
+        err = -1;
+    }
+    if (err) {
+        // Kept encoded
         attribute.value = "[der]";
-        attribute.value += hexlify(sequence);
+        attribute.value += hexlify(tape.data + tape[field].offset, tape.value(index) + tape[index].length - tape.data - tape[field].offset);
     }
 
     attribute.type = oid;
 
-    return n_bytes_total;
+    index = sequence_end;
+    return 0;
 }
 
 /**
  * @brief der_decode_x509_name
- * @param der_bytes
- * @param name
- * @return
  *
  * Name ::= CHOICE { -- only one possibility for now --
  *       rdnSequence  RDNSequence }
@@ -373,44 +317,42 @@ static int der_decode_x509_attribute_value(const OctetString &der_bytes, Attribu
  *
  * RelativeDistinguishedName ::= SET SIZE (1..MAX) OF AttributeTypeAndValue
  */
-static int der_decode_x509_name(const OctetString &der_bytes, Name &name)
+static int der_decode_x509_name(const Der_tape &tape, size_t &index, size_t end, Name &name)
 {
-    LOGHEX("", der_bytes, 32);
-
     // decode SEQUENCE OF header
-    OctetString sequenceof;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_SEQUENCE, sequenceof);
-    if (n_bytes_total < 0) {
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
+    size_t sequenceof_end = tape[index].next;
+    size_t n_attributes = 0;
 
     // while more in the SEQUENCE OF, decode SET OF
-    while (sequenceof.size()) {
-        OctetString setof;
-        int n_bytes_setof = der_decode_header(sequenceof, V_ASN1_SET, setof);
-        if (n_bytes_setof < 0) {
+    for (size_t setof = index + 1; setof < sequenceof_end; setof = tape[setof].next) {
+        if (der_expect(tape, setof, sequenceof_end, V_ASN1_SET)) {
             LOGERROR("Cannot decode header (SET OF)");
             return -1;
         }
+        // Count at least one per RDN, so that empty ones are also bounded
+        n_attributes += std::max<size_t>(1, der_count_children(tape, setof, der_get_limit(DER_LIMIT_RDNS)));
+        if (der_check_limit(DER_LIMIT_RDNS, n_attributes)) return -1;
         // while more in each SET OF, decode AttributeTypeAndValue
         std::set<AttributeTypeAndValue> attributes;
-        while (setof.size()) {
+        size_t setof_end = tape[setof].next;
+        for (size_t item = setof + 1; item < setof_end; ) {
             AttributeTypeAndValue attribute;
-            int n_bytes = der_decode_x509_attribute_value(setof, attribute);
-            if (n_bytes < 0) {
+            if (der_decode_x509_attribute_value(tape, item, setof_end, attribute)) {
                 LOGERROR("Cannot decode attribute value");
                 return -1;
             }
             attributes.insert(attribute);
-            setof.erase(0, n_bytes);
         }
 
         name.push_back(attributes);
-        sequenceof.erase(0, n_bytes_setof);
     }
 
-    return n_bytes_total;
+    index = sequenceof_end;
+    return 0;
 }
 
 /**
@@ -435,17 +377,15 @@ static std::string generalized_time_to_string(const std::string &der_time)
     return result;
 }
 
-static int der_decode_generalized_time(const OctetString &der_bytes, std::string &time)
+static int der_decode_generalized_time(const Der_tape &tape, size_t &index, size_t end, std::string &time)
 {
-    LOGHEX("", der_bytes, 32);
-    OctetString value;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_GENERALIZEDTIME, value);
-    if (n_bytes_total < 0) {
+    if (der_expect(tape, index, end, V_ASN1_GENERALIZEDTIME)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
-    time = generalized_time_to_string(std::string((char*)value.data(), value.size()));
-    return n_bytes_total;
+    time = generalized_time_to_string(std::string((const char *)tape.value(index), tape[index].length));
+    index = tape[index].next;
+    return 0;
 }
 
 /*
@@ -453,29 +393,24 @@ static int der_decode_generalized_time(const OctetString &der_bytes, std::string
  *      utcTime        UTCTime,
  *      generalTime    GeneralizedTime }
  *
- * UTCTime not supported as year is on 2 digits only.
  * Expected formats:
+ * - YYMMDDhhmmssZ (UTCTime)
  * - YYYYMMDDhhmmss[.fff...]
  * - 19920521000000.123Z
  */
-static int der_decode_x509_time(const OctetString &der_bytes, std::string &time)
+static int der_decode_x509_time(const Der_tape &tape, size_t &index, size_t end, std::string &time)
 {
-    LOGHEX("", der_bytes, 64);
-
-    int tag;
-    OctetString value;
-    int n_bytes = get_tag_length_value(der_bytes, tag, value);
-    if (n_bytes < 0) {
+    if (index >= end) {
         LOGERROR("cannot decode tag and length");
         return -1;
     }
 
-    std::string timetmp = std::string((char*)value.data(), value.size());
-    switch (tag) {
+    std::string timetmp = std::string((const char *)tape.value(index), tape[index].length);
+    switch (tape.tag_number(index)) {
     case V_ASN1_UTCTIME:
         // Expect YYMMDDhhmmssZ
-        // Add "20" (for 21st century) at the beginning to complete the year on 4 digits
-        timetmp.insert(0, "20");
+        // Complete the year on 4 digits: 19YY if YY >= 50, 20YY otherwise (RFC 5280 4.1.2.5.1)
+        timetmp.insert(0, (timetmp.compare(0, 2, "50") >= 0) ? "19" : "20");
     case V_ASN1_GENERALIZEDTIME:
         time = generalized_time_to_string(timetmp);
         break;
@@ -484,7 +419,8 @@ static int der_decode_x509_time(const OctetString &der_bytes, std::string &time)
         return -1;
     }
 
-    return n_bytes;
+    index = tape[index].next;
+    return 0;
 }
 
 /*
@@ -492,98 +428,88 @@ static int der_decode_x509_time(const OctetString &der_bytes, std::string &time)
  *    notBefore      Time,
  *    notAfter       Time  }
  */
-static int der_decode_x509_validity(const OctetString &der_bytes, Validity &validity)
+static int der_decode_x509_validity(const Der_tape &tape, size_t &index, size_t end, Validity &validity)
 {
-    OctetString value;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_SEQUENCE, value);
-    if (n_bytes_total < 0) {
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
+    size_t sequence_end = tape[index].next;
+    size_t field = index + 1;
 
-    int n_bytes = der_decode_x509_time(value, validity.not_before);
-    if (n_bytes < 0) {
+    if (der_decode_x509_time(tape, field, sequence_end, validity.not_before)) {
         LOGERROR("Cannot decode notBbefore");
         return -1;
     }
-    value.erase(0, n_bytes);
-    n_bytes = der_decode_x509_time(value, validity.not_after);
-    if (n_bytes < 0) {
+    if (der_decode_x509_time(tape, field, sequence_end, validity.not_after)) {
         LOGERROR("Cannot decode notBbefore");
         return -1;
     }
 
-    return n_bytes_total;
+    index = sequence_end;
+    return 0;
 }
 
-static int der_decode_x509_subject_public_key_info(const OctetString &der_bytes, SubjectPublicKeyInfo &spki)
+static int der_decode_x509_subject_public_key_info(const Der_tape &tape, size_t &index, size_t end, SubjectPublicKeyInfo &spki)
 {
-    OctetString value;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_SEQUENCE, value);
-    if (n_bytes_total < 0) {
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
+    size_t sequence_end = tape[index].next;
+    size_t field = index + 1;
+    spki.der_offset = tape[index].offset;
+    spki.der_size = tape[index].header_size + tape[index].length;
 
-
-    int n_bytes = der_decode_x509_algorithm_identifier(value, spki.algorithm);
-    if (n_bytes < 0) {
+    if (der_decode_x509_algorithm_identifier(tape, field, sequence_end, spki.algorithm)) {
         LOGERROR("Cannot decode algorithm");
         return -1;
     }
 
-    value.erase(0, n_bytes);
-
-    n_bytes = der_decode_bit_string(value, spki.subject_public_key);
-    if (n_bytes < 0) {
+    if (der_decode_bit_string(tape, field, sequence_end, spki.subject_public_key)) {
         LOGERROR("cannot decode bit string");
         return -1;
     }
 
-    return n_bytes_total;
+    index = sequence_end;
+    return 0;
 }
 
-static int der_decode_x509_basic_constraints(const OctetString &der_bytes, BasicConstraints &basic_constraints)
+static int der_decode_x509_basic_constraints(const Der_tape &tape, size_t &index, size_t end, BasicConstraints &basic_constraints)
 {
-    LOGHEX("", der_bytes, 16);
-
-    OctetString sequence;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_SEQUENCE, sequence);
-    if (n_bytes_total < 0) {
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
+    size_t sequence_end = tape[index].next;
+    size_t field = index + 1;
 
-    if (!sequence.empty() && sequence[0] == V_ASN1_BOOLEAN) {
+    if (field < sequence_end && tape[field].tag == V_ASN1_BOOLEAN) {
         // This is 'ca'
-        int n_bytes = der_decode_boolean(sequence, basic_constraints.ca);
-        if (n_bytes < 0) {
+        if (der_decode_boolean(tape, field, sequence_end, basic_constraints.ca)) {
             LOGERROR("Cannot decode boolean");
             return -1;
         }
-        sequence.erase(0, n_bytes);
     } else {
         // default value FALSE
         basic_constraints.ca = false;
     }
 
-    if (!sequence.empty()) {
-        int n_bytes = der_decode_integer(sequence, basic_constraints.path_len_constraint);
-        if (n_bytes < 0) {
+    if (field < sequence_end) {
+        if (der_decode_integer(tape, field, sequence_end, basic_constraints.path_len_constraint)) {
             LOGERROR("Cannot decode integer");
             return -1;
         }
     }
-    return n_bytes_total;
+
+    index = sequence_end;
+    return 0;
 }
 
 /**
- * @brief der_decode_x509_general_names
- * @param der_bytes
- * @param out
- * @return
- *
- * GeneralNames ::= SEQUENCE SIZE (1..MAX) OF GeneralName
+ * @brief Decode the GeneralName items of a GeneralNames
+ * @param[in] first  Position of the first GeneralName
+ * @param[in] end    End of the GeneralNames
  *
  * GeneralName ::= CHOICE {
  *      otherName                 [0]  AnotherName,
@@ -595,62 +521,131 @@ static int der_decode_x509_basic_constraints(const OctetString &der_bytes, Basic
  *      uniformResourceIdentifier [6]  IA5String,
  *      iPAddress                 [7]  OCTET STRING,
  *      registeredID              [8]  OBJECT IDENTIFIER }
+ *
+ * All the entries are kept, in order (eg: the thousands of dNSName of a CDN certificate).
  */
-static int der_decode_x509_general_names(const OctetString &der_bytes, GeneralNames &names)
+static int der_decode_x509_general_name_items(const Der_tape &tape, size_t first, size_t end, GeneralNames &names)
 {
-    LOGHEX("", der_bytes, 16);
-    OctetString sequenceof;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_SEQUENCE, sequenceof);
-    if (n_bytes_total < 0) {
-        LOGERROR("Cannot decode header");
-        return -1;
-    }
-
-    while (sequenceof.size()) {
-        int tag;
-        OctetString field;
-        int n_bytes_field = get_tag_length_value(sequenceof, tag, field);
-        if (n_bytes_field <= 0) {
-            LOGERROR("cannot decode tag and length");
-            return -1;
-        }
-
+    size_t n_names = 0;
+    size_t max_names = der_get_limit(DER_LIMIT_GENERAL_NAMES);
+    for (size_t field = first; field < end && n_names <= max_names; field = tape[field].next) n_names++;
+    if (der_check_limit(DER_LIMIT_GENERAL_NAMES, n_names)) return -1;
+
+    names.items.reserve(n_names);
+    for (size_t field = first; field < end; field = tape[field].next) {
+        int tag = tape.tag_number(field);
+        GeneralName name;
+        name.tag = tag;
         switch (tag) {
-        case 0:
-        case 3:
-        case 5:
-        case 7:
-        case 8:
-            names.type = GeneralNames::TYPE_OTHER;
-            names.othervalue = OctetString(sequenceof.data(), n_bytes_field);
+        case GENERAL_NAME_OTHER:
+        case GENERAL_NAME_X400:
+        case GENERAL_NAME_EDI_PARTY:
+        case GENERAL_NAME_IP_ADDRESS:
+        case GENERAL_NAME_REGISTERED_ID:
+            name.type = GeneralName::TYPE_OTHER;
+            name.othervalue = tape.tlv_bytes(field);
             break;
-        case 1:
-        case 2:
-        case 6:
+        case GENERAL_NAME_RFC822:
+        case GENERAL_NAME_DNS:
+        case GENERAL_NAME_URI:
             // IA5String
-            names.type = GeneralNames::TYPE_STR;
-            names.stringvalue = std::string((char *)field.data(), field.size());
+            name.type = GeneralName::TYPE_STR;
+            name.stringvalue = std::string((const char *)tape.value(field), tape[field].length);
             break;
-        case 4:
+        case GENERAL_NAME_DIRECTORY:
             // Name
             {
-                int n_bytes = der_decode_x509_name(field, names.namevalue);
-                if (n_bytes < 0) {
+                size_t first_rdn = field + 1;
+                if (der_decode_x509_name(tape, first_rdn, tape[field].next, name.namevalue)) {
                     LOGERROR("cannot decode Name");
                     return -1;
                 }
             }
-            names.type = GeneralNames::TYPE_NAME;
+            name.type = GeneralName::TYPE_NAME;
             break;
         default:
             LOGERROR("invalid tag 0x%x", tag);
             return -1;
         }
+        names.items.push_back(std::move(name));
+    }
+    return 0;
+}
 
-        sequenceof.erase(0, n_bytes_field);
+/**
+ * @brief der_decode_x509_general_names
+ *
+ * GeneralNames ::= SEQUENCE SIZE (1..MAX) OF GeneralName
+ */
+static int der_decode_x509_general_names(const Der_tape &tape, size_t &index, size_t end, GeneralNames &names)
+{
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
+        LOGERROR("Cannot decode header");
+        return -1;
     }
+    if (der_decode_x509_general_name_items(tape, index + 1, tape[index].next, names)) return -1;
+    index = tape[index].next;
+    return 0;
+}
 
-    return n_bytes_total;
+/**
+ * @brief Decode the bases of GeneralSubtrees
+ * @param[in] first  Position of the first GeneralSubtree
+ * @param[in] end    End of the GeneralSubtrees
+ *
+ * GeneralSubtrees ::= SEQUENCE SIZE (1..MAX) OF GeneralSubtree
+ *
+ * GeneralSubtree ::= SEQUENCE {
+ *      base                    GeneralName,
+ *      minimum         [0]     BaseDistance DEFAULT 0,
+ *      maximum         [1]     BaseDistance OPTIONAL }
+ */
+static int der_decode_x509_general_subtrees(const Der_tape &tape, size_t first, size_t end, GeneralNames &bases)
+{
+    for (size_t subtree = first; subtree < end; subtree = tape[subtree].next) {
+        size_t base = subtree;
+        if (der_expect(tape, base, end, V_ASN1_SEQUENCE)) {
+            LOGERROR("Cannot decode header");
+            return -1;
+        }
+        base++;
+        if (base >= tape[subtree].next) {
+            LOGERROR("Missing base");
+            return -1;
+        }
+        if (der_decode_x509_general_name_items(tape, base, tape[base].next, bases)) return -1;
+    }
+    return 0;
+}
+
+/*
+ * NameConstraints ::= SEQUENCE {
+ *      permittedSubtrees       [0]     GeneralSubtrees OPTIONAL,
+ *      excludedSubtrees        [1]     GeneralSubtrees OPTIONAL }
+ */
+static int der_decode_x509_name_constraints(const Der_tape &tape, size_t &index, size_t end, NameConstraints &constraints)
+{
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
+        LOGERROR("Cannot decode header");
+        return -1;
+    }
+    size_t sequence_end = tape[index].next;
+
+    for (size_t field = index + 1; field < sequence_end; field = tape[field].next) {
+        int tag = tape.tag_number(field);
+        // IMPLICIT GeneralSubtrees: the GeneralSubtree items are directly in the field
+        if (0 == tag) {
+            if (der_decode_x509_general_subtrees(tape, field + 1, tape[field].next, constraints.permitted_subtrees)) return -1;
+        } else if (1 == tag) {
+            if (der_decode_x509_general_subtrees(tape, field + 1, tape[field].next, constraints.excluded_subtrees)) return -1;
+        } else {
+            LOGERROR("invalid tag %d", tag);
+            return -1;
+        }
+    }
+
+    index = sequence_end;
+    return 0;
 }
 
 /**
@@ -668,56 +663,43 @@ static int der_decode_x509_general_names(const OctetString &der_bytes, GeneralNa
  *        A16C A46A 3068 310B3009060355040613025553 3125 3023060355040A131C537461726669656C6420546563686E6F6C6F676965732C20496E632E31323030060355040B1329537461726669656C6420436C61737320322043657274696669636174696F6E20417574686F72697479
  *        8201 00
  */
-static int der_decode_x509_authority_key_identifier(const OctetString &der_bytes, AuthorityKeyIdentifier &akid)
+static int der_decode_x509_authority_key_identifier(const Der_tape &tape, size_t &index, size_t end, AuthorityKeyIdentifier &akid)
 {
     // Set empty values for optional fields
     akid.key_identifier = OctetString();
     akid.authority_cert_serial_number = "";
 
-    OctetString sequence;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_SEQUENCE, sequence);
-    if (n_bytes_total < 0) {
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
+    size_t sequence_end = tape[index].next;
 
-    while (sequence.size()) {
-        LOGHEX("", sequence, 32);
-        int tag;
-        OctetString field;
-        int n_bytes_field = get_tag_length_value(sequence, tag, field);
-        if (n_bytes_field <= 0) {
-            LOGERROR("cannot decode tag and length");
-            return -1;
-        }
+    for (size_t field = index + 1; field < sequence_end; field = tape[field].next) {
+        int tag = tape.tag_number(field);
         if (0 == tag) {
-            akid.key_identifier = field;
+            akid.key_identifier = tape.value_bytes(field);
         } else if (1 == tag) {
-            // rebuild a full ASN1 DER SEQUENCE OF with universal tag and length
-            OctetString der_sequenceof = sequence;
-            der_sequenceof[0] = 0x10; // set a universal tag for SEQUENCE OF
-            int n_bytes = der_decode_x509_general_names(der_sequenceof, akid.authority_cert_issuer);
-            if (n_bytes < 0) {
+            // IMPLICIT GeneralNames: the items are directly in the field
+            if (der_decode_x509_general_name_items(tape, field + 1, tape[field].next, akid.authority_cert_issuer)) {
                 LOGERROR("cannot decode general names");
                 return -1;
             }
         } else if (2 == tag) {
-            // rebuild a full ASN1 DER INTEGER with universal tag and length
-            OctetString der_integer = sequence;
-            der_integer[0] = 0x2; // set a universal tag for INTEGER
-            int n_bytes_integer = der_decode_integer(der_integer, akid.authority_cert_serial_number);
-            if (n_bytes_integer < 0) {
+            // IMPLICIT INTEGER
+            if (!tape[field].length) {
                 LOGERROR("cannot decode integer");
                 return -1;
             }
+            akid.authority_cert_serial_number = integer_to_string(tape.value(field), tape[field].length);
         } else {
             LOGERROR("invalid tag %d", tag);
             return -1;
         }
-        // Remove the consumed bytes
-        sequence.erase(0, n_bytes_field);
     }
-    return n_bytes_total;
+
+    index = sequence_end;
+    return 0;
 }
 
 /*
@@ -733,217 +715,268 @@ static int der_decode_x509_authority_key_identifier(const OctetString &der_bytes
  *      encipherOnly            (7),
  *      decipherOnly            (8) }
  */
-static int der_decode_x509_key_usage(const OctetString &der_bytes, KeyUsage &key_usage)
+static int der_decode_x509_key_usage(const Der_tape &tape, size_t &index, size_t end, KeyUsage &key_usage)
 {
-    LOGHEX("", der_bytes, 16);
-
     std::vector<bool> bits;
-    int n_bytes = der_decode_bit_string(der_bytes, bits);
-    if (n_bytes < 0) {
+    if (der_decode_bit_string(tape, index, end, bits)) {
         LOGERROR("Cannot decode bit string");
         return -1;
     }
 
-    if (bits.size() > 9) {
+    if (bits.size() > KEY_USAGE_BITS) {
         LOGERROR("Bit string too long: %lu", bits.size());
         return -1;
     }
 
-    // pad with zeros to be sure to have 9 bits
-    bits.insert(bits.end(), 9 - bits.size(), 0);
-
-    if (bits[0]) key_usage.insert("digitalSignature");
-    if (bits[1]) key_usage.insert("nonRepudiation");
-    if (bits[2]) key_usage.insert("keyEncipherment");
-    if (bits[3]) key_usage.insert("dataEncipherment");
-    if (bits[4]) key_usage.insert("keyAgreement");
-    if (bits[5]) key_usage.insert("keyCertSign");
-    if (bits[6]) key_usage.insert("cRLSign");
-    if (bits[7]) key_usage.insert("encipherOnly");
-    if (bits[8]) key_usage.insert("decipherOnly");
+    key_usage = 0;
+    for (size_t bit=0; bit<bits.size(); bit++) {
+        if (bits[bit]) key_usage |= 1 << bit;
+    }
 
-    return n_bytes;
+    return 0;
 }
 
-
 /*
- * Extension  ::=  SEQUENCE  {
- *     extnID      OBJECT IDENTIFIER,
- *     critical    BOOLEAN DEFAULT FALSE,
- *     extnValue   OCTET STRING
- *                 -- contains the DER encoding of an ASN.1 value
- *                 -- corresponding to the extension type identified
- *                 -- by extnID
- *     }
+ * ExtKeyUsageSyntax ::= SEQUENCE SIZE (1..MAX) OF KeyPurposeId
+ *
+ * KeyPurposeId ::= OBJECT IDENTIFIER
  */
-static int der_decode_x509_extension(const OctetString &der_bytes, Extension &extension)
+static int der_decode_x509_ext_key_usage(const Der_tape &tape, size_t &index, size_t end, ExtKeyUsage &eku)
 {
-    LOGHEX("", der_bytes, 16);
-
-    OctetString sequence;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_SEQUENCE, sequence);
-    if (n_bytes_total < 0) {
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
-
-    int n_bytes = der_decode_object_identifier(sequence, extension.extn_id);
-    if (n_bytes < 0) {
-        LOGERROR("Cannot decode header");
-        return -1;
+    size_t sequence_end = tape[index].next;
+    eku.bits = 0;
+    for (size_t item = index + 1; item < sequence_end; ) {
+        ObjectIdentifier purpose;
+        if (der_decode_object_identifier(tape, item, sequence_end, purpose)) {
+            LOGERROR("Cannot decode KeyPurposeId");
+            return -1;
+        }
+        eku.bits |= 1 << ext_key_usage_bit_of_oid(purpose);
+        eku.purposes.push_back(oid_intern(purpose));
     }
-    sequence.erase(0, n_bytes);
+    index = sequence_end;
+    return 0;
+}
 
-    if (sequence.empty()) {
-        LOGERROR("Missing field after extn_id");
+/*
+ * certificatePolicies ::= SEQUENCE SIZE (1..MAX) OF PolicyInformation
+ *
+ * PolicyInformation ::= SEQUENCE {
+ *      policyIdentifier   CertPolicyId,
+ *      policyQualifiers   SEQUENCE SIZE (1..MAX) OF
+ *                              PolicyQualifierInfo OPTIONAL }
+ *
+ * Only the policyIdentifier are kept.
+ */
+static int der_decode_x509_certificate_policies(const Der_tape &tape, size_t &index, size_t end, CertificatePolicies &policies)
+{
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
+        LOGERROR("Cannot decode header");
         return -1;
     }
-
-    if (sequence[0] == V_ASN1_BOOLEAN) {
-        // This is 'critical'
-        n_bytes = der_decode_boolean(sequence, extension.critical);
-        if (n_bytes < 0) {
-            LOGERROR("Cannot decode boolean");
+    size_t sequence_end = tape[index].next;
+    for (size_t item = index + 1; item < sequence_end; item = tape[item].next) {
+        if (der_expect(tape, item, sequence_end, V_ASN1_SEQUENCE)) {
+            LOGERROR("Cannot decode PolicyInformation");
             return -1;
         }
-        sequence.erase(0, n_bytes);
-    } else {
-        // default value FALSE
-        extension.critical = false;
+        size_t field = item + 1;
+        ObjectIdentifier policy;
+        if (der_decode_object_identifier(tape, field, tape[item].next, policy)) {
+            LOGERROR("Cannot decode policyIdentifier");
+            return -1;
+        }
+        policies.policies.push_back(oid_intern(policy));
     }
+    index = sequence_end;
+    return 0;
+}
 
-    OctetString extn_value;
-    n_bytes = der_decode_octet_string(sequence, extn_value);
-    if (n_bytes < 0) {
-        LOGERROR("Cannot decode extnValue octet string");
-        return -1;
-    }
+/**
+ * @brief Decode the contents of an extnValue, whose DER is in a tape of its own
+ */
+static int der_decode_x509_extension_value(const std::string &oid_name, const OctetString &extn_value, Extension &extension)
+{
+    Der_tape tape;
+    if (der_tape_build(extn_value.data(), extn_value.size(), tape) < 0) tape.tlvs.clear();
+    size_t index = 0;
+    size_t end = tape.size(); // 0 if the value is not valid DER: each decoder reports it
 
-    // TODO add warnings for fields below that are not fully decoded
-    std::string oid_name = oid_get_name(extension.extn_id);
-    LOGDEBUG("oid %s", oid_name.c_str());
     if (oid_name == "id-ce-subjectKeyIdentifier") {
         OctetString data;
-        int n_bytes = der_decode_octet_string(extn_value, data);
-        if (n_bytes < 0) {
+        if (der_decode_octet_string(tape, index, end, data)) {
             LOGERROR("Cannot decode id-ce-subjectKeyIdentifier");
             return -1;
         }
         extension.extn_value.emplace<SubjectKeyIdentifier>(data);
     } else if (oid_name == "id-ce-keyUsage") {
         KeyUsage key_usage;
-        int n_bytes = der_decode_x509_key_usage(extn_value, key_usage);
-        if (n_bytes < 0) {
+        if (der_decode_x509_key_usage(tape, index, end, key_usage)) {
             LOGERROR("Cannot decode id-ce-keyUsage");
             return -1;
         }
         extension.extn_value = key_usage;
-    } else if (oid_name == "id-ce-privateKeyUsagePeriod") {
-        extension.extn_value = extn_value;
-    } else if (oid_name == "id-ce-subjectAltName") {
-        GeneralNames general_names;
-        der_decode_x509_general_names(extn_value, general_names);
-        extension.extn_value = general_names;
-    } else if (oid_name == "id-ce-issuerAltName") {
-        GeneralNames general_names;
-        der_decode_x509_general_names(extn_value, general_names);
-        extension.extn_value = general_names;
+    } else if (oid_name == "id-ce-extKeyUsage") {
+        // Invalid values are kept encoded
+        ExtKeyUsage eku;
+        if (der_decode_x509_ext_key_usage(tape, index, end, eku)) {
+            LOGWARNING("Cannot decode id-ce-extKeyUsage");
+            extension.extn_value = extn_value;
+        } else {
+            extension.extn_value = eku;
+        }
+    } else if (oid_name == "id-ce-certificatePolicies") {
+        // Invalid values are kept encoded
+        CertificatePolicies policies;
+        if (der_decode_x509_certificate_policies(tape, index, end, policies)) {
+            LOGWARNING("Cannot decode id-ce-certificatePolicies");
+            extension.extn_value = extn_value;
+        } else {
+            extension.extn_value = policies;
+        }
+    } else if (oid_name == "id-ce-nameConstraints") {
+        // Invalid values are kept encoded
+        NameConstraints constraints;
+        if (der_decode_x509_name_constraints(tape, index, end, constraints)) {
+            LOGWARNING("Cannot decode id-ce-nameConstraints");
+            extension.extn_value = extn_value;
+        } else {
+            extension.extn_value = constraints;
+        }
     } else if (oid_name == "id-ce-basicConstraints") {
         BasicConstraints basic_constraints;
-        int n_bytes = der_decode_x509_basic_constraints(extn_value, basic_constraints);
-        if (n_bytes < 0) {
+        if (der_decode_x509_basic_constraints(tape, index, end, basic_constraints)) {
             LOGERROR("Cannot decode id-ce-basicConstraints");
             return -1;
         }
         extension.extn_value = basic_constraints;
-    } else if (oid_name == "id-ce-cRLNumber") {
-        extension.extn_value = extn_value;
-    } else if (oid_name == "id-ce-cRLReasons") {
-        extension.extn_value = extn_value;
-    } else if (oid_name == "id-ce-instructionCode") {
-        extension.extn_value = extn_value;
-    } else if (oid_name == "id-ce-holdInstructionCode") {
-        extension.extn_value = extn_value;
     } else if (oid_name == "id-ce-invalidityDate") {
         std::string time;
-        int n_bytes = der_decode_generalized_time(extn_value, time);
-        if (n_bytes < 0) {
+        if (der_decode_generalized_time(tape, index, end, time)) {
             LOGERROR("Cannot decode id-ce-invalidityDate");
             return -1;
         }
         extension.extn_value = time;
-    } else if (oid_name == "id-ce-issuingDistributionPoint") {
-        extension.extn_value = extn_value;
-    } else if (oid_name == "id-ce-deltaCRLIndicator") {
-        extension.extn_value = extn_value;
-    } else if (oid_name == "id-ce-issuingDistributionPoint") {
-        extension.extn_value = extn_value;
-    } else if (oid_name == "id-ce-certificateIssuer") {
-        GeneralNames general_names;
-        der_decode_x509_general_names(extn_value, general_names);
-        extension.extn_value = general_names;
-    } else if (oid_name == "id-ce-nameConstraints") {
-        extension.extn_value = extn_value;
-    } else if (oid_name == "id-ce-cRLDistributionPoints") {
-        extension.extn_value = extn_value;
-    } else if (oid_name == "id-ce-certificatePolicies") {
-        extension.extn_value = extn_value;
-    } else if (oid_name == "id-ce-policyMappings") {
-        extension.extn_value = extn_value;
     } else if (oid_name == "id-ce-authorityKeyIdentifier") {
         AuthorityKeyIdentifier akid;
-        int n_bytes = der_decode_x509_authority_key_identifier(extn_value, akid);
-        if (n_bytes < 0) {
+        if (der_decode_x509_authority_key_identifier(tape, index, end, akid)) {
             LOGERROR("Cannot decode id-ce-authorityKeyIdentifier");
             return -1;
         }
         extension.extn_value = akid;
-    } else if (oid_name == "id-ce-policyConstraints") {
-        extension.extn_value = extn_value;
-    } else if (oid_name == "id-ce-extKeyUsage") {
-        extension.extn_value = extn_value;
     } else {
-        extension.extn_value = extn_value;
+        // subjectAltName, issuerAltName, certificateIssuer
+        // Invalid values are ignored, but not the ones that exceed the limit
+        GeneralNames general_names;
+        size_t max_names = der_get_limit(DER_LIMIT_GENERAL_NAMES);
+        if (end && der_check_limit(DER_LIMIT_GENERAL_NAMES, der_count_children(tape, 0, max_names))) return -1;
+        der_decode_x509_general_names(tape, index, end, general_names);
+        extension.extn_value = general_names;
+    }
+    return 0;
+}
+
+/*
+ * Extension  ::=  SEQUENCE  {
+ *     extnID      OBJECT IDENTIFIER,
+ *     critical    BOOLEAN DEFAULT FALSE,
+ *     extnValue   OCTET STRING
+ *                 -- contains the DER encoding of an ASN.1 value
+ *                 -- corresponding to the extension type identified
+ *                 -- by extnID
+ *     }
+ */
+static int der_decode_x509_extension(const Der_tape &tape, size_t &index, size_t end, Extension &extension)
+{
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
+        LOGERROR("Cannot decode header");
+        return -1;
+    }
+    size_t sequence_end = tape[index].next;
+    size_t field = index + 1;
+
+    if (der_decode_object_identifier(tape, field, sequence_end, extension.extn_id)) {
+        LOGERROR("Cannot decode header");
+        return -1;
+    }
+
+    if (field >= sequence_end) {
+        LOGERROR("Missing field after extn_id");
+        return -1;
+    }
+
+    if (tape[field].tag == V_ASN1_BOOLEAN) {
+        // This is 'critical'
+        if (der_decode_boolean(tape, field, sequence_end, extension.critical)) {
+            LOGERROR("Cannot decode boolean");
+            return -1;
+        }
+    } else {
+        // default value FALSE
+        extension.critical = false;
+    }
+
+    OctetString extn_value;
+    if (der_decode_octet_string(tape, field, sequence_end, extn_value)) {
+        LOGERROR("Cannot decode extnValue octet string");
+        return -1;
     }
+    index = sequence_end;
 
-    return n_bytes_total;
+    // TODO add warnings for fields below that are not fully decoded
+    std::string oid_name = oid_get_name(extension.extn_id);
+    LOGDEBUG("oid %s", oid_name.c_str());
+    if (oid_name == "id-ce-subjectKeyIdentifier"
+        || oid_name == "id-ce-keyUsage"
+        || oid_name == "id-ce-extKeyUsage"
+        || oid_name == "id-ce-certificatePolicies"
+        || oid_name == "id-ce-subjectAltName"
+        || oid_name == "id-ce-issuerAltName"
+        || oid_name == "id-ce-basicConstraints"
+        || oid_name == "id-ce-nameConstraints"
+        || oid_name == "id-ce-invalidityDate"
+        || oid_name == "id-ce-certificateIssuer"
+        || oid_name == "id-ce-authorityKeyIdentifier") {
+        return der_decode_x509_extension_value(oid_name, extn_value, extension);
+    }
+    // Other extensions are kept encoded (eg: id-ce-policyMappings)
+    extension.extn_value = extn_value;
+    return 0;
 }
 
 /*
  * Extensions  ::=  SEQUENCE SIZE (1..MAX) OF Extension
  */
-int der_decode_x509_extensions(const OctetString &der_bytes, Extensions &extensions)
+static int der_decode_x509_extensions(const Der_tape &tape, size_t &index, size_t end, Extensions &extensions)
 {
-    LOGHEX("", der_bytes, 16);
-
     // decode SEQUENCE OF header
-    OctetString sequenceof;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_SEQUENCE, sequenceof);
-    if (n_bytes_total < 0) {
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
+    size_t sequenceof_end = tape[index].next;
+    size_t n_extensions = der_count_children(tape, index, der_get_limit(DER_LIMIT_EXTENSIONS));
+    if (der_check_limit(DER_LIMIT_EXTENSIONS, n_extensions)) return -1;
 
-    // while more in the SEQUENCE OF, decode SET OF
-    while (sequenceof.size()) {
+    for (size_t item = index + 1; item < sequenceof_end; ) {
         Extension extension;
-        int n_bytes = der_decode_x509_extension(sequenceof, extension);
-        if (n_bytes < 0) {
+        if (der_decode_x509_extension(tape, item, sequenceof_end, extension)) {
             LOGERROR("Cannot decode extension");
             return -1;
         }
         extensions.items[extension.extn_id] = extension;
-        sequenceof.erase(0, n_bytes);
     }
 
-    return n_bytes_total;
+    index = sequenceof_end;
+    return 0;
 }
 
 /**
  * @brief der_decode_x509_tbs_certificate
- * @param der_bytes
- * @param tbs_certificate
- * @return
  *
  *  TBSCertificate  ::=  SEQUENCE  {
  *       version         [0]  Version DEFAULT v1,
@@ -960,106 +993,74 @@ int der_decode_x509_extensions(const OctetString &der_bytes, Extensions &extensi
  *       extensions      [3]  Extensions OPTIONAL
  *                            -- If present, version MUST be v3 --  }
  */
-static int der_decode_x509_tbs_certificate(const OctetString &der_bytes, TBSCertificate &tbs_certificate)
+static int der_decode_x509_tbs_certificate(const Der_tape &tape, size_t &index, size_t end, TBSCertificate &tbs_certificate)
 {
-    LOGHEX("", der_bytes, 16);
-    OctetString value;
-    int n_bytes_total = der_decode_header(der_bytes, V_ASN1_SEQUENCE, value);
-    if (n_bytes_total < 0) {
+    if (der_expect(tape, index, end, V_ASN1_SEQUENCE)) {
         LOGERROR("Cannot decode header");
         return -1;
     }
+    size_t sequence_end = tape[index].next;
+    size_t field = index + 1;
 
     // extract the EXPLICIT tag [0] of 'version'
-    OctetString version;
-    int n_bytes = der_decode_header(value, 0, version);
-    if (n_bytes < 0) {
+    if (der_expect(tape, field, sequence_end, 0)) {
         LOGERROR("Cannot decode version explicit tag");
         return -1;
     }
-
-    int n_bytes_version = der_decode_integer(version, tbs_certificate.version);
-    if (n_bytes_version < 0) {
+    size_t version = field + 1;
+    if (der_decode_integer(tape, version, tape[field].next, tbs_certificate.version)) {
         LOGERROR("cannot decode version");
         return -1;
     }
+    field = tape[field].next;
 
-    value.erase(0, n_bytes);
-
-    n_bytes = der_decode_integer(value, tbs_certificate.serial_number);
-    if (n_bytes < 0) {
+    if (der_decode_integer(tape, field, sequence_end, tbs_certificate.serial_number)) {
         LOGERROR("Cannot decode serial number");
         return -1;
     }
-    value.erase(0, n_bytes);
 
-    n_bytes = der_decode_x509_algorithm_identifier(value, tbs_certificate.signature);
-    if (n_bytes < 0) {
+    if (der_decode_x509_algorithm_identifier(tape, field, sequence_end, tbs_certificate.signature)) {
         LOGERROR("Cannot decode signature");
         return -1;
     }
-    value.erase(0, n_bytes);
 
-    n_bytes = der_decode_x509_name(value, tbs_certificate.issuer);
-    if (n_bytes < 0) {
+    if (der_decode_x509_name(tape, field, sequence_end, tbs_certificate.issuer)) {
         LOGERROR("Cannot decode issuer");
         return -1;
     }
-    value.erase(0, n_bytes);
 
-    n_bytes = der_decode_x509_validity(value, tbs_certificate.validity);
-    if (n_bytes < 0) {
+    if (der_decode_x509_validity(tape, field, sequence_end, tbs_certificate.validity)) {
         LOGERROR("Cannot decode validity");
         return -1;
     }
-    value.erase(0, n_bytes);
 
-    n_bytes = der_decode_x509_name(value, tbs_certificate.subject);
-    if (n_bytes < 0) {
+    if (der_decode_x509_name(tape, field, sequence_end, tbs_certificate.subject)) {
         LOGERROR("Cannot decode subject");
         return -1;
     }
-    value.erase(0, n_bytes);
 
-    n_bytes = der_decode_x509_subject_public_key_info(value, tbs_certificate.subject_public_key_info);
-    if (n_bytes < 0) {
+    // Computed once, for the matching of issuers
+    tbs_certificate.issuer_key = compute_name_key(tbs_certificate.issuer);
+    tbs_certificate.subject_key = compute_name_key(tbs_certificate.subject);
+
+    if (der_decode_x509_subject_public_key_info(tape, field, sequence_end, tbs_certificate.subject_public_key_info)) {
         LOGERROR("Cannot decode subject_public_key_info");
         return -1;
     }
-    value.erase(0, n_bytes);
-
-    while (!value.empty()) {
-        // There are remaining bytes. Optional fields are expected.
-        int tag;
-        OctetString data;
-        n_bytes = get_tag_length_value(value, tag, data);
-        if (n_bytes <= 0) {
-            LOGERROR("cannot decode tag and length");
-            return -1;
-        }
 
-        value = data;
-        LOGHEX("", value, 16);
-
-        OctetString optional;
+    for (; field < sequence_end; field = tape[field].next) {
+        // There are remaining values. Optional fields are expected.
+        int tag = tape.tag_number(field);
+        size_t extensions = field + 1;
         switch (tag) {
-        case 1: // issuerUniqueID
-            n_bytes = der_decode_bit_string(value, tbs_certificate.issuer_unique_id);
-            if (n_bytes < 0) {
-                LOGERROR("cannot decode issuer unique id");
-                return -1;
-            }
+        case 1: // issuerUniqueID (IMPLICIT BIT STRING)
+            tbs_certificate.issuer_unique_id = tape.value_bytes(field);
             break;
-        case 2: // subjectUniqueID
-            n_bytes = der_decode_bit_string(value, tbs_certificate.subject_unique_id);
-            if (n_bytes < 0) {
-                LOGERROR("cannot decode subject unique id");
-                return -1;
-            }
+        case 2: // subjectUniqueID (IMPLICIT BIT STRING)
+            tbs_certificate.subject_unique_id = tape.value_bytes(field);
             break;
         case 3: // extensions
-            n_bytes = der_decode_x509_extensions(value, tbs_certificate.extensions);
-            if (n_bytes < 0) {
+            if (der_decode_x509_extensions(tape, extensions, tape[field].next, tbs_certificate.extensions)) {
                 LOGERROR("cannot decode extensions");
                 return -1;
             }
@@ -1068,65 +1069,220 @@ static int der_decode_x509_tbs_certificate(const OctetString &der_bytes, TBSCert
             LOGERROR("cannot decode optional fields: tag=0x%x", tag);
             return -1;
         }
-        value.erase(0, n_bytes);
     }
 
-    return n_bytes_total;
-}
+    // Computed once, for the filters of usages and policies
+    tbs_certificate.usage_bits = compute_usage_bits(tbs_certificate.extensions);
 
+    index = sequence_end;
+    return 0;
+}
 
 /**
- * @brief der_decode_x509_certificate
- * @param der_bytes
- * @param i_start
- * @param i_end
- * @param out
- * @return
+ * @brief Decode a certificate, from the tape of its DER encoding
  *
  * Certificate  ::=  SEQUENCE  {
  *      tbsCertificate       TBSCertificate,
  *      signatureAlgorithm   AlgorithmIdentifier,
  *      signature            BIT STRING  }
  */
+static int der_decode_x509_certificate(const Der_tape &tape, Certificate &cert)
+{
+    size_t end = tape.size();
+    if (der_expect(tape, 0, end, V_ASN1_SEQUENCE)) {
+        LOGERROR("Cannot decode header");
+        return -1;
+    }
+    size_t field = 1;
+
+    if (der_decode_x509_tbs_certificate(tape, field, end, cert.tbs_certificate)) {
+        LOGERROR("cannot decode tbs_certificate");
+        return -1;
+    }
+
+    if (der_decode_x509_algorithm_identifier(tape, field, end, cert.signature_algorithm)) {
+        LOGERROR("cannot decode signature_algorithm");
+        return -1;
+    }
+
+    if (der_decode_bit_string(tape, field, end, cert.signature_value)) {
+        LOGERROR("cannot decode signature_value");
+        return -1;
+    }
+
+    if (field < end) {
+        LOGERROR("warning: trailing garbage bytes not decoded (too many bytes)");
+    }
+
+    return 0;
+}
+
+/**
+ * @brief der_decode_x509_certificate
+ * @param[in]  der_bytes
+ * @param[out] cert
+ * @return 0 on success, -1 on error
+ *
+ * The structure of the whole certificate is first scanned into a tape
+ * (see der_tape_build), and the fields are then decoded from the tape,
+ * without parsing the headers again.
+ *
+ * Certificates that exceed the limits of size and counts of elements
+ * (see Der_limit) are rejected.
+ */
 int der_decode_x509_certificate(const OctetString &der_bytes, Certificate &cert)
 {
     LOGHEX("", der_bytes, 16);
+    if (der_check_limit(DER_LIMIT_CERT_SIZE, der_bytes.size())) return -1;
     cert.der_bytes = der_bytes;
 
-    OctetString value;
-    int n_bytes = der_decode_header(der_bytes, V_ASN1_SEQUENCE, value);
-    if (n_bytes < 0) {
-        LOGERROR("Cannot decode header");
+    // One tape per thread, so that its entries are not reallocated for each certificate
+    static thread_local Der_tape tape;
+    if (der_tape_build(cert.der_bytes.data(), cert.der_bytes.size(), tape) < 0) {
+        LOGERROR("Invalid DER structure");
         return -1;
     }
+    return der_decode_x509_certificate(tape, cert);
+}
 
-    n_bytes = der_decode_x509_tbs_certificate(value, cert.tbs_certificate);
-    if (n_bytes < 0) {
-        LOGERROR("cannot decode tbs_certificate");
+/**
+ * @brief Decode a Name, from its DER encoding (eg: the issuer of a CRL)
+ */
+int der_decode_x509_name(const OctetString &der_bytes, Name &name)
+{
+    Der_tape tape;
+    if (der_tape_build(der_bytes.data(), der_bytes.size(), tape) < 0) {
+        LOGERROR("Invalid DER structure");
         return -1;
     }
+    size_t index = 0;
+    return der_decode_x509_name(tape, index, tape.size(), name);
+}
 
-    value.erase(0, n_bytes); // remove consumed bytes
+/**
+ * @brief Decode a PKCS#10 certification request (CSR)
+ *
+ * CertificationRequest ::= SEQUENCE {
+ *      certificationRequestInfo  CertificationRequestInfo,
+ *      signatureAlgorithm        AlgorithmIdentifier,
+ *      signature                 BIT STRING }
+ *
+ * CertificationRequestInfo ::= SEQUENCE {
+ *      version       INTEGER { v1(0) },
+ *      subject       Name,
+ *      subjectPKInfo SubjectPublicKeyInfo,
+ *      attributes    [0] Attributes }
+ */
+int der_decode_pkcs10_request(const OctetString &der_bytes, CertificationRequest &csr)
+{
+    if (der_check_limit(DER_LIMIT_CERT_SIZE, der_bytes.size())) return -1;
+    csr.der_bytes = der_bytes;
 
-    n_bytes = der_decode_x509_algorithm_identifier(value, cert.signature_algorithm);
-    if (n_bytes < 0) {
-        LOGERROR("cannot decode signature_algorithm");
+    Der_tape tape;
+    if (der_tape_build(csr.der_bytes.data(), csr.der_bytes.size(), tape) < 0) {
+        LOGERROR("Invalid DER structure");
+        return -1;
+    }
+    size_t end = tape.size();
+    if (der_expect(tape, 0, end, V_ASN1_SEQUENCE) || der_expect(tape, 1, end, V_ASN1_SEQUENCE)) {
+        LOGERROR("Cannot decode header");
+        return -1;
+    }
+    size_t info_end = tape[1].next;
+    size_t field = 2;
+    if (der_decode_integer(tape, field, info_end, csr.version)) {
+        LOGERROR("Cannot decode version");
+        return -1;
+    }
+    if (der_decode_x509_name(tape, field, info_end, csr.subject)) {
+        LOGERROR("Cannot decode subject");
+        return -1;
+    }
+    if (der_decode_x509_subject_public_key_info(tape, field, info_end, csr.subject_public_key_info)) {
+        LOGERROR("Cannot decode subjectPKInfo");
+        return -1;
+    }
+    field = info_end;
+    if (der_decode_x509_algorithm_identifier(tape, field, end, csr.signature_algorithm)) {
+        LOGERROR("Cannot decode signatureAlgorithm");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the certificates of a PKCS#7 SignedData (eg: .p7b file)
+ * @param[in]  der_bytes
+ * @param[out] certificates  DER encoded
+ * @return 0 on success, -1 on error
+ *
+ * ContentInfo ::= SEQUENCE {
+ *      contentType        ContentType,
+ *      content        [0] EXPLICIT ANY DEFINED BY contentType }
+ *
+ * SignedData ::= SEQUENCE {
+ *      version            CMSVersion,
+ *      digestAlgorithms   DigestAlgorithmIdentifiers,
+ *      encapContentInfo   EncapsulatedContentInfo,
+ *      certificates   [0] IMPLICIT CertificateSet OPTIONAL,
+ *      crls           [1] IMPLICIT RevocationInfoChoices OPTIONAL,
+ *      signerInfos        SignerInfos }
+ *
+ * Only the certificates of the CertificateSet are returned (other choices,
+ * such as attribute certificates, are ignored).
+ */
+int der_decode_pkcs7_certificates(const OctetString &der_bytes, std::vector<OctetString> &certificates)
+{
+    LOGHEX("", der_bytes, 16);
+    Der_tape tape;
+    if (der_tape_build(der_bytes.data(), der_bytes.size(), tape) < 0) {
+        LOGERROR("Invalid DER structure");
+        return -1;
+    }
+    size_t end = tape.size();
+    if (der_expect(tape, 0, end, V_ASN1_SEQUENCE)) {
+        LOGERROR("Cannot decode header");
         return -1;
     }
 
-    value.erase(0, n_bytes); // remove consumed bytes
+    size_t field = 1;
+    ObjectIdentifier content_type;
+    if (der_decode_object_identifier(tape, field, end, content_type)) {
+        LOGERROR("Cannot decode contentType");
+        return -1;
+    }
+    if (content_type != OID_PKCS7_SIGNED_DATA) {
+        LOGERROR("Not a PKCS#7 SignedData: %s", content_type.c_str());
+        return -1;
+    }
 
-    n_bytes = der_decode_bit_string(value, cert.signature_value);
-    if (n_bytes < 0) {
-        LOGERROR("cannot decode signature_value");
+    if (der_expect(tape, field, end, 0)) {
+        LOGERROR("Cannot decode content explicit tag");
         return -1;
     }
+    size_t content_end = tape[field].next;
+    field++;
 
-    value.erase(0, n_bytes); // remove consumed bytes
+    if (der_expect(tape, field, content_end, V_ASN1_SEQUENCE)) {
+        LOGERROR("Cannot decode SignedData");
+        return -1;
+    }
+    size_t signed_data_end = tape[field].next;
+    field++;
 
-    if (!value.empty()) {
-        LOGERROR("warning: trailing garbage bytes not decoded (too many bytes)");
+    // Skip version, digestAlgorithms and encapContentInfo
+    for (int i=0; i<3; i++) {
+        if (field >= signed_data_end) {
+            LOGERROR("Cannot decode SignedData");
+            return -1;
+        }
+        field = tape[field].next;
     }
 
+    if (field >= signed_data_end || tape[field].tag != 0xA0) return 0; // no certificates
+
+    for (size_t choice = field + 1; choice < tape[field].next; choice = tape[choice].next) {
+        if (tape[choice].tag == 0x30) certificates.push_back(tape.tlv_bytes(choice));
+    }
     return 0;
 }
@@ -1,9 +1,14 @@
 #ifndef DER_DECODE_X509_H
 #define DER_DECODE_X509_H
 
+#include <vector>
+
 #include "certificate.h"
 #include "util.h"
 
 int der_decode_x509_certificate(const OctetString &der_bytes, Certificate &cert);
+int der_decode_x509_name(const OctetString &der_bytes, Name &name);
+int der_decode_pkcs10_request(const OctetString &der_bytes, CertificationRequest &csr);
+int der_decode_pkcs7_certificates(const OctetString &der_bytes, std::vector<OctetString> &certificates);
 
 #endif // DER_DECODE_X509_H
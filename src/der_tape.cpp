@@ -0,0 +1,160 @@
+#include <atomic>
+#include <limits.h>
+
+#include "der_tape.h"
+#include "journal.h"
+
+static size_t limits[DER_LIMIT_COUNT] = {
+    1024 * 1024, // DER_LIMIT_CERT_SIZE
+    32,          // DER_LIMIT_DEPTH
+    128,         // DER_LIMIT_RDNS
+    128,         // DER_LIMIT_EXTENSIONS
+    4096,        // DER_LIMIT_GENERAL_NAMES
+};
+
+static const char *LIMIT_NAMES[DER_LIMIT_COUNT] = {
+    "certificate size",
+    "nesting depth",
+    "RDNs",
+    "extensions",
+    "GeneralNames entries",
+};
+
+static std::atomic<unsigned long> rejections[DER_LIMIT_COUNT];
+
+void der_set_limit(Der_limit limit, size_t value)
+{
+    if (limit == DER_LIMIT_DEPTH && value > DER_MAX_DEPTH) value = DER_MAX_DEPTH;
+    limits[limit] = value;
+}
+
+size_t der_get_limit(Der_limit limit)
+{
+    return limits[limit];
+}
+
+const char *der_limit_name(Der_limit limit)
+{
+    return LIMIT_NAMES[limit];
+}
+
+/**
+ * @brief Get the number of values rejected because they exceeded a limit
+ */
+unsigned long der_get_rejections(Der_limit limit)
+{
+    return rejections[limit];
+}
+
+/**
+ * @brief Check a value against a limit
+ * @return 0 if the value is within the limit, -1 otherwise (the rejection is counted)
+ */
+int der_check_limit(Der_limit limit, size_t value)
+{
+    if (value <= limits[limit]) return 0;
+    rejections[limit]++;
+    LOGERROR("Limit exceeded: %s (%lu > %lu)", LIMIT_NAMES[limit], value, limits[limit]);
+    return -1;
+}
+
+/**
+ * @brief Count the children of a constructed TLV of a tape
+ * @param max  The counting stops after this number
+ * @return The number of children, at most max + 1
+ *
+ * The children are skipped by their next index, so that the cost
+ * does not depend on their contents.
+ */
+size_t der_count_children(const Der_tape &tape, size_t index, size_t max)
+{
+    size_t n = 0;
+    for (size_t child = index + 1; child < tape[index].next && n <= max; child = tape[child].next) n++;
+    return n;
+}
+
+/**
+ * @brief Parse the tag and length of a TLV
+ * @param max_length  Longer values are refused (INT_MAX for the values decoded in memory)
+ * @return The size of the header, 0 if the data is too short to contain it,
+ *         or -1 if it is invalid
+ *
+ * High tag numbers (more than 30) and indefinite lengths are not DER
+ * and are refused, as are lengths above max_length.
+ */
+int der_parse_header(const unsigned char *data, size_t size, Der_header &header, uint64_t max_length)
+{
+    if (size < 2) return 0;
+    header.tag = data[0];
+    if ((header.tag & DER_TAG_NUMBER_MASK) == DER_TAG_NUMBER_MASK) return -1;
+
+    if (!(data[1] & 0x80)) {
+        header.header_size = 2;
+        header.length = data[1];
+        return 2;
+    }
+    size_t n_bytes = data[1] & 0x7f;
+    if (n_bytes == 0 || n_bytes > 8 || (n_bytes > 4 && max_length <= UINT32_MAX)) return -1;
+    if (size < 2 + n_bytes) return 0;
+    uint64_t length = 0;
+    for (size_t i=0; i<n_bytes; i++) length = (length << 8) | data[2 + i];
+    if (length > max_length) return -1;
+    header.header_size = 2 + n_bytes;
+    header.length = length;
+    return header.header_size;
+}
+
+/**
+ * @brief Build the tape of the TLV at the beginning of some data
+ * @param[in]  data
+ * @param[in]  size  Size of the data, that may extend after the TLV
+ * @param[out] tape
+ * @return The size of the TLV, or -1 if it is invalid
+ *
+ * The constructed TLVs are descended without recursion, and the contents
+ * of each one must exactly fill it. The nesting is bounded by DER_LIMIT_DEPTH.
+ * The contents of the primitive TLVs
+ * (including OCTET STRING and BIT STRING that encapsulate DER) are not parsed.
+ */
+int der_tape_build(const unsigned char *data, size_t size, Der_tape &tape)
+{
+    tape.data = data;
+    tape.tlvs.clear();
+
+    size_t open[DER_MAX_DEPTH]; // constructed TLVs whose contents are being scanned
+    size_t open_end[DER_MAX_DEPTH];
+    size_t depth = 0;
+    size_t pos = 0;
+    size_t limit = size;
+    do {
+        Der_header header;
+        if (der_parse_header(data + pos, limit - pos, header) <= 0 || header.length > limit - pos - header.header_size) {
+            LOGERROR("Invalid DER header at offset %lu", pos);
+            return -1;
+        }
+        size_t index = tape.tlvs.size();
+        tape.tlvs.push_back({header.tag, (unsigned char)depth, header.header_size, (uint32_t)pos, (uint32_t)header.length, (uint32_t)index + 1});
+        pos += header.header_size;
+        if (header.tag & DER_CONSTRUCTED) {
+            if (der_check_limit(DER_LIMIT_DEPTH, depth + 1)) {
+                LOGERROR("DER nesting too deep at offset %lu", pos);
+                return -1;
+            }
+            open[depth] = index;
+            open_end[depth] = pos + header.length;
+            limit = open_end[depth];
+            depth++;
+        } else {
+            pos += header.length;
+        }
+
+        // Close the constructed TLVs that end here
+        while (depth && pos == open_end[depth - 1]) {
+            depth--;
+            tape.tlvs[open[depth]].next = tape.tlvs.size();
+            if (depth) limit = open_end[depth - 1];
+        }
+    } while (depth);
+
+    return pos;
+}
@@ -0,0 +1,81 @@
+#ifndef DER_TAPE_H
+#define DER_TAPE_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <vector>
+
+#include "util.h"
+
+#define DER_MAX_DEPTH 64 // nesting of constructed elements
+
+#define DER_CLASS_MASK 0xc0
+#define DER_CLASS_CONTEXT 0x80
+#define DER_CONSTRUCTED 0x20
+#define DER_TAG_NUMBER_MASK 0x1f
+
+/* Limits on the complexity of untrusted DER values
+ *
+ * They bound the time and memory spent on each certificate. The values
+ * that exceed them are rejected, and counted for each limit.
+ */
+enum Der_limit {
+    DER_LIMIT_CERT_SIZE,     // bytes of a certificate
+    DER_LIMIT_DEPTH,         // nesting of constructed TLVs (at most DER_MAX_DEPTH)
+    DER_LIMIT_RDNS,          // attributes of a Name
+    DER_LIMIT_EXTENSIONS,    // extensions of a certificate
+    DER_LIMIT_GENERAL_NAMES, // entries of a GeneralNames (eg: subjectAltName)
+    DER_LIMIT_COUNT
+};
+
+/* Header of a TLV */
+struct Der_header {
+    unsigned char tag;         // identifier octet: class, constructed bit and tag number
+    unsigned char header_size; // size of the tag and length
+    uint64_t length;           // size of the value (at most INT_MAX, unless allowed by der_parse_header())
+};
+
+/* Entry of a tape, for each TLV */
+struct Der_tlv {
+    unsigned char tag;
+    unsigned char depth;       // 0 for the outermost TLV
+    unsigned char header_size;
+    uint32_t offset;           // of the tag, in the data
+    uint32_t length;           // of the value
+    uint32_t next;             // index of the first entry after the contents of this TLV
+};
+
+/* Structure of a DER encoded value, as a flat list of its TLVs in order
+ *
+ * The tape is built in one pass by der_tape_build(), that checks that
+ * the lengths of all the nested TLVs are consistent. The contents of a
+ * constructed TLV at index i are the entries [i+1, tlvs[i].next),
+ * and its next sibling is at tlvs[i].next.
+ *
+ * The tape refers to the data, that must outlive it.
+ */
+class Der_tape {
+public:
+    Der_tape(): data(0) {}
+    const unsigned char *data;
+    std::vector<Der_tlv> tlvs;
+
+    size_t size() const { return tlvs.size(); }
+    const Der_tlv &operator[](size_t i) const { return tlvs[i]; }
+    int tag_number(size_t i) const { return tlvs[i].tag & DER_TAG_NUMBER_MASK; }
+    const unsigned char *value(size_t i) const { return data + tlvs[i].offset + tlvs[i].header_size; }
+    OctetString value_bytes(size_t i) const { return OctetString(value(i), tlvs[i].length); }
+    OctetString tlv_bytes(size_t i) const { return OctetString(data + tlvs[i].offset, tlvs[i].header_size + tlvs[i].length); }
+};
+
+void der_set_limit(Der_limit limit, size_t value);
+size_t der_get_limit(Der_limit limit);
+const char *der_limit_name(Der_limit limit);
+unsigned long der_get_rejections(Der_limit limit);
+int der_check_limit(Der_limit limit, size_t value);
+size_t der_count_children(const Der_tape &tape, size_t index, size_t max);
+
+int der_parse_header(const unsigned char *data, size_t size, Der_header &header, uint64_t max_length=INT_MAX);
+int der_tape_build(const unsigned char *data, size_t size, Der_tape &tape);
+
+#endif // DER_TAPE_H
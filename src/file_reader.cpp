@@ -0,0 +1,509 @@
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "file_reader.h"
+#include "journal.h"
+#include "parallel.h"
+
+#define URING_QUEUE_DEPTH 64   // files in flight, per ring
+#define READ_CHUNK_SIZE 16384  // first read of the io_uring backend (certificate files are usually smaller)
+#define URING_DRAIN_ATTEMPTS 100 // failed waits for the operations in flight, before giving up their buffers
+
+/**
+ * @brief Read a whole file with the classical system calls
+ * @return 0 on success, or an errno value
+ */
+static int read_file_portable(const std::string &path, OctetString &data, size_t &syscalls)
+{
+    syscalls++;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno;
+
+    struct stat st;
+    syscalls++;
+    if (fstat(fd, &st)) {
+        int err = errno;
+        syscalls++;
+        close(fd);
+        return err;
+    }
+
+    // For regular files, stop reading when the size given by fstat is reached
+    bool known_size = S_ISREG(st.st_mode);
+    size_t capacity = (known_size && st.st_size > 0) ? st.st_size : READ_CHUNK_SIZE;
+    size_t size = 0;
+    data.resize(capacity);
+    int err = 0;
+    while (!known_size || size < (size_t)st.st_size) {
+        if (size == data.size()) data.resize(2 * data.size());
+        syscalls++;
+        ssize_t n = read(fd, &data[size], data.size() - size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            err = errno;
+            break;
+        }
+        if (n == 0) break;
+        size += n;
+    }
+    data.resize(size);
+    syscalls++;
+    close(fd);
+    return err;
+}
+
+/**
+ * @brief Read a file with the classical system calls, and pass it to the callback
+ * @param mutex  Protects the stats (may be NULL if they are not shared)
+ */
+static void read_file_to_callback(const std::vector<std::string> &paths, size_t i, const File_callback &callback,
+                                  Read_stats &stats, std::mutex *mutex)
+{
+    OctetString data;
+    size_t syscalls = 0;
+    int err = read_file_portable(paths[i], data, syscalls);
+    {
+        std::unique_lock<std::mutex> lock;
+        if (mutex) lock = std::unique_lock<std::mutex>(*mutex);
+        stats.files++;
+        stats.bytes += data.size();
+        stats.syscalls += syscalls;
+        if (err) stats.errors++;
+    }
+    if (err) data.clear();
+    callback(i, data, err);
+}
+
+static int read_files_portable(const std::vector<std::string> &paths, const File_callback &callback, Read_stats &stats)
+{
+    std::mutex mutex;
+    parallel_for(paths.size(), [&](size_t i) {
+        read_file_to_callback(paths, i, callback, stats, &mutex);
+    });
+    return 0;
+}
+
+/* Minimal io_uring ring, driven by the raw system calls */
+struct Uring {
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sqe_tail; // tail of the prepared entries, not yet published
+    size_t syscalls;
+};
+
+static void uring_exit(Uring &ring)
+{
+    if (ring.sqes) munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ring && ring.cq_ring != ring.sq_ring) munmap(ring.cq_ring, ring.cq_ring_size);
+    if (ring.sq_ring) munmap(ring.sq_ring, ring.sq_ring_size);
+    if (ring.fd >= 0) close(ring.fd);
+    ring.fd = -1;
+}
+
+/**
+ * @return 0 on success, or an errno value
+ */
+static int uring_init(Uring &ring, unsigned entries)
+{
+    memset(&ring, 0, sizeof(ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring.fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring.fd < 0) return errno;
+
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        if (ring.cq_ring_size > ring.sq_ring_size) ring.sq_ring_size = ring.cq_ring_size;
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+
+    ring.sq_ring = mmap(0, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        int err = errno;
+        ring.sq_ring = 0;
+        uring_exit(ring);
+        return err;
+    }
+    if (single_mmap) {
+        ring.cq_ring = ring.sq_ring;
+    } else {
+        ring.cq_ring = mmap(0, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ring == MAP_FAILED) {
+            int err = errno;
+            ring.cq_ring = 0;
+            uring_exit(ring);
+            return err;
+        }
+    }
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = (struct io_uring_sqe *)mmap(0, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        int err = errno;
+        ring.sqes = 0;
+        uring_exit(ring);
+        return err;
+    }
+
+    char *sq = (char *)ring.sq_ring;
+    char *cq = (char *)ring.cq_ring;
+    ring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring.sqe_tail = *ring.sq_tail;
+    return 0;
+}
+
+/**
+ * @brief Tell if the kernel supports the operations needed for reading files
+ */
+static bool uring_probe(Uring &ring)
+{
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+    if (!probe) return false;
+    bool supported = false;
+    if (0 == syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256)) {
+        supported = probe->last_op >= IORING_OP_CLOSE
+                && (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED)
+                && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+                && (probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+/* The caller never has more operations in flight than the ring entries,
+ * so that a submission entry is always available.
+ */
+static struct io_uring_sqe *uring_get_sqe(Uring &ring)
+{
+    unsigned index = ring.sqe_tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[index] = index;
+    ring.sqe_tail++;
+    return sqe;
+}
+
+/**
+ * @brief Submit the prepared entries, and wait for at least wait_nr completions
+ * @return 0 on success, or an errno value
+ */
+static int uring_enter(Uring &ring, unsigned wait_nr)
+{
+    // Publish the new entries to the kernel
+    __atomic_store_n(ring.sq_tail, ring.sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring.sqe_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    while (1) {
+        ring.syscalls++;
+        int ret = syscall(__NR_io_uring_enter, ring.fd, to_submit, wait_nr, flags, NULL, 0);
+        if (ret >= 0) return 0;
+        if (errno != EINTR) return errno;
+    }
+}
+
+static bool uring_has_unsubmitted(Uring &ring)
+{
+    return ring.sqe_tail != *ring.sq_tail;
+}
+
+struct Uring_slot {
+    enum { FREE, OPENING, READING, CLOSING } state;
+    size_t index; // index of the file in the paths
+    int fd;
+    OctetString data;
+    size_t size; // number of bytes read so far
+    int err;
+    bool interrupted; // stopped because the ring failed: the file is to be read again
+};
+
+static void prep_read(Uring &ring, Uring_slot &slot, size_t slot_index)
+{
+    if (slot.size == slot.data.size()) slot.data.resize(slot.data.empty() ? READ_CHUNK_SIZE : 2 * slot.data.size());
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot.fd;
+    sqe->addr = (unsigned long)&slot.data[slot.size];
+    sqe->len = slot.data.size() - slot.size;
+    sqe->off = slot.size;
+    sqe->user_data = slot_index;
+    slot.state = Uring_slot::READING;
+}
+
+static void prep_close(Uring &ring, Uring_slot &slot, size_t slot_index)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = slot.fd;
+    sqe->user_data = slot_index;
+    slot.state = Uring_slot::CLOSING;
+}
+
+/**
+ * @brief Read the files [begin, end) through a private ring
+ *
+ * Up to URING_QUEUE_DEPTH files are opened, read and closed concurrently.
+ * The callbacks of the completed files are run after the next operations
+ * have been submitted, so that the kernel works while the data is decoded.
+ *
+ * If io_uring_enter fails, no more operations are started, and the ones
+ * in flight are waited for (their buffers and file descriptors are still
+ * used by the kernel). The files that were not completely read are then
+ * read with the portable backend.
+ */
+static int read_files_uring_range(const std::vector<std::string> &paths, size_t begin, size_t end,
+                                  const File_callback &callback, Read_stats &stats)
+{
+    Uring ring;
+    int err = uring_init(ring, URING_QUEUE_DEPTH);
+    if (err) {
+        LOGWARNING("io_uring_setup: %s (falling back to portable reads)", strerror(err));
+        for (size_t i=begin; i<end; i++) read_file_to_callback(paths, i, callback, stats, NULL);
+        return 0;
+    }
+
+    std::vector<Uring_slot> slots(URING_QUEUE_DEPTH);
+    std::vector<size_t> free_slots;
+    for (size_t i=0; i<slots.size(); i++) {
+        slots[i].state = Uring_slot::FREE;
+        free_slots.push_back(i);
+    }
+
+    size_t next = begin;
+    size_t in_flight = 0;
+    int ring_err = 0;        // first error of io_uring_enter
+    size_t failed_waits = 0; // while draining
+    std::vector<size_t> fallback; // files to read with the portable backend
+    while (1) {
+        // Start opening new files, unless the ring failed
+        while (!ring_err && next < end && !free_slots.empty()) {
+            size_t slot_index = free_slots.back();
+            free_slots.pop_back();
+            Uring_slot &slot = slots[slot_index];
+            slot.index = next;
+            slot.fd = -1;
+            slot.data.clear();
+            slot.size = 0;
+            slot.err = 0;
+            slot.interrupted = false;
+            slot.state = Uring_slot::OPENING;
+            struct io_uring_sqe *sqe = uring_get_sqe(ring);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (unsigned long)paths[next].c_str();
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = slot_index;
+            next++;
+            in_flight++;
+        }
+        if (!in_flight) break;
+
+        err = uring_enter(ring, 1);
+        if (err) {
+            if (!ring_err) LOGWARNING("io_uring_enter: %s (falling back to portable reads)", strerror(err));
+            ring_err = err;
+            if (++failed_waits == URING_DRAIN_ATTEMPTS) break;
+            // Some completions may be available anyway (eg: EBUSY, when the completion queue is full)
+        }
+
+        // Reap the completions, and prepare the following operations
+        // (or close the files synchronously, once the ring has failed)
+        std::vector<size_t> completed;
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            size_t slot_index = cqe->user_data;
+            int res = cqe->res;
+            Uring_slot &slot = slots[slot_index];
+            switch (slot.state) {
+            case Uring_slot::OPENING:
+                if (res < 0) {
+                    slot.err = -res;
+                    completed.push_back(slot_index);
+                } else if (ring_err) {
+                    close(res);
+                    slot.interrupted = true;
+                    completed.push_back(slot_index);
+                } else {
+                    slot.fd = res;
+                    prep_read(ring, slot, slot_index);
+                }
+                break;
+            case Uring_slot::READING:
+                if (res > 0) slot.size += res;
+                else if (res < 0) slot.err = -res;
+                if (ring_err) {
+                    close(slot.fd);
+                    if (res > 0) slot.interrupted = true; // not read up to the end
+                    completed.push_back(slot_index);
+                } else if (res > 0) {
+                    prep_read(ring, slot, slot_index);
+                } else {
+                    prep_close(ring, slot, slot_index);
+                }
+                break;
+            case Uring_slot::CLOSING:
+                completed.push_back(slot_index);
+                break;
+            default:
+                LOGERROR("Unexpected completion for slot %lu", slot_index);
+                break;
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+        if (!ring_err && uring_has_unsubmitted(ring)) {
+            err = uring_enter(ring, 0);
+            if (err) {
+                // The prepared operations are submitted by the next waits
+                LOGWARNING("io_uring_enter: %s (falling back to portable reads)", strerror(err));
+                ring_err = err;
+            }
+        }
+
+        for (size_t slot_index: completed) {
+            Uring_slot &slot = slots[slot_index];
+            if (slot.interrupted) {
+                fallback.push_back(slot.index);
+            } else {
+                slot.data.resize(slot.size);
+                if (slot.err) slot.data.clear();
+                stats.files++;
+                stats.bytes += slot.data.size();
+                if (slot.err) stats.errors++;
+                callback(slot.index, slot.data, slot.err);
+            }
+            slot.state = Uring_slot::FREE;
+            free_slots.push_back(slot_index);
+            in_flight--;
+        }
+    }
+    stats.syscalls += ring.syscalls + 1; // + io_uring_setup
+
+    if (in_flight) {
+        // The kernel may still write into the buffers of the slots: they are not freed
+        LOGERROR("io_uring: %lu operations still in flight (their buffers are leaked)", in_flight);
+        std::vector<Uring_slot> *leaked = new std::vector<Uring_slot>();
+        leaked->swap(slots);
+        for (const auto &slot: *leaked) {
+            if (slot.state != Uring_slot::FREE) fallback.push_back(slot.index);
+        }
+    }
+    uring_exit(ring);
+
+    for (; next < end; next++) fallback.push_back(next);
+    std::sort(fallback.begin(), fallback.end());
+    for (size_t i: fallback) read_file_to_callback(paths, i, callback, stats, NULL);
+    return 0;
+}
+
+/**
+ * @brief Tell if io_uring can be used for reading files
+ */
+static bool uring_available()
+{
+    Uring ring;
+    int err = uring_init(ring, 1);
+    if (err) {
+        LOGINFO("io_uring not available: %s", strerror(err));
+        return false;
+    }
+    bool supported = uring_probe(ring);
+    if (!supported) LOGINFO("io_uring does not support openat/read/close");
+    uring_exit(ring);
+    return supported;
+}
+
+static int read_files_uring(const std::vector<std::string> &paths, const File_callback &callback, Read_stats &stats)
+{
+    // One ring per thread, each reading a contiguous range of the files
+    size_t n_ranges = get_parallel_jobs();
+    if (n_ranges > paths.size()) n_ranges = paths.size();
+    std::vector<Read_stats> range_stats(n_ranges);
+    std::vector<int> range_errors(n_ranges, 0);
+    parallel_for(n_ranges, [&](size_t r) {
+        size_t begin = paths.size() * r / n_ranges;
+        size_t end = paths.size() * (r + 1) / n_ranges;
+        range_errors[r] = read_files_uring_range(paths, begin, end, callback, range_stats[r]);
+    });
+
+    int err = 0;
+    for (size_t r=0; r<n_ranges; r++) {
+        stats.files += range_stats[r].files;
+        stats.bytes += range_stats[r].bytes;
+        stats.errors += range_stats[r].errors;
+        stats.syscalls += range_stats[r].syscalls;
+        if (range_errors[r]) err = -1;
+    }
+    return err;
+}
+
+/**
+ * @brief Read whole files, and pass their contents to the callback
+ * @param paths
+ * @param backend   IO_AUTO selects io_uring when the kernel supports it
+ * @param callback  Called from several threads
+ * @param[out] stats
+ * @return 0 on success, -1 on error
+ *
+ * Errors on individual files (eg: permission denied) are passed to the
+ * callback, and do not make this function fail.
+ */
+int read_files(const std::vector<std::string> &paths, Io_backend backend, const File_callback &callback, Read_stats &stats)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    if (backend != IO_PORTABLE && paths.size()) {
+        if (uring_available()) {
+            backend = IO_URING;
+        } else {
+            if (backend == IO_URING) LOGWARNING("io_uring not supported, falling back to portable reads");
+            backend = IO_PORTABLE;
+        }
+    }
+
+    int err;
+    if (backend == IO_URING) {
+        stats.backend = "io_uring";
+        err = read_files_uring(paths, callback, stats);
+    } else {
+        stats.backend = "portable";
+        err = read_files_portable(paths, callback, stats);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    stats.seconds = elapsed.count();
+    return err;
+}
@@ -0,0 +1,33 @@
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+enum Io_backend {
+    IO_AUTO,     // io_uring if supported by the kernel, else portable
+    IO_URING,
+    IO_PORTABLE  // open, fstat, read, close
+};
+
+struct Read_stats {
+    const char *backend;
+    size_t files;
+    size_t bytes;
+    size_t errors;
+    size_t syscalls; // system calls made for reading the files
+    double seconds;  // wall time of the reading and of the callbacks
+    Read_stats(): backend(""), files(0), bytes(0), errors(0), syscalls(0), seconds(0) {}
+};
+
+/* Called once per file, from the reader threads, in any order.
+ * err is 0 on success, or an errno value (data is then empty).
+ */
+typedef std::function<void(size_t index, const OctetString &data, int err)> File_callback;
+
+int read_files(const std::vector<std::string> &paths, Io_backend backend, const File_callback &callback, Read_stats &stats);
+
+#endif // FILE_READER_H
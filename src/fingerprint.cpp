@@ -0,0 +1,49 @@
+#include <algorithm>
+#include <openssl/evp.h>
+
+#include "fingerprint.h"
+#include "journal.h"
+#include "parallel.h"
+
+#define FINGERPRINT_BATCH_SIZE 256 // certificates hashed in a row by a thread
+
+/**
+ * @brief Compute the fingerprints of the certificates that do not have them yet
+ *
+ * The certificates are hashed by batches, by several threads. The digests
+ * are fetched once, and each thread reuses its contexts, so that the time
+ * goes into the hashing itself (openssl selects the fastest implementation
+ * for the CPU, eg: SHA-NI, AVX2).
+ */
+void compute_fingerprints(std::vector<Certificate_with_links> &certificates)
+{
+    EVP_MD *sha1 = EVP_MD_fetch(NULL, "SHA1", NULL);
+    EVP_MD *sha256 = EVP_MD_fetch(NULL, "SHA256", NULL);
+    if (!sha1 || !sha256) {
+        LOGERROR("Cannot get SHA-1 and SHA-256 digests");
+        EVP_MD_free(sha1);
+        EVP_MD_free(sha256);
+        return;
+    }
+
+    size_t n_batches = (certificates.size() + FINGERPRINT_BATCH_SIZE - 1) / FINGERPRINT_BATCH_SIZE;
+    parallel_for(n_batches, [&](size_t batch) {
+        EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+        size_t end = std::min(certificates.size(), (batch + 1) * FINGERPRINT_BATCH_SIZE);
+        for (size_t i = batch * FINGERPRINT_BATCH_SIZE; i < end && ctx; i++) {
+            Certificate &cert = certificates[i];
+            if (cert.fingerprints.computed) continue;
+            const unsigned char *data = cert.der_bytes.data();
+            size_t size = cert.der_bytes.size();
+            cert.fingerprints.computed =
+                EVP_DigestInit_ex(ctx, sha1, NULL) && EVP_DigestUpdate(ctx, data, size)
+                && EVP_DigestFinal_ex(ctx, cert.fingerprints.sha1, NULL)
+                && EVP_DigestInit_ex(ctx, sha256, NULL) && EVP_DigestUpdate(ctx, data, size)
+                && EVP_DigestFinal_ex(ctx, cert.fingerprints.sha256, NULL);
+        }
+        EVP_MD_CTX_free(ctx);
+    });
+
+    EVP_MD_free(sha1);
+    EVP_MD_free(sha256);
+}
@@ -0,0 +1,10 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <vector>
+
+#include "hierarchy.h"
+
+void compute_fingerprints(std::vector<Certificate_with_links> &certificates);
+
+#endif // FINGERPRINT_H
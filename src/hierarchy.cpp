@@ -1,6 +1,8 @@
 #include <algorithm>
 #include <assert.h>
+#include <unordered_map>
 
+#include "fingerprint.h"
 #include "hierarchy.h"
 #include "journal.h"
 #include "oid_name.h"
@@ -21,13 +23,13 @@ std::string Certificate_with_links::get_file_location() const
  *
  * Tell if a certificate is a valid issuer of another certificate.
  *
- * - compare issuer/subject properties
+ * - compare issuer/subject properties (keys computed when decoding, see set_name_match)
  * - compare extensions
  * - verify signature
  */
 static bool is_issuer(const Certificate_with_links &cert_issuer, const Certificate_with_links &cert_child)
 {
-    if (cert_issuer.tbs_certificate.subject != cert_child.tbs_certificate.issuer) {
+    if (cert_issuer.tbs_certificate.subject_key != cert_child.tbs_certificate.issuer_key) {
         return false;
     }
 
@@ -72,23 +74,35 @@ bool is_self_signed(const Certificate_with_links &cert)
     return is_issuer(cert, cert);
 }
 
+/**
+ * @brief Remove the certificates that are already present in the list
+ *
+ * The certificates are compared by their SHA-256 fingerprints, and then
+ * by their DER encodings. The first occurrence is kept.
+ */
 static void prune_duplicates(std::vector<Certificate_with_links> &certificates)
 {
-    std::vector<Certificate_with_links>::iterator cert1;
-    std::vector<Certificate_with_links>::iterator cert2;
-    for (cert1=certificates.begin(); cert1!=certificates.end(); cert1++) {
-        for (cert2=cert1+1; cert2!=certificates.end();) {
-            if (cert1->der_bytes == cert2->der_bytes) {
-                // Same certificates. Remove the second
-                LOGWARNING("Duplicate certificate %s:%lu ignored (same as %s:%lu)",
-                           cert2->filename.c_str(), cert2->index_in_file,
-                           cert1->filename.c_str(), cert1->index_in_file);
-                cert2 = certificates.erase(cert2);
-            } else {
-                cert2++;
+    compute_fingerprints(certificates);
+
+    std::unordered_map<std::string, size_t> seen; // fingerprint -> index in 'unique'
+    std::vector<Certificate_with_links> unique;
+    unique.reserve(certificates.size());
+    for (size_t i=0; i<certificates.size(); i++) {
+        Certificate_with_links &cert = certificates[i];
+        std::string key((const char *)cert.fingerprints.sha256, sizeof(cert.fingerprints.sha256));
+        if (!cert.fingerprints.computed) key = std::string((const char *)cert.der_bytes.data(), cert.der_bytes.size());
+        auto result = seen.emplace(key, unique.size());
+        if (!result.second) {
+            const Certificate_with_links &first = unique[result.first->second];
+            if (first.der_bytes == cert.der_bytes) {
+                LOGWARNING("Duplicate certificate %s ignored (same as %s)",
+                           cert.get_file_location().c_str(), first.get_file_location().c_str());
+                continue;
             }
         }
+        unique.push_back(std::move(cert));
     }
+    certificates.swap(unique);
 }
 
 static void mark_issuer(Certificate_with_links &issuer, Certificate_with_links &issued)
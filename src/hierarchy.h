@@ -4,13 +4,28 @@
 #include <vector>
 
 #include "certificate.h"
+#include "name_constraints.h"
+
+/* State of the path validation of a certificate (see validate_paths()) */
+struct Path_validation {
+    bool done;
+    bool in_progress;
+    std::string error;        // why the certificate is not valid (empty if valid)
+    std::string issuer_error; // why it cannot issue certificates (empty if it can)
+    int max_path_length;      // non-self-issued intermediate certificates allowed below (-1 if not limited)
+    std::shared_ptr<const Name_constraints> name_constraints; // for the certificates below (NULL if none)
+    Path_validation(): done(false), in_progress(false), max_path_length(-1) {}
+};
 
 struct Certificate_with_links : public Certificate {
     std::string filename;
     int index_in_file;  // -1 if the file contains only 1 certificate
     std::set<Certificate_with_links*> parents;
     std::set<Certificate_with_links*> children;
-    Certificate_with_links(const Certificate &cert):  Certificate(cert) {}
+    bool revoked; // listed in a verified CRL of a parent (see load_crl())
+    Path_validation validation;
+    Certificate_with_links(const Certificate &cert):  Certificate(cert), revoked(false) {}
+    Certificate_with_links(Certificate &&cert):  Certificate(std::move(cert)), revoked(false) {}
     std::string get_file_location() const;
 };
 
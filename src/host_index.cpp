@@ -0,0 +1,51 @@
+#include <fnmatch.h>
+#include <string.h>
+
+#include "host_index.h"
+
+/**
+ * @brief Add a DNS name of a certificate (eg: "www.example.com", "*.example.com")
+ */
+void Host_index::add(const std::string &name, uint32_t cert)
+{
+    std::vector<std::string> labels;
+    reversed_labels(name, labels);
+    if (labels.empty()) return;
+
+    bool wildcard = labels.size() > 1 && labels.back().find('*') != std::string::npos;
+    size_t n_labels = wildcard ? labels.size() - 1 : labels.size();
+    uint32_t node = trie.add(labels, n_labels);
+    nodes.resize(trie.size());
+
+    uint32_t entry = entries.size();
+    entries.push_back({cert, name, wildcard ? labels.back() : ""});
+    if (wildcard) nodes[node].wildcards.push_back(entry);
+    else nodes[node].names.push_back(entry);
+}
+
+/**
+ * @brief Find the names that cover a hostname
+ * @param[out] matches  The matching names are appended
+ */
+void Host_index::find(const std::string &hostname, std::vector<Host_match> &matches) const
+{
+    std::vector<std::string> labels;
+    reversed_labels(hostname, labels);
+    if (labels.empty()) return;
+
+    uint32_t node = Label_trie::ROOT;
+    for (size_t i=0; i<labels.size(); i++) {
+        if (i == labels.size() - 1) {
+            // Only the first label remains: try the wildcards
+            for (uint32_t entry: nodes[node].wildcards) {
+                const Entry &e = entries[entry];
+                if (e.pattern == "*" || 0 == fnmatch(e.pattern.c_str(), labels[i].c_str(), 0)) {
+                    matches.push_back({e.cert, e.name});
+                }
+            }
+        }
+        node = trie.child(node, labels[i]);
+        if (node == Label_trie::NO_NODE) return;
+    }
+    for (uint32_t entry: nodes[node].names) matches.push_back({entries[entry].cert, entries[entry].name});
+}
@@ -0,0 +1,47 @@
+#ifndef HOST_INDEX_H
+#define HOST_INDEX_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "label_trie.h"
+
+/* Name of a certificate that covers a hostname */
+struct Host_match {
+    uint32_t cert;     // index given to Host_index::add()
+    std::string name;  // as in the certificate (eg: "*.example.com")
+};
+
+/* Index of the DNS names of certificates, to find the ones that cover a hostname
+ *
+ * The names are stored in a trie of their labels, from the last one
+ * (eg: "com", "example", "www"), so that a lookup costs one step per label
+ * of the hostname, whatever the number of names. Wildcard labels (eg: "*",
+ * or "w*") stand for exactly one label, and only as the first label of a name.
+ *
+ * Names and hostnames are compared without case, and without trailing dot.
+ */
+class Host_index {
+public:
+    Host_index(): nodes(1) {}
+    void add(const std::string &name, uint32_t cert);
+    void find(const std::string &hostname, std::vector<Host_match> &matches) const;
+
+private:
+    struct Node {
+        std::vector<uint32_t> names;     // names ending at this node (indexes in entries)
+        std::vector<uint32_t> wildcards; // names whose first label is a wildcard, and the rest ends at this node
+    };
+    struct Entry {
+        uint32_t cert;
+        std::string name;
+        std::string pattern; // first label, for the wildcards
+    };
+
+    Label_trie trie;
+    std::vector<Node> nodes; // by node of the trie
+    std::vector<Entry> entries;
+};
+
+#endif // HOST_INDEX_H
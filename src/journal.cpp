@@ -4,6 +4,8 @@
 
 Journal journal;
 
+thread_local bool Journal::muted = false;
+
 Journal::Journal()
 {
     max_level = LOG_WARNING;
@@ -22,6 +24,10 @@ void Journal::log(int level, const char *file, const char *func, const char *for
 {
     va_list ap;
 
+    // Messages above the log level are neither printed nor kept:
+    // do not pay for formatting them (the decoder logs a lot at debug level)
+    if (level > max_level || muted) return;
+
     /* Determine required size. */
     va_start(ap, format);
     int n = vsnprintf(nullptr, 0, format, ap);
@@ -41,13 +47,12 @@ void Journal::log(int level, const char *file, const char *func, const char *for
         free(ptr);
         return; // cannot log
     }
+    std::lock_guard<std::mutex> lock(mutex);
     lines.push_back(std::make_pair(level, std::string(ptr)));
 
-    if (level <= max_level) {
-        if (level == LOG_DEBUG) fprintf(stderr, "%s: %s: ", file, func);
-        fprintf(stderr, "%s%s", level_prefix(level), ptr);
-        fprintf(stderr, "\n");
-    }
+    if (level == LOG_DEBUG) fprintf(stderr, "%s: %s: ", file, func);
+    fprintf(stderr, "%s%s", level_prefix(level), ptr);
+    fprintf(stderr, "\n");
     free(ptr);
 }
 
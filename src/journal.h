@@ -2,6 +2,7 @@
 #define JOURNAL_H
 
 #include <list>
+#include <mutex>
 #include <string>
 #include <syslog.h>
 
@@ -21,11 +22,15 @@ class Journal {
 private:
     std::list<std::pair<Level, std::string>> lines;
     Level max_level;
+    std::mutex mutex; // log() may be called from the loader worker threads
+    static thread_local bool muted;
 public:
     Journal();
     void log(int level, const char *file, const char *func, const char *format, ...);
     void set_log_level(Level level);
     int get_log_level();
+    bool is_enabled(Level level) const { return level <= max_level && !muted; }
+    void set_muted(bool value) { muted = value; } // for the current thread only (eg: trial decoding)
 };
 
 #define LOG(_level, _fmt, ...) do { journal.log(_level, __FILE__, __func__, _fmt, __VA_ARGS__); } while (0)
@@ -34,7 +39,7 @@ public:
 //#define LOGNOTICE(...)  do { journal.log(LOG_NOTICE, __FILE__, __func__, __VA_ARGS__); } while (0)
 #define LOGINFO(...)    do { journal.log(LOG_INFO, __FILE__, __func__, __VA_ARGS__); } while (0)
 #define LOGDEBUG(...)   do { journal.log(LOG_DEBUG, __FILE__, __func__, __VA_ARGS__); } while (0)
-#define LOGHEX(_label, _bytes, _limit) do { journal.log(LOG_DEBUG, __FILE__, __func__, "%s: %s", _label, hexlify(_bytes, _limit).c_str()); } while (0)
+#define LOGHEX(_label, _bytes, _limit) do { if (journal.is_enabled(LOG_DEBUG)) journal.log(LOG_DEBUG, __FILE__, __func__, "%s: %s", _label, hexlify(_bytes, _limit).c_str()); } while (0)
 
 extern Journal journal;
 
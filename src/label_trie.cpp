@@ -0,0 +1,54 @@
+#include "label_trie.h"
+
+/**
+ * @brief Split a hostname into its labels, from the last one, in lower case
+ */
+void reversed_labels(const std::string &hostname, std::vector<std::string> &labels)
+{
+    labels.clear();
+    size_t end = hostname.size();
+    if (end && hostname[end - 1] == '.') end--;
+    while (end > 0) {
+        size_t dot = hostname.rfind('.', end - 1);
+        size_t start = (dot == std::string::npos) ? 0 : dot + 1;
+        std::string label = hostname.substr(start, end - start);
+        for (char &c: label) {
+            if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        }
+        labels.push_back(label);
+        if (dot == std::string::npos) break;
+        end = dot;
+        if (end == 0) labels.push_back(""); // leading dot
+    }
+}
+
+static std::string edge_key(uint32_t parent, const std::string &label)
+{
+    std::string key((const char *)&parent, sizeof(parent));
+    return key + label;
+}
+
+/**
+ * @brief Add the path of the first n_labels labels (as given by reversed_labels())
+ * @return The node at the end of the path
+ */
+uint32_t Label_trie::add(const std::vector<std::string> &labels, size_t n_labels)
+{
+    uint32_t node = ROOT;
+    for (size_t i=0; i<n_labels; i++) {
+        auto result = edges.emplace(edge_key(node, labels[i]), n_nodes);
+        if (result.second) n_nodes++;
+        node = result.first->second;
+    }
+    return node;
+}
+
+/**
+ * @brief Get the child of a node by its label (NO_NODE if none)
+ */
+uint32_t Label_trie::child(uint32_t node, const std::string &label) const
+{
+    auto it = edges.find(edge_key(node, label));
+    if (it == edges.end()) return NO_NODE;
+    return it->second;
+}
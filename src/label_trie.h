@@ -0,0 +1,31 @@
+#ifndef LABEL_TRIE_H
+#define LABEL_TRIE_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+void reversed_labels(const std::string &hostname, std::vector<std::string> &labels);
+
+/* Trie of domain names, by their labels from the last one (eg: "com", "example", "www")
+ *
+ * Only the links between the nodes are kept here: the nodes are numbered
+ * from 0 (the root), and their contents are kept by the users of the trie,
+ * in a vector of size() nodes.
+ */
+class Label_trie {
+public:
+    static const uint32_t ROOT = 0;
+    static const uint32_t NO_NODE = UINT32_MAX;
+    Label_trie(): n_nodes(1) {}
+    uint32_t add(const std::vector<std::string> &labels, size_t n_labels);
+    uint32_t child(uint32_t node, const std::string &label) const;
+    size_t size() const { return n_nodes; }
+
+private:
+    uint32_t n_nodes;
+    std::unordered_map<std::string, uint32_t> edges; // label and index of parent -> index of child
+};
+
+#endif // LABEL_TRIE_H
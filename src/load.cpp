@@ -1,14 +1,343 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctype.h>
 #include <errno.h>
 #include <fstream>
 #include <iostream>
 #include <limits.h>
+#include <memory>
 #include <stdio.h>
+#include <streambuf>
+#include <thread>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <fcntl.h>
 
+#include "carve.h"
+#include "cert_framer.h"
+#include "ct.h"
+#include "decompress.h"
 #include "der_decode_x509.h"
+#include "der_tape.h"
+#include "file_reader.h"
 #include "journal.h"
 #include "load.h"
+#include "oid_name.h"
+#include "parallel.h"
+#include "pcap.h"
+#include "pem_scan.h"
+#include "pkcs.h"
+#include "tar.h"
 #include "util.h"
+#include "walk.h"
+
+#define PARALLEL_DECODING_MIN_SIZE (1024*1024) // buffers whose certificates are decoded by several threads
+#define MMAP_MIN_SIZE (64*1024*1024)            // files mapped in memory instead of being read
+#define TAR_BATCH_SIZE (4*1024*1024)            // tar members read before being decoded by several threads
+#define TAR_BATCH_MEMBERS 1024
+#define CT_BATCH_ENTRIES 4096                   // CT log entries decoded together by several threads
+#define PCAP_BATCH_CERTIFICATES 1024            // certificates of a capture decoded together by several threads
+#define STREAM_BATCH_CERTIFICATES 256           // certificates of a stream decoded together, while the next ones are received
+#define STREAM_CHUNK_SIZE 65536
+#define KEEP_GOING_LOGGED_FAILURES 10           // failures logged for each reason, the other ones are only counted
+
+enum {
+    OPT_FILES_FROM = 0x100,
+    OPT_IO,
+    OPT_STATS,
+    OPT_CT,
+    OPT_CARVE,
+    OPT_SCAN_TEXT,
+    OPT_SCAN_BASE64,
+    OPT_PKCS12_PASSWORD,
+    OPT_MAX_CERT_SIZE,
+    OPT_MAX_DEPTH,
+    OPT_MAX_RDNS,
+    OPT_MAX_EXTENSIONS,
+    OPT_MAX_GENERAL_NAMES,
+    OPT_NAME_MATCH,
+    OPT_KEY_USAGE,
+    OPT_EXT_KEY_USAGE,
+    OPT_POLICY,
+    OPT_CA,
+};
+
+/**
+ * @brief Set a limit of the decoding (see Der_limit) from a command line argument
+ */
+static void parse_limit(Der_limit limit, const char *arg, struct argp_state* state)
+{
+    char *end;
+    unsigned long value = strtoul(arg, &end, 10);
+    if (*end || !*arg) argp_error(state, "Invalid limit of %s: '%s'", der_limit_name(limit), arg);
+    der_set_limit(limit, value);
+}
+
+/**
+ * @brief Add to a filter the usages of a comma separated list (eg: "keyCertSign,cRLSign")
+ * @param ext  Names of ExtKeyUsage purposes instead of KeyUsage bits
+ */
+static void parse_usages(bool ext, const char *arg, Usage_bits &filter, struct argp_state* state)
+{
+    std::string list = arg;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos) comma = list.size();
+        std::string name = list.substr(start, comma - start);
+        int bit = ext ? ext_key_usage_bit(name) : key_usage_bit(name);
+        if (bit < 0) argp_error(state, "Invalid %s: '%s'", ext ? "extended key usage" : "key usage", name.c_str());
+        if (ext) filter.usages |= 1ULL << (bit + USAGE_EXT_KEY_USAGE_SHIFT);
+        else filter.usages |= 1ULL << bit;
+        start = comma + 1;
+    }
+}
+
+/**
+ * @brief Add a policy to a filter (numerical OID, or name such as anyPolicy)
+ *
+ * The policy is interned before any certificate is decoded,
+ * so that it gets one of the ids that fit in the mask.
+ */
+static void parse_policy(const char *arg, Usage_bits &filter, struct argp_state* state)
+{
+    std::string oid = oid_get_id(arg);
+    if (oid.empty()) {
+        oid = arg;
+        if (oid.empty() || oid.find_first_not_of("0123456789.") != std::string::npos) {
+            argp_error(state, "Invalid policy: '%s'", arg);
+        }
+    }
+    uint32_t id = oid_intern(oid);
+    if (id >= USAGE_MAX_POLICIES) argp_error(state, "Too many policies (at most %d)", USAGE_MAX_POLICIES);
+    filter.policies |= 1ULL << id;
+}
+
+static error_t parse_opt(int key, char* arg, struct argp_state* state)
+{
+    struct Load_options *options = (struct Load_options *)state->input;
+    char *end;
+    long jobs;
+
+    switch(key) {
+    case 'r':
+        options->recursive = true;
+        break;
+    case OPT_FILES_FROM:
+        options->files_from = arg;
+        break;
+    case '0':
+        options->null_separated = true;
+        break;
+    case OPT_IO:
+        if (0 == strcmp(arg, "auto")) options->io_backend = IO_AUTO;
+        else if (0 == strcmp(arg, "uring")) options->io_backend = IO_URING;
+        else if (0 == strcmp(arg, "portable")) options->io_backend = IO_PORTABLE;
+        else argp_error(state, "Invalid io backend: '%s'", arg);
+        break;
+    case OPT_STATS:
+        options->stats = true;
+        break;
+    case OPT_CT:
+        options->ct = true;
+        break;
+    case OPT_CARVE:
+        options->carve = true;
+        break;
+    case OPT_SCAN_TEXT:
+        options->scan_text = true;
+        break;
+    case OPT_SCAN_BASE64:
+        options->scan_text = true;
+        options->scan_base64 = true;
+        break;
+    case OPT_PKCS12_PASSWORD:
+        set_pkcs12_password(arg);
+        break;
+    case 'k':
+        options->keep_going = true;
+        break;
+    case OPT_MAX_CERT_SIZE:
+        parse_limit(DER_LIMIT_CERT_SIZE, arg, state);
+        break;
+    case OPT_MAX_DEPTH:
+        parse_limit(DER_LIMIT_DEPTH, arg, state);
+        break;
+    case OPT_MAX_RDNS:
+        parse_limit(DER_LIMIT_RDNS, arg, state);
+        break;
+    case OPT_MAX_EXTENSIONS:
+        parse_limit(DER_LIMIT_EXTENSIONS, arg, state);
+        break;
+    case OPT_MAX_GENERAL_NAMES:
+        parse_limit(DER_LIMIT_GENERAL_NAMES, arg, state);
+        break;
+    case OPT_NAME_MATCH:
+        if (0 == strcmp(arg, "exact")) set_name_match(NAME_MATCH_EXACT);
+        else if (0 == strcmp(arg, "canonical")) set_name_match(NAME_MATCH_CANONICAL);
+        else argp_error(state, "Invalid name matching: '%s'", arg);
+        break;
+    case OPT_KEY_USAGE:
+        parse_usages(false, arg, options->filter, state);
+        break;
+    case OPT_EXT_KEY_USAGE:
+        parse_usages(true, arg, options->filter, state);
+        break;
+    case OPT_POLICY:
+        parse_policy(arg, options->filter, state);
+        break;
+    case OPT_CA:
+        options->filter.usages |= USAGE_CA;
+        break;
+    case 'j':
+        jobs = strtol(arg, &end, 10);
+        if (*end || jobs < 1) argp_error(state, "Invalid number of jobs: '%s'", arg);
+        set_parallel_jobs(jobs);
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+static struct argp_option options[] = {
+    { "recursive",   'r',           0,        0, "Load all files of the given directories, recursively", 2 },
+    { "files-from",  OPT_FILES_FROM, "FILE",  0, "Load the files listed in FILE (one per line, or - for stdin)", 2 },
+    { "null",        '0',           0,        0, "Paths of --files-from are separated by null characters", 2 },
+    { "jobs",        'j',           "N",      0, "Number of threads (default: number of CPUs)", 2 },
+    { "io",          OPT_IO,        "BACKEND", 0, "Reading of files: auto|uring|portable (default: auto)", 2 },
+    { "stats",       OPT_STATS,     0,        0, "Print statistics about the loading", 2 },
+    { "ct",          OPT_CT,        0,        0, "Load Certificate Transparency log entries (get-entries JSON pages, "
+                                                 "static-ct-api data tiles)", 2 },
+    { "carve",       OPT_CARVE,     0,        0, "Search DER certificates anywhere in the inputs (eg: firmware images)", 2 },
+    { "scan-text",   OPT_SCAN_TEXT, 0,        0, "Search PEM certificates anywhere in the inputs (eg: logs, YAML, JSON)", 2 },
+    { "scan-base64", OPT_SCAN_BASE64, 0,      0, "Same as --scan-text, and also search base64 encoded PEM "
+                                                 "(eg: Kubernetes secrets)", 2 },
+    { "pkcs12-password", OPT_PKCS12_PASSWORD, "PASS", 0, "Password of the PKCS#12 files (default: none, or empty)", 2 },
+    { "keep-going",  'k',           0,        0, "Skip the certificates and files that cannot be loaded, "
+                                                 "instead of stopping", 2 },
+    { "max-cert-size", OPT_MAX_CERT_SIZE, "N", 0, "Reject the certificates larger than N bytes (default: 1048576)", 2 },
+    { "max-depth",   OPT_MAX_DEPTH, "N",      0, "Reject the certificates nested deeper than N levels (default: 32, at most 64)", 2 },
+    { "max-rdns",    OPT_MAX_RDNS,  "N",      0, "Reject the names of more than N attributes (default: 128)", 2 },
+    { "max-extensions", OPT_MAX_EXTENSIONS, "N", 0, "Reject the certificates of more than N extensions (default: 128)", 2 },
+    { "max-general-names", OPT_MAX_GENERAL_NAMES, "N", 0, "Reject the alternative names of more than N entries (default: 4096)", 2 },
+    { "name-match",  OPT_NAME_MATCH, "MODE",  0, "Matching of the names of issuers: exact|canonical "
+                                                 "(default: canonical, ignoring case and spaces)", 2 },
+    { "key-usage",   OPT_KEY_USAGE, "LIST",   0, "Select only the certificates whose keyUsage has all the usages of LIST "
+                                                 "(eg: keyCertSign,cRLSign)", 2 },
+    { "ext-key-usage", OPT_EXT_KEY_USAGE, "LIST", 0, "Select only the certificates whose extKeyUsage has all the purposes "
+                                                 "of LIST (eg: serverAuth,clientAuth)", 2 },
+    { "policy",      OPT_POLICY,    "OID",    0, "Select only the certificates that assert the policy OID (may be repeated)", 2 },
+    { "ca",          OPT_CA,        0,        0, "Select only the CA certificates (basicConstraints cA:true)", 2 },
+    { 0 }
+};
+
+struct argp argp_load = { options, parse_opt, 0, 0 };
+
+/* Reasons of the failures skipped in --keep-going mode */
+enum Load_failure {
+    FAILURE_UNKNOWN_FORMAT,      // neither PEM nor DER
+    FAILURE_PEM_WITHOUT_END,
+    FAILURE_INVALID_DER_LENGTH,
+    FAILURE_TOO_LARGE,           // exceeds --max-cert-size
+    FAILURE_INVALID_CERTIFICATE, // cannot be decoded
+    FAILURE_INVALID_FILE,        // cannot be read, decompressed or parsed (archive, capture, ...)
+    FAILURE_COUNT
+};
+
+static const char *FAILURE_NAMES[FAILURE_COUNT] = {
+    "Unknown certificate format",
+    "PEM certificate without END marker",
+    "Invalid DER length",
+    "Certificate too large",
+    "Cannot decode certificate",
+    "Cannot load file",
+};
+
+static bool keep_going_mode = false;
+static std::atomic<unsigned long> failure_counts[FAILURE_COUNT];
+
+/**
+ * @brief Count a failure skipped in --keep-going mode
+ * @param location  Where the failure occurred, or null if it has already been logged
+ *
+ * Only the first failures of each reason are logged, so that a
+ * large damaged input does not flood the output.
+ */
+static void report_failure(Load_failure reason, const char *location)
+{
+    unsigned long n = ++failure_counts[reason];
+    if (!location || n > KEEP_GOING_LOGGED_FAILURES) return;
+    LOGWARNING("%s: %s (skipped)", FAILURE_NAMES[reason], location);
+    if (n == KEEP_GOING_LOGGED_FAILURES) LOGWARNING("%s: further failures not shown", FAILURE_NAMES[reason]);
+}
+
+/**
+ * @brief Report a file that cannot be read
+ * @param action  What failed (eg: "read from")
+ * @return 0 if the file is skipped (--keep-going mode), -1 otherwise
+ */
+static int report_file_error(const std::string &path, const char *action, int errnum)
+{
+    if (keep_going_mode) {
+        report_failure(FAILURE_INVALID_FILE, (path + ": " + strerror(errnum)).c_str());
+        return 0;
+    }
+    LOGERROR("Cannot %s '%s': %s", action, path.c_str(), strerror(errnum));
+    return -1;
+}
+
+static void print_failure_summary()
+{
+    for (int reason=0; reason<FAILURE_COUNT; reason++) {
+        if (failure_counts[reason]) LOGWARNING("Skipped: %lu x %s", failure_counts[reason].load(), FAILURE_NAMES[reason]);
+    }
+}
+
+/* Print the number of values rejected for each limit of the decoding */
+static void print_rejection_summary()
+{
+    for (int limit=0; limit<DER_LIMIT_COUNT; limit++) {
+        unsigned long n = der_get_rejections((Der_limit)limit);
+        if (n) LOGWARNING("Rejected: %lu x limit of %s exceeded", n, der_limit_name((Der_limit)limit));
+    }
+}
+
+/* Read-only input stream buffer over a memory area, without copy */
+class Memory_streambuf : public std::streambuf {
+public:
+    Memory_streambuf(const unsigned char *data, size_t size) {
+        char *begin = (char *)data;
+        setg(begin, begin, begin + size);
+    }
+};
+
+/* Input stream buffer over a file descriptor (eg: a pipe), that gives
+ * the data as soon as it arrives, without waiting for a full buffer.
+ */
+class Fd_streambuf : public std::streambuf {
+public:
+    Fd_streambuf(int fd): fd(fd), read_errno(0), buffer(STREAM_CHUNK_SIZE) {}
+    int get_errno() const { return read_errno; } // 0 if no read error
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        ssize_t n;
+        do n = read(fd, buffer.data(), buffer.size()); while (n < 0 && errno == EINTR);
+        if (n < 0) read_errno = errno;
+        if (n <= 0) return traits_type::eof();
+        setg(buffer.data(), buffer.data(), buffer.data() + n);
+        return traits_type::to_int_type(*gptr());
+    }
+private:
+    int fd;
+    int read_errno;
+    std::vector<char> buffer;
+};
 
 /* Read a PEM formatted certificate
  *
@@ -99,83 +428,1031 @@ OctetString get_der_sequence(std::istream &input)
     return der_bytes;
 }
 
-static int load_cert_file(std::istream &input, const char *filename, std::vector<Certificate_with_links> &certificates)
+/**
+ * @brief Read and decode the certificate at the current position of the input
+ * @return 0 on success, -1 on error
+ */
+static int load_one_cert(std::istream &input, int c, const char *filename, size_t index, Certificate &cert)
 {
-    LOGDEBUG("%s", filename);
-    size_t index = 0;
-    while (1) {
-        int c = input.peek();
-        if (c == EOF) {
-            // Cannot get a character
-            if (input.eof()) break;
-            LOGERROR("Cannot get first character: %s:%lu: %s", filename, index, strerror(errno));
-            return -1;
+    OctetString der_bytes;
+    if (c == '-') {
+        LOGINFO("Loading %s:%lu as PEM", filename, index);
+        der_bytes = get_pem_cert(input);
+    } else if (c == 0x30) {
+        LOGINFO("Loading %s:%lu as DER", filename, index);
+        der_bytes = get_der_sequence(input);
+    } else {
+        LOGERROR("Unknown certificate format: %s:%lu", filename, index);
+        return -1;
+    }
+    if (der_bytes.empty()) {
+        LOGERROR("Could not read PEM/DER: %s:%lu", filename, index);
+        return -1;
+    }
+
+    int err = der_decode_x509_certificate(der_bytes, cert);
+    if (err) {
+        LOGERROR("Cannot decode certificate: %s:%lu", filename, index);
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Get the size of the DER TLV at the beginning of a buffer
+ * @param[in]  data
+ * @param[in]  size   Size of the buffer
+ * @param[out] total  Size of the tag, length and contents
+ * @return 0 on success, -1 if the size is invalid or exceeds the buffer
+ */
+static int der_tlv_size(const unsigned char *data, size_t size, size_t &total)
+{
+    if (size < 2) return -1;
+    size_t header_size = 2;
+    size_t length = 0;
+    if (data[1] & 0x80) {
+        size_t n_bytes = data[1] & 0x7f;
+        if (size < 2 + n_bytes) return -1;
+        for (size_t i=0; i<n_bytes; i++) {
+            if (length > (INT_MAX >> 8)) return -1; // same limit as get_der_sequence
+            length = (length << 8) + data[2 + i];
         }
-        OctetString der_bytes;
-        if (c == '-') {
-            LOGINFO("Loading %s:%lu as PEM", filename, index);
-            der_bytes = get_pem_cert(input);
-        } else if (c == 0x30) {
-            LOGINFO("Loading %s:%lu as DER", filename, index);
-            der_bytes = get_der_sequence(input);
-        } else {
-            LOGERROR("Unknown certificate format: %s:%lu", filename, index);
-            return -1;
+        header_size += n_bytes;
+    } else {
+        length = data[1];
+    }
+    if (length > size - header_size) return -1;
+    total = header_size + length;
+    return 0;
+}
+
+struct Cert_chunk {
+    size_t offset;
+    size_t size;
+};
+
+/**
+ * @brief Find the boundaries of the concatenated certificates of a buffer
+ *
+ * PEM certificates are delimited by the END marker, and DER certificates
+ * by the length of their top-level SEQUENCE, without decoding them.
+ *
+ * The scan stops at the first position that does not start a PEM or DER
+ * certificate, or whose DER length is invalid: the last chunk then extends
+ * to the end of the buffer, and the error is reported when decoding it.
+ *
+ * In --keep-going mode, the invalid data is reported and skipped instead,
+ * up to the next BEGIN marker or plausible DER header (see resync_cert_boundary).
+ */
+static void scan_cert_boundaries(const unsigned char *data, size_t size, const char *filename, std::vector<Cert_chunk> &chunks)
+{
+    static const char PEM_END[] = PEM_CERTIFICATE_END;
+    static const char PEM_BEGIN[] = PEM_CERTIFICATE_BEGIN;
+    size_t pos = 0;
+    while (pos < size) {
+        size_t end = size;
+        bool valid = false;
+        Load_failure reason = FAILURE_UNKNOWN_FORMAT;
+        if (keep_going_mode && isspace(data[pos])) {
+            pos++; // between certificates
+            continue;
         }
-        if (der_bytes.empty()) {
-            LOGERROR("Could not read PEM/DER: %s:%lu", filename, index);
-            return -1;
+        if (data[pos] == '-' && (!keep_going_mode || is_pem_begin(data + pos, size - pos))) {
+            const unsigned char *marker = (const unsigned char *)memmem(data + pos, size - pos, PEM_END, sizeof(PEM_END) - 1);
+            // In --keep-going mode, do not swallow the next certificate if this one has no END marker
+            if (marker && keep_going_mode) {
+                const unsigned char *next = (const unsigned char *)memmem(data + pos + 1, marker - data - pos - 1,
+                                                                          PEM_BEGIN, sizeof(PEM_BEGIN) - 1);
+                if (next) marker = 0;
+            }
+            if (marker) {
+                const unsigned char *eol = (const unsigned char *)memchr(marker, '\n', data + size - marker);
+                if (eol) end = eol - data + 1;
+                valid = true;
+            } else {
+                reason = FAILURE_PEM_WITHOUT_END;
+            }
+        } else if (data[pos] == 0x30) {
+            size_t total;
+            if (0 == der_tlv_size(data + pos, size - pos, total)) {
+                end = pos + total;
+                valid = true;
+            } else {
+                reason = FAILURE_INVALID_DER_LENGTH;
+            }
+        }
+        if (!valid && keep_going_mode) {
+            std::string location = std::string(filename) + "@" + std::to_string(pos);
+            report_failure(reason, location.c_str());
+            pos = resync_cert_boundary(data, size, pos + 1);
+            continue;
         }
+        chunks.push_back({pos, end - pos});
+        if (!valid) break;
+        pos = end;
+    }
+}
 
-        Certificate cert;
-        int err = der_decode_x509_certificate(der_bytes, cert);
+/**
+ * @brief Load the certificates of a buffer
+ *
+ * Large buffers (eg: bundles of many certificates) are first split
+ * by scan_cert_boundaries(), and then decoded by several threads.
+ * The certificates keep their index in the file.
+ *
+ * As for a sequential reading, the loading fails if a certificate
+ * cannot be decoded, and the certificates after it are ignored
+ * (except in --keep-going mode, where it is reported and skipped).
+ */
+static int load_cert_buffer(const unsigned char *data, size_t size, const char *filename, std::vector<Certificate_with_links> &certificates)
+{
+    LOGDEBUG("%s", filename);
+    std::vector<Cert_chunk> chunks;
+    scan_cert_boundaries(data, size, filename, chunks);
 
-        if (err) {
-            LOGERROR("Cannot decode certificate: %s:%lu", filename, index);
-            return -1;
+    std::vector<Certificate> decoded(chunks.size());
+    std::vector<int> errors(chunks.size(), -1);
+    auto decode_chunk = [&](size_t i) {
+        Memory_streambuf buffer(data + chunks[i].offset, chunks[i].size);
+        std::istream input(&buffer);
+        if (keep_going_mode) journal.set_muted(true); // failures are reported by report_failure
+        errors[i] = load_one_cert(input, data[chunks[i].offset], filename, i, decoded[i]);
+        if (keep_going_mode) journal.set_muted(false);
+    };
+
+    if (size >= PARALLEL_DECODING_MIN_SIZE && chunks.size() > 1) {
+        parallel_for(chunks.size(), decode_chunk);
+    } else {
+        for (size_t i=0; i<chunks.size(); i++) {
+            decode_chunk(i);
+            if (errors[i] && !keep_going_mode) break;
+        }
+    }
+
+    for (size_t i=0; i<chunks.size(); i++) {
+        if (errors[i] && keep_going_mode) {
+            std::string location = std::string(filename) + "@" + std::to_string(chunks[i].offset);
+            report_failure(FAILURE_INVALID_CERTIFICATE, location.c_str());
+            continue;
+        }
+        if (errors[i]) return -1;
+        Certificate_with_links certificate(std::move(decoded[i]));
+        certificate.filename = filename;
+        certificate.index_in_file = i;
+        certificates.push_back(std::move(certificate));
+    }
+
+    if (certificates.empty()) {
+        LOGWARNING("No certificate read from '%s'", filename);
+    }
+
+    return 0;
+}
+
+/* Certificate of a stream, waiting to be decoded */
+struct Pending_frame {
+    Framed_cert frame;
+    size_t index_in_file;
+};
+
+/**
+ * @brief Decode certificates of a stream, in a background thread
+ *
+ * A batch is decoded while the next certificates are being received.
+ */
+class Stream_decoder_thread {
+public:
+    Stream_decoder_thread(const char *filename): filename(filename), done(true) {}
+    ~Stream_decoder_thread() { if (thread.joinable()) thread.join(); }
+    bool is_busy() const { return !done; }
+    void start(std::vector<Pending_frame> &batch);
+    int collect(std::vector<Certificate_with_links> &certificates);
+private:
+    const char *filename;
+    std::vector<Pending_frame> frames;
+    std::vector<Certificate> decoded;
+    std::vector<int> errors;
+    std::thread thread;
+    std::atomic<bool> done;
+};
+
+/**
+ * @brief Start decoding a batch (the batch is emptied)
+ *
+ * The previous batch must have been collected.
+ */
+void Stream_decoder_thread::start(std::vector<Pending_frame> &batch)
+{
+    frames.swap(batch);
+    batch.clear();
+    decoded.assign(frames.size(), Certificate());
+    errors.assign(frames.size(), 0);
+    done = false;
+    thread = std::thread([this]() {
+        parallel_for(frames.size(), [this](size_t i) {
+            const OctetString &bytes = frames[i].frame.bytes;
+            Memory_streambuf buffer(bytes.data(), bytes.size());
+            std::istream input(&buffer);
+            if (keep_going_mode) journal.set_muted(true);
+            errors[i] = load_one_cert(input, bytes[0], filename, frames[i].index_in_file, decoded[i]);
+            if (keep_going_mode) journal.set_muted(false);
+        });
+        done = true;
+    });
+}
+
+/**
+ * @brief Wait for the batch being decoded, and take its certificates
+ * @return 0 on success, -1 on error (except in --keep-going mode)
+ */
+int Stream_decoder_thread::collect(std::vector<Certificate_with_links> &certificates)
+{
+    if (!thread.joinable()) return 0;
+    thread.join();
+    int err = 0;
+    for (size_t i=0; i<frames.size() && !err; i++) {
+        if (errors[i] && keep_going_mode) {
+            std::string location = std::string(filename) + "@" + std::to_string(frames[i].frame.offset);
+            report_failure(FAILURE_INVALID_CERTIFICATE, location.c_str());
+            continue;
+        }
+        if (errors[i]) {
+            err = -1;
+            break;
         }
-        Certificate_with_links certificate(cert);
+        Certificate_with_links certificate(std::move(decoded[i]));
         certificate.filename = filename;
-        certificate.index_in_file = index;
-        certificates.push_back(certificate);
-        index++;
+        certificate.index_in_file = frames[i].index_in_file;
+        certificates.push_back(std::move(certificate));
     }
+    frames.clear();
+    decoded.clear();
+    return err;
+}
+
+/**
+ * @brief Load the certificates of a stream of concatenated PEM and DER certificates, as they arrive
+ *
+ * The stream is split by a Cert_framer, and the certificates are decoded by
+ * batches in a background thread, while the next ones are being received.
+ * A batch is started when it is full, or as soon as the decoder is idle if
+ * the input is slower than the decoding (eg: a pipe fed progressively).
+ *
+ * As for a file, the loading fails at the first certificate in error
+ * (except in --keep-going mode, where it is reported and skipped).
+ */
+static int load_framed_stream(std::streambuf *input, const char *filename, std::vector<Certificate_with_links> &certificates)
+{
+    LOGDEBUG("%s", filename);
+    Cert_framer framer(keep_going_mode);
+    Stream_decoder_thread decoder(filename);
+    std::vector<Framed_cert> frames;
+    std::vector<Pending_frame> batch;
+    size_t index = 0;
+    int err = 0;
+    char chunk[STREAM_CHUNK_SIZE];
+    while (!err) {
+        std::streamsize n = read_available(input, chunk, sizeof(chunk));
+        if (n > 0) framer.feed((unsigned char *)chunk, n, frames);
+        else framer.finish(frames);
+
+        for (auto &frame: frames) {
+            if (frame.error == FRAME_OK) {
+                batch.push_back({std::move(frame), index++});
+                continue;
+            }
+            Load_failure reason = FAILURE_UNKNOWN_FORMAT;
+            if (frame.error == FRAME_PEM_WITHOUT_END) reason = FAILURE_PEM_WITHOUT_END;
+            else if (frame.error == FRAME_INVALID_DER_LENGTH) reason = FAILURE_INVALID_DER_LENGTH;
+            else if (frame.error == FRAME_TOO_LARGE) reason = FAILURE_TOO_LARGE;
+            if (keep_going_mode) {
+                std::string location = std::string(filename) + "@" + std::to_string(frame.offset);
+                report_failure(reason, location.c_str());
+                continue;
+            }
+            LOGERROR("%s: %s:%lu", FAILURE_NAMES[reason], filename, index);
+            err = -1;
+            break;
+        }
+        frames.clear();
+        if (err || n <= 0) break;
+
+        bool input_waiting = (size_t)n < sizeof(chunk); // the input is slower than the decoding
+        if (batch.size() >= STREAM_BATCH_CERTIFICATES || (input_waiting && !batch.empty() && !decoder.is_busy())) {
+            err = decoder.collect(certificates);
+            if (!err) decoder.start(batch);
+        }
+    }
+
+    if (!err) err = decoder.collect(certificates);
+    if (!err && !batch.empty()) {
+        decoder.start(batch);
+        err = decoder.collect(certificates);
+    }
+    if (err) return -1;
 
     if (certificates.empty()) {
         LOGWARNING("No certificate read from '%s'", filename);
     }
+    return 0;
+}
+
+static int load_file_data(const Input_file &file, const unsigned char *data, size_t size, std::vector<Certificate_with_links> &certificates);
+
+/* DER certificate extracted from a container, to be decoded */
+struct Pending_der {
+    OctetString der_bytes;
+    std::string filename;
+    int index_in_file;
+};
+
+/**
+ * @brief Decode pending certificates, with several threads
+ *
+ * As for a sequential decoding, the certificates are kept in order,
+ * and the decoding fails at the first certificate in error
+ * (except in --keep-going mode, where it is reported and skipped).
+ */
+static int decode_der_batch(std::vector<Pending_der> &batch, std::vector<Certificate_with_links> &certificates)
+{
+    std::vector<Certificate> decoded(batch.size());
+    std::vector<int> errors(batch.size(), 0);
+    parallel_for(batch.size(), [&](size_t i) {
+        if (keep_going_mode) journal.set_muted(true);
+        errors[i] = der_decode_x509_certificate(batch[i].der_bytes, decoded[i]);
+        if (keep_going_mode) journal.set_muted(false);
+    });
+
+    for (size_t i=0; i<batch.size(); i++) {
+        if (errors[i]) {
+            std::string location = batch[i].filename;
+            if (batch[i].index_in_file >= 0) location += ":" + std::to_string(batch[i].index_in_file);
+            if (keep_going_mode) {
+                report_failure(FAILURE_INVALID_CERTIFICATE, location.c_str());
+                continue;
+            }
+            LOGERROR("Cannot decode certificate: %s", location.c_str());
+            batch.clear();
+            return -1;
+        }
+        Certificate_with_links certificate(std::move(decoded[i]));
+        certificate.filename = batch[i].filename;
+        certificate.index_in_file = batch[i].index_in_file;
+        certificates.push_back(std::move(certificate));
+    }
+    batch.clear();
+    return 0;
+}
+
+/**
+ * @brief Load the certificates presented in the TLS handshakes of a capture
+ *
+ * Each certificate is located by the frame that completes its handshake message,
+ * and its position in the chain: "capture.pcap:frame:position".
+ * Certificates are given once per capture, and decoded by batches.
+ */
+static int load_pcap_stream(std::istream &input, const char *filename, std::vector<Certificate_with_links> &certificates)
+{
+    LOGINFO("Loading capture '%s'", filename);
+    std::vector<Pending_der> batch;
+    int err = read_pcap(input, filename, [&](OctetString &der_bytes, unsigned long long frame, size_t index_in_chain) {
+        batch.push_back({std::move(der_bytes), std::string(filename) + ":" + std::to_string(frame), (int)index_in_chain});
+        if (batch.size() >= PCAP_BATCH_CERTIFICATES) return decode_der_batch(batch, certificates);
+        return 0;
+    });
+    if (err) return err;
+    return decode_der_batch(batch, certificates);
+}
+
+struct Tar_pending_member {
+    std::string location;
+    OctetString data;
+};
+
+/**
+ * @brief Decode the members of a tar archive read so far, with several threads
+ */
+static int load_tar_batch(std::vector<Tar_pending_member> &batch, std::vector<Certificate_with_links> &certificates)
+{
+    std::vector<std::vector<Certificate_with_links>> member_certificates(batch.size());
+    std::vector<int> errors(batch.size(), 0);
+    parallel_for(batch.size(), [&](size_t i) {
+        Input_file member = { batch[i].location, true, (long long)batch[i].data.size() };
+        errors[i] = load_file_data(member, batch[i].data.data(), batch[i].data.size(), member_certificates[i]);
+    });
+    batch.clear();
+
+    for (size_t i=0; i<member_certificates.size(); i++) {
+        if (errors[i] && keep_going_mode) {
+            report_failure(FAILURE_INVALID_FILE, 0);
+            continue;
+        }
+        if (errors[i]) return errors[i];
+        std::move(member_certificates[i].begin(), member_certificates[i].end(), std::back_inserter(certificates));
+    }
+    return 0;
+}
 
+static int load_cert_stream(std::istream &input, const char *filename, bool discovered,
+                            std::vector<Certificate_with_links> &certificates);
+
+/**
+ * @brief Load the certificates of a member of a tar archive, as it is read
+ *
+ * Only the archive being truncated stops the loading of the archive.
+ * The other errors are the ones of the member.
+ */
+static int load_tar_member_stream(Tar_reader &reader, const unsigned char *magic, size_t magic_size,
+                                  const std::string &location, std::vector<Certificate_with_links> &certificates)
+{
+    Tar_member_streambuf contents(reader);
+    Compression compression = detect_compression(magic, magic_size);
+    Prefixed_streambuf prefixed(magic, magic_size, &contents);
+    std::istream input(&prefixed);
+    std::unique_ptr<Decompress_streambuf> decompress;
+    if (compression != COMPRESSION_NONE) {
+        decompress.reset(new Decompress_streambuf(compression, &prefixed));
+        input.rdbuf(decompress.get());
+    }
+    std::vector<Certificate_with_links> member_certificates;
+    int err = load_cert_stream(input, location.c_str(), true, member_certificates);
+    if (decompress && decompress->failed()) {
+        LOGERROR("Cannot decompress '%s'", location.c_str());
+        err = -1;
+    }
+    if (reader.failed()) return -1;
+    if (err && keep_going_mode) {
+        report_failure(FAILURE_INVALID_FILE, location.c_str());
+        return 0;
+    }
+    if (err) return err;
+    std::move(member_certificates.begin(), member_certificates.end(), std::back_inserter(certificates));
     return 0;
 }
 
-int load_certificates(const std::list<std::string> &paths, std::vector<Certificate_with_links> &certificates)
+/**
+ * @brief Load the certificates of the members of a tar archive
+ * @param input        The archive, possibly being decompressed
+ * @param archive      Name of the archive
+ * @param first_block  First header block, already read from the input
+ *
+ * Each member is loaded as a file discovered in a directory, with location "archive:member".
+ * Members whose first bytes do not look like a certificate file (PEM, DER or a
+ * compression magic number) are skipped without reading the rest of them.
+ * The other ones are read in batches, that are decoded in parallel.
+ */
+static int load_tar_stream(std::istream &input, const char *archive, const unsigned char *first_block,
+                           std::vector<Certificate_with_links> &certificates)
 {
+    LOGINFO("Loading tar archive '%s'", archive);
+    Tar_reader reader(input, archive, first_block);
+    std::vector<Tar_pending_member> batch;
+    size_t batch_size = 0;
+    while (1) {
+        Tar_member member;
+        int result = reader.next(member);
+        if (result < 0) return -1;
+        if (result == 0) break;
+
+        std::string location = std::string(archive) + ":" + member.path;
+        unsigned char magic[COMPRESSION_MAGIC_MAX_SIZE];
+        std::streamsize magic_size = reader.read_some((char *)magic, sizeof(magic));
+        if (magic_size < 0) return -1;
+        if (!magic_size || (magic[0] != '-' && magic[0] != 0x30 &&
+                            detect_compression(magic, magic_size) == COMPRESSION_NONE)) {
+            LOGINFO("Not a certificate file: '%s' (skipped)", location.c_str());
+            continue;
+        }
+
+        if (member.size > der_get_limit(DER_LIMIT_CERT_SIZE)) {
+            // Large member (eg: a bundle): decode it while reading it, after the members before it
+            if (load_tar_batch(batch, certificates)) return -1;
+            batch_size = 0;
+            if (load_tar_member_stream(reader, magic, magic_size, location, certificates)) return -1;
+            continue;
+        }
+
+        batch.push_back({location, OctetString()});
+        OctetString &data = batch.back().data;
+        if (reader.read_contents(data)) return -1;
+        data.insert(0, magic, magic_size);
+        batch_size += member.size;
+        if (batch_size >= TAR_BATCH_SIZE || batch.size() >= TAR_BATCH_MEMBERS) {
+            if (load_tar_batch(batch, certificates)) return -1;
+            batch_size = 0;
+        }
+    }
+    return load_tar_batch(batch, certificates);
+}
+
+/**
+ * @brief Load the certificates of a PKCS#7 (DER or PEM) or PKCS#12 file
+ *
+ * The certificates are located as in a file of concatenated certificates.
+ */
+static int load_pkcs_data(const Input_file &file, const unsigned char *data, size_t size, std::vector<Certificate_with_links> &certificates)
+{
+    std::vector<OctetString> ders;
     int err;
-    if (paths.size() == 0) {
-        // Take certificates from stdin
-        err = load_cert_file(std::cin, "(stdin)", certificates);
-        if (certificates.size() == 1) {
-            certificates[0].index_in_file = -1;
+    if (is_pkcs12(data, size)) {
+        LOGINFO("Loading '%s' as PKCS#12", file.path.c_str());
+        err = pkcs12_get_certificates(data, size, file.path.c_str(), ders);
+    } else {
+        LOGINFO("Loading '%s' as PKCS#7", file.path.c_str());
+        OctetString der_bytes;
+        if (is_pem_pkcs7(data, size)) der_bytes = pem_pkcs7_to_der(data, size);
+        else der_bytes.assign(data, size);
+        err = der_decode_pkcs7_certificates(der_bytes, ders);
+    }
+    if (err) {
+        LOGERROR("Cannot read certificates from '%s'", file.path.c_str());
+        return -1;
+    }
+
+    std::vector<Pending_der> batch;
+    for (size_t i=0; i<ders.size(); i++) {
+        batch.push_back({std::move(ders[i]), file.path, ders.size() == 1 ? -1 : (int)i});
+    }
+    err = decode_der_batch(batch, certificates);
+    if (err) return err;
+    if (certificates.empty()) {
+        LOGWARNING("No certificate read from '%s'", file.path.c_str());
+    }
+    return 0;
+}
+
+static bool is_pkcs_container(const unsigned char *data, size_t size)
+{
+    return is_pkcs7(data, size) || is_pem_pkcs7(data, size) || is_pkcs12(data, size);
+}
+
+/**
+ * @brief Load the certificates of a stream, that may be a tar archive
+ * @param discovered  Skip the stream if it does not look like a certificate file
+ */
+static int load_cert_stream(std::istream &input, const char *filename, bool discovered,
+                            std::vector<Certificate_with_links> &certificates)
+{
+    unsigned char block[TAR_BLOCK_SIZE];
+    input.read((char *)block, TAR_BLOCK_SIZE);
+    size_t n = input.gcount();
+    if (is_tar_header(block, n)) {
+        return load_tar_stream(input, filename, block, certificates);
+    }
+
+    Prefixed_streambuf buffer(block, n, input.rdbuf());
+    std::istream prefixed(&buffer);
+    if (is_pcap_header(block, n)) {
+        return load_pcap_stream(prefixed, filename, certificates);
+    }
+    if (is_pkcs_container(block, n)) {
+        // Small files: decode them from memory
+        OctetString data;
+        char chunk[65536];
+        std::streamsize length;
+        while ((length = buffer.sgetn(chunk, sizeof(chunk))) > 0) data.append((unsigned char *)chunk, length);
+        Input_file file = { filename, discovered, (long long)data.size() };
+        return load_pkcs_data(file, data.data(), data.size(), certificates);
+    }
+    if (discovered && n && block[0] != '-' && block[0] != 0x30) {
+        LOGINFO("Not a certificate file: '%s' (skipped)", filename);
+        return 0;
+    }
+    int err = load_framed_stream(&buffer, filename, certificates);
+    if (err) return err;
+    if (certificates.size() == 1) {
+        certificates[0].index_in_file = -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Load the certificates of a compressed file
+ *
+ * The certificates are decoded while the file is being decompressed,
+ * so that the decompressed contents are never entirely in memory.
+ */
+static int load_compressed_data(const Input_file &file, Compression compression, const unsigned char *data, size_t size,
+                                std::vector<Certificate_with_links> &certificates)
+{
+    LOGINFO("Decompressing '%s' (%s)", file.path.c_str(), compression_name(compression));
+    Decompress_streambuf buffer(compression, data, size);
+    std::istream input(&buffer);
+    int err = load_cert_stream(input, file.path.c_str(), file.discovered, certificates);
+    if (buffer.failed()) {
+        LOGERROR("Cannot decompress '%s'", file.path.c_str());
+        return -1;
+    }
+    return err;
+}
+
+/**
+ * @brief Load the certificates of a file, from its contents
+ *
+ * Files that were discovered in a directory and that do not look
+ * like PEM or DER are silently skipped.
+ */
+static int load_file_data(const Input_file &file, const unsigned char *data, size_t size, std::vector<Certificate_with_links> &certificates)
+{
+    Compression compression = detect_compression(data, size);
+    if (compression != COMPRESSION_NONE) {
+        return load_compressed_data(file, compression, data, size, certificates);
+    }
+    if (is_tar_header(data, size)) {
+        Memory_streambuf buffer(data, size);
+        std::istream input(&buffer);
+        return load_tar_stream(input, file.path.c_str(), 0, certificates);
+    }
+    if (is_pcap_header(data, size)) {
+        Memory_streambuf buffer(data, size);
+        std::istream input(&buffer);
+        return load_pcap_stream(input, file.path.c_str(), certificates);
+    }
+    if (is_pkcs_container(data, size)) {
+        return load_pkcs_data(file, data, size, certificates);
+    }
+
+    if (file.discovered && size && data[0] != '-' && data[0] != 0x30) {
+        LOGINFO("Not a certificate file: '%s' (skipped)", file.path.c_str());
+        return 0;
+    }
+    int err = load_cert_buffer(data, size, file.path.c_str(), certificates);
+    if (err) return err;
+    if (certificates.size() == 1) {
+        certificates[0].index_in_file = -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Load the DER certificates found anywhere in a buffer
+ *
+ * Each certificate is located by its offset: "path@offset".
+ */
+static int carve_file_data(const std::string &path, const unsigned char *data, size_t size, std::vector<Certificate_with_links> &certificates)
+{
+    std::vector<Carved_certificate> found;
+    carve_certificates(data, size, found);
+    LOGINFO("%lu certificate(s) found in '%s'", found.size(), path.c_str());
+    for (auto &carved: found) {
+        Certificate_with_links certificate(std::move(carved.cert));
+        certificate.filename = path + "@" + std::to_string(carved.offset);
+        certificate.index_in_file = -1;
+        certificates.push_back(std::move(certificate));
+    }
+    return 0;
+}
+
+/**
+ * @brief Load the PEM certificates found anywhere in a text, possibly compressed
+ *
+ * Each certificate is located by the line of its BEGIN marker: "path:line".
+ */
+static int scan_text_file_data(const std::string &path, const unsigned char *data, size_t size, bool base64_wrapped,
+                               std::vector<Certificate_with_links> &certificates)
+{
+    OctetString decompressed;
+    Compression compression = detect_compression(data, size);
+    if (compression != COMPRESSION_NONE) {
+        Decompress_streambuf buffer(compression, data, size);
+        char chunk[65536];
+        std::streamsize n;
+        while ((n = buffer.sgetn(chunk, sizeof(chunk))) > 0) decompressed.append((unsigned char *)chunk, n);
+        if (buffer.failed()) {
+            LOGERROR("Cannot decompress '%s'", path.c_str());
+            return -1;
         }
+        data = decompressed.data();
+        size = decompressed.size();
+    }
 
+    std::vector<Pem_block> blocks;
+    scan_pem_blocks(data, size, base64_wrapped, path.c_str(), blocks);
+    LOGINFO("%lu PEM block(s) found in '%s'", blocks.size(), path.c_str());
+
+    std::vector<Certificate> decoded(blocks.size());
+    std::vector<int> errors(blocks.size(), 0);
+    parallel_for(blocks.size(), [&](size_t i) {
+        if (blocks[i].der_bytes.empty()) errors[i] = -1;
+        else errors[i] = der_decode_x509_certificate(blocks[i].der_bytes, decoded[i]);
+    });
+
+    for (size_t i=0; i<blocks.size(); i++) {
+        std::string location = path + ":" + std::to_string(blocks[i].line);
+        if (errors[i]) {
+            LOGWARNING("Cannot decode certificate: %s (ignored)", location.c_str());
+            continue;
+        }
+        Certificate_with_links certificate(std::move(decoded[i]));
+        certificate.filename = location;
+        certificate.index_in_file = -1;
+        certificates.push_back(std::move(certificate));
+    }
+    return 0;
+}
+
+/**
+ * @brief Load the certificates of the contents of a file, according to the mode of loading
+ */
+static int load_input_data(const Input_file &file, const Load_options &options, const unsigned char *data, size_t size,
+                           std::vector<Certificate_with_links> &certificates)
+{
+    if (options.carve) return carve_file_data(file.path, data, size, certificates);
+    if (options.scan_text) return scan_text_file_data(file.path, data, size, options.scan_base64, certificates);
+    return load_file_data(file, data, size, certificates);
+}
+
+/* Read the whole standard input */
+static OctetString read_stdin()
+{
+    OctetString data;
+    char buffer[65536];
+    std::streamsize n;
+    while ((n = std::cin.rdbuf()->sgetn(buffer, sizeof(buffer))) > 0) data.append((unsigned char *)buffer, n);
+    return data;
+}
+
+/**
+ * @brief Load the certificates of a file mapped in memory
+ */
+static int load_mapped_file(const Input_file &file, const Load_options &options, std::vector<Certificate_with_links> &certificates)
+{
+    int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return report_file_error(file.path, "read from", errno);
+    void *data = mmap(0, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int map_errno = errno;
+    close(fd);
+    if (data == MAP_FAILED) return report_file_error(file.path, "map", map_errno);
+    madvise(data, file.size, MADV_SEQUENTIAL);
+    int err = load_input_data(file, options, (const unsigned char *)data, file.size, certificates);
+    munmap(data, file.size);
+    return err;
+}
+
+/* State of the loading of Certificate Transparency log entries, common to all inputs */
+struct Ct_loader {
+    std::vector<Ct_entry> batch;
+    std::unordered_set<std::string> chain_certs; // DER of the chain certificates already loaded
+    unsigned long long next_index;               // index of the next entry, if not given by the input
+    std::vector<Certificate_with_links> &certificates;
+    Ct_loader(std::vector<Certificate_with_links> &certificates): next_index(0), certificates(certificates) {}
+};
+
+/**
+ * @brief Decode the pending entries
+ *
+ * The certificates of the chains that were already loaded
+ * (typically the intermediate CAs) are not decoded again.
+ */
+static int load_ct_batch(Ct_loader &loader)
+{
+    std::vector<Pending_der> batch;
+    for (auto &entry: loader.batch) {
+        std::string location = "ct:" + std::to_string(entry.index);
+        batch.push_back({std::move(entry.certificate), location, -1});
+        for (size_t i=0; i<entry.chain.size(); i++) {
+            std::string der((const char *)entry.chain[i].data(), entry.chain[i].size());
+            if (!loader.chain_certs.insert(der).second) continue;
+            batch.push_back({std::move(entry.chain[i]), location, (int)i + 1});
+        }
+    }
+    loader.batch.clear();
+    return decode_der_batch(batch, loader.certificates);
+}
+
+/**
+ * @brief Load a Certificate Transparency dump, possibly compressed
+ *
+ * Static-ct-api data tiles are recognized by their path, and get-entries
+ * pages by their JSON contents. Other files (eg: the issuers of a static-ct-api
+ * log) are loaded as usual, except the other tiles of the log that are skipped.
+ *
+ * The entries are decoded by batches, so that the memory used does not
+ * depend on the size of the dump.
+ */
+static int load_ct_input(Ct_loader &loader, std::istream &input, const std::string &path, bool discovered)
+{
+    unsigned char magic[COMPRESSION_MAGIC_MAX_SIZE];
+    size_t magic_size;
+    Compression compression = peek_compression(input.rdbuf(), magic, magic_size);
+    Prefixed_streambuf prefixed(magic, magic_size, input.rdbuf());
+    std::unique_ptr<Decompress_streambuf> decompress;
+    std::istream decompressed(&prefixed);
+    if (compression != COMPRESSION_NONE) {
+        decompress.reset(new Decompress_streambuf(compression, &prefixed));
+        decompressed.rdbuf(decompress.get());
+    }
+
+    bool index_found;
+    unsigned long long first_index = ct_first_index_from_path(path, index_found);
+    if (!index_found) first_index = loader.next_index;
+
+    auto add_entry = [&loader](Ct_entry &entry) {
+        loader.next_index = entry.index + 1;
+        loader.batch.push_back(std::move(entry));
+        if (loader.batch.size() >= CT_BATCH_ENTRIES) return load_ct_batch(loader);
+        return 0;
+    };
+
+    int err;
+    if (path.find("tile/data/") != std::string::npos) {
+        LOGINFO("Loading CT tile '%s'", path.c_str());
+        err = read_ct_tile(decompressed, path.c_str(), first_index, add_entry);
     } else {
-        for (auto cert_path : paths) {
-            std::ifstream ifs(cert_path, std::ifstream::in);
-            if (!ifs.good()) {
-                LOGERROR("Cannot read from '%s': %s", cert_path.c_str(), strerror(errno));
+        decompressed >> std::ws;
+        if (decompressed.peek() == '{') {
+            LOGINFO("Loading CT entries '%s'", path.c_str());
+            err = read_ct_json(decompressed, path.c_str(), first_index, add_entry);
+        } else if (discovered && (path.find("tile/") != std::string::npos || path.find("checkpoint") != std::string::npos)) {
+            LOGINFO("Not a CT entries file: '%s' (skipped)", path.c_str());
+            err = 0;
+        } else {
+            std::vector<Certificate_with_links> file_certificates;
+            err = load_cert_stream(decompressed, path.c_str(), discovered, file_certificates);
+            std::move(file_certificates.begin(), file_certificates.end(), std::back_inserter(loader.certificates));
+        }
+    }
+    if (decompress && decompress->failed()) {
+        LOGERROR("Cannot decompress '%s'", path.c_str());
+        return -1;
+    }
+    return err;
+}
+
+/**
+ * @brief Load Certificate Transparency dumps, one after the other
+ */
+static int load_ct_files(const std::vector<Input_file> &files, std::vector<Certificate_with_links> &certificates)
+{
+    Ct_loader loader(certificates);
+    for (auto &file: files) {
+        std::ifstream input(file.path, std::ifstream::in | std::ifstream::binary);
+        if (!input.good()) {
+            if (report_file_error(file.path, "read from", errno)) return -1;
+            continue;
+        }
+        int err = load_ct_input(loader, input, file.path, file.discovered);
+        if (err && keep_going_mode) report_failure(FAILURE_INVALID_FILE, 0);
+        else if (err) return err;
+    }
+    return load_ct_batch(loader);
+}
+
+static void print_read_stats(const Read_stats &stats, size_t mapped_files)
+{
+    fprintf(stderr, "Stats: io backend: %s\n", stats.backend);
+    fprintf(stderr, "Stats: files: %lu (%lu mapped in memory, %lu in error)\n", stats.files, mapped_files, stats.errors);
+    fprintf(stderr, "Stats: bytes: %lu\n", stats.bytes);
+    fprintf(stderr, "Stats: system calls: %lu (%.2f per file)\n", stats.syscalls,
+            stats.files ? (double)stats.syscalls / stats.files : 0.0);
+    fprintf(stderr, "Stats: read and decode time: %.3f s (%.0f files/s)\n", stats.seconds,
+            stats.seconds > 0 ? stats.files / stats.seconds : 0.0);
+}
+
+/**
+ * @brief Load certificates from files, directories, or stdin
+ *
+ * If no path is given (neither directly nor with --files-from),
+ * certificates are read from stdin.
+ *
+ * Files are read (see read_files) and decoded in parallel. The resulting certificates
+ * are in the order of the files, and the loading stops at the first
+ * file in error.
+ */
+static int load_inputs(const std::list<std::string> &paths, const Load_options &options, std::vector<Certificate_with_links> &certificates)
+{
+    int err = 0;
+    if (paths.size() == 0 && options.files_from.empty() && options.ct) {
+        Ct_loader loader(certificates);
+        err = load_ct_input(loader, std::cin, "(stdin)", false);
+        if (err) return err;
+        return load_ct_batch(loader);
+    }
+    if (paths.size() == 0 && options.files_from.empty() && (options.carve || options.scan_text)) {
+        // Scanning needs the whole input
+        OctetString data = read_stdin();
+        Input_file file = { "(stdin)", false, (long long)data.size() };
+        return load_input_data(file, options, data.data(), data.size(), certificates);
+    }
+    if (paths.size() == 0 && options.files_from.empty()) {
+        // Take certificates from stdin, possibly compressed, possibly a tar archive,
+        // and decode them as they arrive
+        Fd_streambuf stdin_buffer(STDIN_FILENO);
+        unsigned char magic[COMPRESSION_MAGIC_MAX_SIZE];
+        size_t magic_size;
+        Compression compression = peek_compression(&stdin_buffer, magic, magic_size);
+        Prefixed_streambuf prefixed(magic, magic_size, &stdin_buffer);
+        if (compression != COMPRESSION_NONE) {
+            Decompress_streambuf buffer(compression, &prefixed);
+            std::istream input(&buffer);
+            err = load_cert_stream(input, "(stdin)", false, certificates);
+            if (buffer.failed()) {
+                LOGERROR("Cannot decompress stdin");
                 err = -1;
-                break;
-            } else {
-                std::vector<Certificate_with_links> tmpcert;
-                err = load_cert_file(ifs, cert_path.c_str(), tmpcert);
-                if (err) break;
-                if (tmpcert.size() == 1) {
-                    tmpcert[0].index_in_file = -1;
-                }
-                certificates.insert(certificates.end(), tmpcert.begin(), tmpcert.end());
-                ifs.close();
             }
+        } else {
+            std::istream input(&prefixed);
+            err = load_cert_stream(input, "(stdin)", false, certificates);
+        }
+        if (stdin_buffer.get_errno()) {
+            LOGERROR("Cannot read from stdin: %s", strerror(stdin_buffer.get_errno()));
+            err = -1;
+        }
+        return err;
+    }
+
+    std::list<std::string> all_paths = paths;
+    if (!options.files_from.empty()) {
+        err = read_files_from(options.files_from, options.null_separated, all_paths);
+        if (err) return err;
+    }
+
+    std::vector<Input_file> files;
+    std::vector<std::string> skipped_paths;
+    err = walk_paths(all_paths, options.recursive, files, keep_going_mode ? &skipped_paths : 0);
+    if (err) return err;
+    for (auto &location: skipped_paths) report_failure(FAILURE_INVALID_FILE, location.c_str());
+    if (options.ct) return load_ct_files(files, certificates);
+
+    // Large files are mapped in memory, and loaded one after the other
+    // (each with several threads, see load_cert_buffer), while the other
+    // files are read and decoded as soon as they have been read.
+    std::vector<std::string> read_paths;
+    std::vector<size_t> read_indexes; // index in files of read_paths
+    std::vector<size_t> mapped_indexes;
+    for (size_t i=0; i<files.size(); i++) {
+        if (files[i].size >= MMAP_MIN_SIZE) {
+            mapped_indexes.push_back(i);
+        } else {
+            read_paths.push_back(files[i].path);
+            read_indexes.push_back(i);
+        }
+    }
+
+    std::vector<std::vector<Certificate_with_links>> file_certificates(files.size());
+    std::vector<int> file_errors(files.size(), 0);
+    auto start = std::chrono::steady_clock::now();
+    Read_stats mapped_stats;
+    std::thread mapped_thread;
+    if (!mapped_indexes.empty()) {
+        mapped_thread = std::thread([&]() {
+            for (size_t i: mapped_indexes) {
+                file_errors[i] = load_mapped_file(files[i], options, file_certificates[i]);
+                mapped_stats.files++;
+                mapped_stats.bytes += files[i].size;
+                mapped_stats.syscalls += 5; // open, mmap, madvise, munmap, close
+                if (file_errors[i]) mapped_stats.errors++;
+            }
+        });
+    }
+    Read_stats stats;
+    err = read_files(read_paths, options.io_backend, [&](size_t i, const OctetString &data, int read_err) {
+        size_t file_index = read_indexes[i];
+        if (read_err) {
+            file_errors[file_index] = report_file_error(files[file_index].path, "read from", read_err);
+            return;
         }
+        file_errors[file_index] = load_input_data(files[file_index], options, data.data(), data.size(), file_certificates[file_index]);
+    }, stats);
+    if (mapped_thread.joinable()) mapped_thread.join();
+    if (options.stats) {
+        stats.files += mapped_stats.files;
+        stats.bytes += mapped_stats.bytes;
+        stats.syscalls += mapped_stats.syscalls;
+        stats.errors += mapped_stats.errors;
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        stats.seconds = elapsed.count();
+        print_read_stats(stats, mapped_stats.files);
     }
+    if (err) return err;
+
+    for (size_t i=0; i<files.size(); i++) {
+        if (file_errors[i] && keep_going_mode) {
+            report_failure(FAILURE_INVALID_FILE, 0);
+            continue;
+        }
+        if (file_errors[i]) return file_errors[i];
+        std::move(file_certificates[i].begin(), file_certificates[i].end(), std::back_inserter(certificates));
+    }
+    return 0;
+}
+
+/**
+ * @brief Load certificates from files, directories, or stdin (see load_inputs)
+ *
+ * In --keep-going mode, the certificates and files in error are skipped,
+ * and the failures are summarized at the end, as are the values rejected
+ * by the limits of the decoding.
+ *
+ * All the certificates are loaded, whatever the filters (--key-usage, ...):
+ * the ones that do not match are still needed as issuers (see Load_options::selects()).
+ */
+int load_certificates(const std::list<std::string> &paths, const Load_options &options, std::vector<Certificate_with_links> &certificates)
+{
+    keep_going_mode = options.keep_going;
+    int err = load_inputs(paths, options, certificates);
+    if (keep_going_mode) print_failure_summary();
+    print_rejection_summary();
     return err;
 }
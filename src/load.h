@@ -1,12 +1,36 @@
 #ifndef LOAD_H
 #define LOAD_H
 
+#include <argp.h>
 #include <string>
 #include <vector>
 
+#include "file_reader.h"
 #include "hierarchy.h"
 
-int load_certificates(const std::list<std::string> &paths, std::vector<Certificate_with_links> &certificates);
+struct Load_options {
+    bool recursive;
+    std::string files_from; // empty if not given
+    bool null_separated;
+    Io_backend io_backend;
+    bool stats;
+    bool ct;    // inputs are Certificate Transparency log entries
+    bool carve;       // search DER certificates anywhere in the inputs
+    bool scan_text;   // search PEM certificates anywhere in the inputs
+    bool scan_base64; // also search base64 encoded PEM certificates
+    bool keep_going;  // skip the certificates and files in error
+    Usage_bits filter; // usages and policies of the certificates kept (see --key-usage, --policy, ...)
+    Load_options(): recursive(false), null_separated(false), io_backend(IO_AUTO), stats(false), ct(false), carve(false),
+                    scan_text(false), scan_base64(false), keep_going(false) {}
+    bool selects(const Certificate &cert) const { return cert.tbs_certificate.usage_bits.covers(filter); }
+};
+
+/* Command line options common to the commands that load certificates.
+ * To be used as an argp child, with input a struct Load_options.
+ */
+extern struct argp argp_load;
+
+int load_certificates(const std::list<std::string> &paths, const Load_options &options, std::vector<Certificate_with_links> &certificates);
 
 
 #endif
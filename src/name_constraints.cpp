@@ -0,0 +1,296 @@
+#include <stdio.h>
+
+#include "journal.h"
+#include "name_constraints.h"
+#include "oid_name.h"
+#include "render_text.h"
+#include "util.h"
+
+/**
+ * @brief Add a domain
+ * @param exact       Match the domain itself
+ * @param subdomains  Match the domains that have more labels on the left
+ */
+void Domain_trie::add(const std::string &domain, bool exact, bool subdomains)
+{
+    std::vector<std::string> labels;
+    reversed_labels(domain, labels);
+    uint32_t node = trie.add(labels, labels.size());
+    nodes.resize(trie.size());
+    if (exact) nodes[node].exact = true;
+    if (subdomains) nodes[node].subdomains = true;
+}
+
+bool Domain_trie::matches(const std::string &domain) const
+{
+    std::vector<std::string> labels;
+    reversed_labels(domain, labels);
+    uint32_t node = Label_trie::ROOT;
+    for (const auto &label: labels) {
+        if (nodes[node].subdomains) return true;
+        node = trie.child(node, label);
+        if (node == Label_trie::NO_NODE) return false;
+    }
+    return nodes[node].exact;
+}
+
+static std::string to_lower(std::string text)
+{
+    for (char &c: text) {
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    }
+    return text;
+}
+
+/**
+ * @brief Get the host of a URI (eg: "www.example.com" in "https://user@www.example.com:8443/path")
+ * @return The host, or an empty string if the URI has no authority
+ */
+static std::string get_uri_host(const std::string &uri)
+{
+    size_t start = uri.find("://");
+    if (start == std::string::npos) return "";
+    start += 3;
+    size_t end = uri.find_first_of("/?#", start);
+    if (end == std::string::npos) end = uri.size();
+    size_t at = uri.rfind('@', end);
+    if (at != std::string::npos && at >= start) start = at + 1;
+    if (start < end && uri[start] == '[') return ""; // IPv6 literal
+    size_t colon = uri.find(':', start);
+    if (colon != std::string::npos && colon < end) end = colon;
+    return uri.substr(start, end - start);
+}
+
+/**
+ * @brief Get the contents of an iPAddress, kept DER encoded in the GeneralName
+ */
+static OctetString get_ip_address(const GeneralName &name)
+{
+    const OctetString &tlv = name.othervalue;
+    if (tlv.size() < 2 || (tlv[1] & 0x80)) return OctetString(); // more than 127 bytes are not an address
+    return OctetString(tlv.data() + 2, tlv.size() - 2);
+}
+
+static std::string ip_address_to_string(const OctetString &address)
+{
+    if (address.size() != 4) return hexlify(address);
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", address[0], address[1], address[2], address[3]);
+    return buffer;
+}
+
+/**
+ * @brief Get the length of a mask made of leading one bits (-1 if the mask is not such a prefix)
+ */
+static int get_prefix_length(const unsigned char *mask, size_t size)
+{
+    int length = 0;
+    size_t i = 0;
+    for (; i < size && mask[i] == 0xff; i++) length += 8;
+    if (i < size) {
+        unsigned char byte = mask[i];
+        while (byte & 0x80) {
+            length++;
+            byte <<= 1;
+        }
+        if (byte) return -1;
+        for (i++; i < size; i++) {
+            if (mask[i]) return -1;
+        }
+    }
+    return length;
+}
+
+static std::string mask_address(const unsigned char *address, size_t size, size_t prefix_length)
+{
+    std::string result((const char *)address, size);
+    for (size_t bit = prefix_length; bit < size * 8; bit++) result[bit / 8] &= ~(0x80 >> (bit % 8));
+    return result;
+}
+
+/**
+ * @brief Add the base of a GeneralSubtree
+ *
+ * RFC 5280 4.2.1.10:
+ * - dNSName: the domain and its subdomains ("example.com")
+ * - rfc822Name: a mailbox ("user@example.com"), all the mailboxes
+ *   of a host ("example.com") or of the subdomains of a domain (".example.com")
+ * - uniformResourceIdentifier: a host ("example.com") or the subdomains of a domain (".example.com")
+ * - iPAddress: address and mask (8 bytes for IPv4, 32 bytes for IPv6)
+ * - directoryName: the names that start with the same RDNs
+ */
+void Subtree_matcher::add(const GeneralName &base)
+{
+    switch (base.tag) {
+    case GENERAL_NAME_DNS:
+        if (!base.stringvalue.empty() && base.stringvalue[0] == '.') dns_names.add(base.stringvalue.substr(1), false, true);
+        else dns_names.add(base.stringvalue, true, true);
+        break;
+    case GENERAL_NAME_RFC822:
+        if (base.stringvalue.find('@') != std::string::npos) {
+            size_t at = base.stringvalue.rfind('@');
+            mailboxes.insert(base.stringvalue.substr(0, at + 1) + to_lower(base.stringvalue.substr(at + 1)));
+        } else if (!base.stringvalue.empty() && base.stringvalue[0] == '.') {
+            email_domains.add(base.stringvalue.substr(1), false, true);
+        } else {
+            email_domains.add(base.stringvalue, true, false);
+        }
+        break;
+    case GENERAL_NAME_URI:
+        if (!base.stringvalue.empty() && base.stringvalue[0] == '.') uri_hosts.add(base.stringvalue.substr(1), false, true);
+        else uri_hosts.add(base.stringvalue, true, false);
+        break;
+    case GENERAL_NAME_IP_ADDRESS:
+        {
+            OctetString value = get_ip_address(base);
+            if (value.size() != 8 && value.size() != 32) {
+                LOGWARNING("Invalid iPAddress in nameConstraints (%lu bytes)", (unsigned long)value.size());
+                return;
+            }
+            size_t size = value.size() / 2;
+            int prefix_length = get_prefix_length(value.data() + size, size);
+            if (prefix_length < 0) ip_masked.push_back(value);
+            else ip_prefixes[prefix_length].insert(mask_address(value.data(), size, prefix_length));
+        }
+        break;
+    case GENERAL_NAME_DIRECTORY:
+        {
+            Name_key key = compute_name_key(base.namevalue);
+            directory_names[key.key.size()].insert(key.key);
+        }
+        break;
+    default:
+        LOGDEBUG("Unsupported type of name in nameConstraints: %d", base.tag);
+        return;
+    }
+    types |= 1 << base.tag;
+}
+
+bool Subtree_matcher::matches_ip_address(const OctetString &address) const
+{
+    if (address.size() != 4 && address.size() != 16) return false;
+    for (const auto &prefixes: ip_prefixes) {
+        if (prefixes.first > address.size() * 8) continue;
+        if (prefixes.second.count(mask_address(address.data(), address.size(), prefixes.first))) return true;
+    }
+    for (const auto &value: ip_masked) {
+        if (value.size() != address.size() * 2) continue;
+        bool match = true;
+        for (size_t i=0; i<address.size(); i++) {
+            const unsigned char mask = value[address.size() + i];
+            if ((address[i] & mask) != (value[i] & mask)) match = false;
+        }
+        if (match) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Tell if a directory name is in a subtree (its name key starts with the key of the subtree)
+ */
+bool Subtree_matcher::matches(const Name_key &name) const
+{
+    for (const auto &keys: directory_names) {
+        if (keys.first > name.key.size()) continue;
+        if (keys.second.count(name.key.substr(0, keys.first))) return true;
+    }
+    return false;
+}
+
+bool Subtree_matcher::matches(const GeneralName &name) const
+{
+    size_t at;
+    switch (name.tag) {
+    case GENERAL_NAME_DNS:
+        return dns_names.matches(name.stringvalue);
+    case GENERAL_NAME_RFC822:
+        at = name.stringvalue.rfind('@');
+        if (at == std::string::npos) return false;
+        if (mailboxes.count(name.stringvalue.substr(0, at + 1) + to_lower(name.stringvalue.substr(at + 1)))) return true;
+        return email_domains.matches(name.stringvalue.substr(at + 1));
+    case GENERAL_NAME_URI:
+        return uri_hosts.matches(get_uri_host(name.stringvalue));
+    case GENERAL_NAME_IP_ADDRESS:
+        return matches_ip_address(get_ip_address(name));
+    case GENERAL_NAME_DIRECTORY:
+        return matches(compute_name_key(name.namevalue));
+    default:
+        return false;
+    }
+}
+
+static std::string general_name_to_string(const GeneralName &name)
+{
+    if (name.tag == GENERAL_NAME_IP_ADDRESS) return ip_address_to_string(get_ip_address(name));
+    if (name.type == GeneralName::TYPE_NAME) return to_string(name.namevalue);
+    return name.stringvalue;
+}
+
+/**
+ * @brief Check the subject and subjectAltName of a certificate against the constraints
+ * @param[out] violation  The first name that is not permitted, or excluded, and why
+ * @return true if all the names comply
+ */
+bool Name_constraints::check(const Certificate &cert, std::string &violation) const
+{
+    static const ObjectIdentifier subject_alt_name_oid = oid_get_id("id-ce-subjectAltName");
+    const TBSCertificate &tbs = cert.tbs_certificate;
+
+    if (!tbs.subject.empty()) {
+        for (const auto &matcher: excluded) {
+            if (matcher->constrains(GENERAL_NAME_DIRECTORY) && matcher->matches(tbs.subject_key)) {
+                violation = to_string(tbs.subject) + " excluded";
+                return false;
+            }
+        }
+        for (const auto &matcher: permitted) {
+            if (matcher->constrains(GENERAL_NAME_DIRECTORY) && !matcher->matches(tbs.subject_key)) {
+                violation = to_string(tbs.subject) + " not permitted";
+                return false;
+            }
+        }
+    }
+
+    auto it = tbs.extensions.items.find(subject_alt_name_oid);
+    if (it == tbs.extensions.items.end()) return true;
+    const GeneralNames *names = std::any_cast<GeneralNames>(&it->second.extn_value);
+    if (!names) return true;
+    for (const auto &name: names->items) {
+        for (const auto &matcher: excluded) {
+            if (matcher->constrains(name.tag) && matcher->matches(name)) {
+                violation = general_name_to_string(name) + " excluded";
+                return false;
+            }
+        }
+        for (const auto &matcher: permitted) {
+            if (matcher->constrains(name.tag) && !matcher->matches(name)) {
+                violation = general_name_to_string(name) + " not permitted";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static std::shared_ptr<const Subtree_matcher> compile_subtrees(const GeneralNames &subtrees)
+{
+    std::shared_ptr<Subtree_matcher> matcher = std::make_shared<Subtree_matcher>();
+    for (const auto &base: subtrees.items) matcher->add(base);
+    return matcher;
+}
+
+/**
+ * @brief Get the constraints of a CA, from the ones of its parent and its nameConstraints
+ * @param parent  May be NULL
+ *
+ * The subtrees of the parent are shared, not copied.
+ */
+std::shared_ptr<const Name_constraints> add_name_constraints(const std::shared_ptr<const Name_constraints> &parent,
+                                                             const NameConstraints &constraints)
+{
+    std::shared_ptr<Name_constraints> result = std::make_shared<Name_constraints>();
+    if (parent) *result = *parent;
+    if (!constraints.permitted_subtrees.empty()) result->permitted.push_back(compile_subtrees(constraints.permitted_subtrees));
+    if (!constraints.excluded_subtrees.empty()) result->excluded.push_back(compile_subtrees(constraints.excluded_subtrees));
+    return result;
+}
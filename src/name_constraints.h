@@ -0,0 +1,77 @@
+#ifndef NAME_CONSTRAINTS_H
+#define NAME_CONSTRAINTS_H
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "certificate.h"
+#include "label_trie.h"
+
+/* Domains matched by a subtree (see Label_trie) */
+class Domain_trie {
+public:
+    Domain_trie(): nodes(1) {}
+    void add(const std::string &domain, bool exact, bool subdomains);
+    bool matches(const std::string &domain) const;
+
+private:
+    struct Node {
+        bool exact;      // the domain that ends at this node is matched
+        bool subdomains; // the domains below this node are matched
+        Node(): exact(false), subdomains(false) {}
+    };
+    Label_trie trie;
+    std::vector<Node> nodes; // by node of the trie
+};
+
+/* Compiled GeneralSubtrees of a nameConstraints (permitted or excluded)
+ *
+ * Each type of name has its own structure, so that a name is checked in
+ * a few lookups, whatever the number of subtrees:
+ * - dNSName, and hosts of rfc822Name and URI: tries of domains
+ * - iPAddress: sets of masked addresses, by prefix length
+ * - directoryName: sets of name keys (see compute_name_key()), by length,
+ *   a subtree being a prefix of the names that it contains
+ * The other types of names (eg: otherName) are not supported: their subtrees are ignored.
+ */
+class Subtree_matcher {
+public:
+    Subtree_matcher(): types(0) {}
+    void add(const GeneralName &base);
+    bool constrains(int tag) const { return types & (1 << tag); }
+    bool matches(const GeneralName &name) const;
+    bool matches(const Name_key &name) const;
+
+private:
+    bool matches_ip_address(const OctetString &address) const;
+    uint32_t types; // bit mask of the GeneralName_tag of the subtrees
+    Domain_trie dns_names;
+    Domain_trie email_domains;
+    std::unordered_set<std::string> mailboxes; // subtrees that are a full email address
+    Domain_trie uri_hosts;
+    std::unordered_map<size_t, std::unordered_set<std::string>> ip_prefixes; // prefix length in bits -> masked addresses (IPv4 or IPv6)
+    std::vector<OctetString> ip_masked; // address and mask, for the masks that are not a prefix
+    std::unordered_map<size_t, std::unordered_set<std::string>> directory_names; // length of the name key -> name keys
+};
+
+/* Name constraints accumulated from the trust anchor down to a certificate
+ *
+ * Each CA that has a nameConstraints adds its compiled subtrees. The permitted
+ * subtrees of all of them must be satisfied (intersection), and the excluded
+ * subtrees of any of them must not match (union). A CA without nameConstraints
+ * shares the constraints of its parent.
+ */
+struct Name_constraints {
+    std::vector<std::shared_ptr<const Subtree_matcher>> permitted;
+    std::vector<std::shared_ptr<const Subtree_matcher>> excluded;
+    bool check(const Certificate &cert, std::string &violation) const;
+};
+
+std::shared_ptr<const Name_constraints> add_name_constraints(const std::shared_ptr<const Name_constraints> &parent,
+                                                             const NameConstraints &constraints);
+
+#endif // NAME_CONSTRAINTS_H
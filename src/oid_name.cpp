@@ -1,4 +1,7 @@
 #include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "oid_name.h"
 
@@ -20,6 +23,12 @@ static const Oid OID_NAMES[] = {
     { "1.2.840.113549.1.1.12", "sha384WithRSAEncryption", NULL },
     { "1.2.840.113549.1.1.13", "sha512WithRSAEncryption", NULL },
     { "1.2.840.113549.1.9.1", "id-emailAddress", "email" },
+    { "1.3.6.1.5.5.7.3.1", "id-kp-serverAuth", "serverAuth" },
+    { "1.3.6.1.5.5.7.3.2", "id-kp-clientAuth", "clientAuth" },
+    { "1.3.6.1.5.5.7.3.3", "id-kp-codeSigning", "codeSigning" },
+    { "1.3.6.1.5.5.7.3.4", "id-kp-emailProtection", "emailProtection" },
+    { "1.3.6.1.5.5.7.3.8", "id-kp-timeStamping", "timeStamping" },
+    { "1.3.6.1.5.5.7.3.9", "id-kp-OCSPSigning", "OCSPSigning" },
     { "2.5.4.3", "id-at-commonName", "cn" },
     { "2.5.4.4", "id-at-surname", "sn" },
     { "2.5.4.5", "id-at-serialNumber", "serial" },
@@ -53,10 +62,12 @@ static const Oid OID_NAMES[] = {
     { "2.5.29.30", "id-ce-nameConstraints", "nameConstraints" },
     { "2.5.29.31", "id-ce-cRLDistributionPoints", "cRLDistributionPoints" },
     { "2.5.29.32", "id-ce-certificatePolicies", "certificatePolicies" },
+    { "2.5.29.32.0", "anyPolicy", NULL },
     { "2.5.29.33", "id-ce-policyMappings", "policyMappings" },
     { "2.5.29.35", "id-ce-authorityKeyIdentifier", "authorityKeyIdentifier" },
     { "2.5.29.36", "id-ce-policyConstraints", "policyConstraints" },
     { "2.5.29.37", "id-ce-extKeyUsage", "extKeyUsage" },
+    { "2.5.29.37.0", "anyExtendedKeyUsage", NULL },
     { NULL, NULL, NULL }
 };
 
@@ -94,3 +105,39 @@ std::string oid_get_id(const std::string &name)
     return ""; // not found
 }
 
+
+/*
+ * Interned OIDs: each distinct OID gets a small integer, in the order
+ * of first occurrence, so that sets of OIDs can be stored as bit masks.
+ * The certificates are decoded by several threads, hence the mutex,
+ * taken only when an OID is not yet in the cache of the thread.
+ */
+static std::mutex interned_mutex;
+static std::unordered_map<std::string, uint32_t> interned_ids;
+static std::vector<std::string> interned_oids;
+
+/**
+ * @brief Get the interned id of a numerical OID, allocating it if needed
+ */
+uint32_t oid_intern(const std::string &oid)
+{
+    thread_local std::unordered_map<std::string, uint32_t> cache;
+    auto it = cache.find(oid);
+    if (it != cache.end()) return it->second;
+
+    std::lock_guard<std::mutex> lock(interned_mutex);
+    auto result = interned_ids.emplace(oid, interned_oids.size());
+    if (result.second) interned_oids.push_back(oid);
+    cache[oid] = result.first->second;
+    return result.first->second;
+}
+
+/**
+ * @brief Get the numerical OID of an interned id
+ */
+std::string oid_interned(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(interned_mutex);
+    if (id >= interned_oids.size()) return "";
+    return interned_oids[id];
+}
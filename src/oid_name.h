@@ -1,10 +1,13 @@
 #ifndef OID_NAME_H
 #define OID_NAME_H
 
+#include <stdint.h>
 #include <string>
 
 std::string oid_get_name(const std::string &oid, bool shortname=false);
 std::string oid_get_id(const std::string &name);
+uint32_t oid_intern(const std::string &oid);
+std::string oid_interned(uint32_t id);
 
 
 #endif // OID_NAME_H
@@ -0,0 +1,52 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+
+static unsigned int parallel_jobs = 0; // 0 means: number of online CPUs
+
+void set_parallel_jobs(unsigned int jobs)
+{
+    parallel_jobs = jobs;
+}
+
+unsigned int get_parallel_jobs()
+{
+    if (parallel_jobs) return parallel_jobs;
+    unsigned int n = std::thread::hardware_concurrency();
+    if (!n) n = 1;
+    return n;
+}
+
+/**
+ * @brief Call func(i) for each i in [0, count), spread over the worker threads
+ *
+ * Items are distributed dynamically (each worker picks the next free index),
+ * so that a few slow items do not stall a whole static partition.
+ * The function returns when all items have been processed.
+ */
+void parallel_for(size_t count, const std::function<void(size_t)> &func)
+{
+    size_t n_threads = get_parallel_jobs();
+    if (n_threads > count) n_threads = count;
+
+    if (n_threads <= 1) {
+        for (size_t i=0; i<count; i++) func(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        while (1) {
+            size_t i = next.fetch_add(1);
+            if (i >= count) break;
+            func(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t=1; t<n_threads; t++) threads.push_back(std::thread(worker));
+    worker(); // the calling thread works too
+    for (auto &thread: threads) thread.join();
+}
@@ -0,0 +1,12 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <functional>
+#include <stddef.h>
+
+void set_parallel_jobs(unsigned int jobs);
+unsigned int get_parallel_jobs();
+
+void parallel_for(size_t count, const std::function<void(size_t)> &func);
+
+#endif // PARALLEL_H
@@ -0,0 +1,256 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <set>
+#include <time.h>
+
+#include "journal.h"
+#include "oid_name.h"
+#include "path_validation.h"
+
+#define TIME_SIZE 19 // YYYY-MM-DD hh:mm:ss, the common prefix of the times of the certificates
+
+/**
+ * @brief Parse a time given on the command line
+ * @param      text  YYYY-MM-DD, or YYYY-MM-DD hh:mm:ss (or YYYY-MM-DDThh:mm:ss), optionally followed by Z
+ * @param[out] time  YYYY-MM-DD hh:mm:ss (UTC), comparable to the times of the certificates
+ * @return 0 on success, -1 on error
+ */
+int parse_validation_time(const std::string &text, std::string &time)
+{
+    int year, month, day, hour = 0, minute = 0, second = 0;
+    int n = 0;
+    if (sscanf(text.c_str(), "%4d-%2d-%2d%n", &year, &month, &day, &n) != 3) return -1;
+    const char *rest = text.c_str() + n;
+    if (*rest == ' ' || *rest == 'T') {
+        if (sscanf(rest + 1, "%2d:%2d:%2d%n", &hour, &minute, &second, &n) != 3) return -1;
+        rest += 1 + n;
+    }
+    if (*rest == 'Z') rest++;
+    if (*rest) return -1;
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) return -1;
+    if (year < 0 || year > 9999 || hour < 0 || minute < 0 || second < 0) return -1;
+
+    char buffer[72]; // enough for any int, even if the ranges are already checked
+    snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d %02d:%02d:%02d", year, month, day, hour, minute, second);
+    time = buffer;
+    return 0;
+}
+
+std::string get_current_time()
+{
+    time_t now = ::time(NULL);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+    return buffer;
+}
+
+/**
+ * @brief Get the pathLenConstraint of a certificate (-1 if not present)
+ */
+static int get_path_length(const BasicConstraints &basic_constraints)
+{
+    const std::string &value = basic_constraints.path_len_constraint; // eg: 0x01
+    if (value.empty()) return -1;
+    if (value[0] == '-') return 0; // invalid, be strict
+    long long length = strtoll(value.c_str(), NULL, 16);
+    if (value.size() > 10 || length > INT_MAX) return INT_MAX;
+    return (int)length;
+}
+
+/**
+ * @brief Tell if the certificate has a critical extension that is not processed here
+ *
+ * RFC 5280 6.1.3: the validation fails on unrecognized critical extensions.
+ */
+static bool has_unknown_critical_extension(const Certificate_with_links &cert, std::string &name)
+{
+    static const std::vector<ObjectIdentifier> known = {
+        oid_get_id("id-ce-basicConstraints"),
+        oid_get_id("id-ce-keyUsage"),
+        oid_get_id("id-ce-extKeyUsage"),
+        oid_get_id("id-ce-subjectAltName"),
+        oid_get_id("id-ce-issuerAltName"),
+        oid_get_id("id-ce-certificatePolicies"),
+        oid_get_id("id-ce-subjectKeyIdentifier"),
+        oid_get_id("id-ce-authorityKeyIdentifier"),
+    };
+    static const ObjectIdentifier name_constraints_oid = oid_get_id("id-ce-nameConstraints");
+    for (const auto &item: cert.tbs_certificate.extensions.items) {
+        if (!item.second.critical) continue;
+        bool is_known = false;
+        for (const auto &oid: known) {
+            if (item.first == oid) is_known = true;
+        }
+        // nameConstraints are processed, unless they could not be decoded
+        if (item.first == name_constraints_oid) is_known = std::any_cast<NameConstraints>(&item.second.extn_value) != NULL;
+        if (!is_known) {
+            name = oid_get_name(item.first, true);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Validate a certificate, given the state of its issuer
+ * @param issuer  NULL if the certificate has no parent (it must then be a trust anchor)
+ *
+ * Compute also what the certificate passes to the certificates it issued
+ * (RFC 5280 6.1.4: basicConstraints, keyUsage, pathLenConstraint, nameConstraints).
+ */
+static void validate_certificate(Certificate_with_links &cert, const Path_validation *issuer, const std::string &time)
+{
+    static const ObjectIdentifier basic_constraints_oid = oid_get_id("id-ce-basicConstraints");
+    static const ObjectIdentifier key_usage_oid = oid_get_id("id-ce-keyUsage");
+    static const ObjectIdentifier name_constraints_oid = oid_get_id("id-ce-nameConstraints");
+
+    const TBSCertificate &tbs = cert.tbs_certificate;
+    Path_validation &state = cert.validation;
+    bool self_issued = tbs.issuer_key == tbs.subject_key;
+    std::string extension;
+    std::string violation;
+
+    if (tbs.validity.not_before.size() < TIME_SIZE || tbs.validity.not_after.size() < TIME_SIZE) {
+        state.error = "invalid validity dates";
+    } else if (tbs.validity.not_before.compare(0, TIME_SIZE, time) > 0) {
+        state.error = "not yet valid";
+    } else if (tbs.validity.not_after.compare(0, TIME_SIZE, time) < 0) {
+        state.error = "expired";
+    } else if (cert.revoked) {
+        state.error = "revoked";
+    } else if (has_unknown_critical_extension(cert, extension)) {
+        state.error = "unsupported critical extension " + extension;
+    } else if (!issuer && !is_self_signed(cert)) {
+        state.error = "issuer not found";
+    } else if (issuer && !issuer->error.empty()) {
+        state.error = "issuer not valid";
+    } else if (issuer && !issuer->issuer_error.empty()) {
+        state.error = "issuer " + issuer->issuer_error;
+    } else if (issuer && issuer->name_constraints && !(self_issued && !cert.children.empty())
+               && !issuer->name_constraints->check(cert, violation)) {
+        // Self-issued intermediate certificates are not checked (RFC 5280 6.1.3 b)
+        state.error = "name constraints: " + violation;
+    }
+
+    auto it = tbs.extensions.items.find(basic_constraints_oid);
+    const BasicConstraints *basic_constraints = NULL;
+    if (it != tbs.extensions.items.end()) basic_constraints = std::any_cast<BasicConstraints>(&it->second.extn_value);
+    it = tbs.extensions.items.find(key_usage_oid);
+    const KeyUsage *key_usage = NULL;
+    if (it != tbs.extensions.items.end()) key_usage = std::any_cast<KeyUsage>(&it->second.extn_value);
+
+    // Trust anchors without basicConstraints (eg: version 1 roots) may issue certificates
+    if (basic_constraints ? !basic_constraints->ca : issuer != NULL) {
+        state.issuer_error = "not a CA";
+    } else if (key_usage && !(*key_usage & KEY_USAGE_KEY_CERT_SIGN)) {
+        state.issuer_error = "without keyCertSign";
+    } else if (issuer) {
+        state.max_path_length = issuer->max_path_length;
+        if (!self_issued && state.max_path_length == 0) state.issuer_error = "pathLenConstraint exceeded";
+        else if (!self_issued && state.max_path_length > 0) state.max_path_length--;
+    }
+    int path_length = basic_constraints ? get_path_length(*basic_constraints) : -1;
+    if (path_length >= 0 && (state.max_path_length < 0 || path_length < state.max_path_length)) {
+        state.max_path_length = path_length;
+    }
+
+    // The constraints are compiled once per constraining CA, and shared by the certificates below
+    if (issuer) state.name_constraints = issuer->name_constraints;
+    it = tbs.extensions.items.find(name_constraints_oid);
+    if (it != tbs.extensions.items.end()) {
+        const NameConstraints *constraints = std::any_cast<NameConstraints>(&it->second.extn_value);
+        if (constraints) state.name_constraints = add_name_constraints(state.name_constraints, *constraints);
+    }
+}
+
+/**
+ * @brief Rank the state of a certificate, the lower the better
+ */
+static int rank_validation(const Path_validation &state)
+{
+    if (!state.error.empty()) return 2;
+    if (!state.issuer_error.empty()) return 1;
+    return 0;
+}
+
+/**
+ * @brief Validate a certificate from the states of its parents
+ *
+ * The certificate is valid if any of its paths is valid: each validated
+ * parent is tried, and the best state is kept (the first one for equal
+ * ranks, in the order of the parents, ie: the order of the certificates).
+ */
+static void validate_from_parents(Certificate_with_links &cert, const std::string &time)
+{
+    Path_validation best;
+    bool found = false;
+    for (const Certificate_with_links *parent: cert.parents) {
+        if (!parent->validation.done) continue; // loop in the hierarchy
+        cert.validation = Path_validation();
+        validate_certificate(cert, &parent->validation, time);
+        if (!found || rank_validation(cert.validation) < rank_validation(best)) {
+            best = cert.validation;
+            found = true;
+            if (rank_validation(best) == 0) break;
+        }
+    }
+    if (found) {
+        cert.validation = best;
+    } else {
+        cert.validation = Path_validation();
+        validate_certificate(cert, NULL, time);
+    }
+}
+
+/**
+ * @brief Validate the paths from the roots of the hierarchy to each certificate
+ * @param time  YYYY-MM-DD hh:mm:ss
+ * @return The number of certificates that are not valid
+ *
+ * The roots of the hierarchy are the trust anchors: they must be self-signed.
+ * The state of each certificate is computed once, from the states of its
+ * parents, so that the whole hierarchy is validated in a time linear in the
+ * number of links.
+ * The signatures have already been verified by compute_hierarchy().
+ */
+size_t validate_paths(std::vector<Certificate_with_links> &certificates, const std::string &time)
+{
+    LOGINFO("Validating paths at %s...", time.c_str());
+    size_t n_invalid = 0;
+    typedef std::set<Certificate_with_links*>::iterator Parent_iterator;
+    std::vector<std::pair<Certificate_with_links*, Parent_iterator>> stack; // certificates whose parents are being validated
+    for (auto &certificate: certificates) {
+        if (certificate.validation.done) continue;
+        certificate.validation.in_progress = true;
+        stack.push_back({&certificate, certificate.parents.begin()});
+        while (!stack.empty()) {
+            Certificate_with_links *cert = stack.back().first;
+            Parent_iterator &parent = stack.back().second;
+            // Validate the parents first
+            for (; parent != cert->parents.end(); parent++) {
+                if ((*parent)->validation.done) continue;
+                if ((*parent)->validation.in_progress) {
+                    LOGERROR("Loop in the hierarchy at %s", (*parent)->get_file_location().c_str());
+                    continue;
+                }
+                break;
+            }
+            if (parent != cert->parents.end()) {
+                Certificate_with_links *next = *parent;
+                parent++;
+                next->validation.in_progress = true;
+                stack.push_back({next, next->parents.begin()});
+                continue;
+            }
+            validate_from_parents(*cert, time);
+            cert->validation.done = true;
+            cert->validation.in_progress = false;
+            if (!cert->validation.error.empty()) n_invalid++;
+            stack.pop_back();
+        }
+    }
+    return n_invalid;
+}
@@ -0,0 +1,13 @@
+#ifndef PATH_VALIDATION_H
+#define PATH_VALIDATION_H
+
+#include <string>
+#include <vector>
+
+#include "hierarchy.h"
+
+int parse_validation_time(const std::string &text, std::string &time);
+std::string get_current_time();
+size_t validate_paths(std::vector<Certificate_with_links> &certificates, const std::string &time);
+
+#endif
@@ -0,0 +1,469 @@
+#include <algorithm>
+#include <openssl/sha.h>
+#include <stdint.h>
+#include <string.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "journal.h"
+#include "pcap.h"
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+
+#define PCAPNG_SECTION_HEADER 0x0a0d0d0a
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_INTERFACE_DESCRIPTION 1
+#define PCAPNG_OBSOLETE_PACKET 2
+#define PCAPNG_SIMPLE_PACKET 3
+#define PCAPNG_ENHANCED_PACKET 6
+
+#define PCAP_MAX_PACKET_SIZE (16*1024*1024)
+
+// Link types
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+#define IPPROTO_TCP_ 6
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+
+// TLS
+#define TLS_CHANGE_CIPHER_SPEC 20
+#define TLS_ALERT 21
+#define TLS_HANDSHAKE 22
+#define TLS_APPLICATION_DATA 23
+#define TLS_HEARTBEAT 24
+#define TLS_MAX_RECORD_SIZE (16384 + 2048)
+#define TLS_HANDSHAKE_CERTIFICATE 11
+#define TLS_MAX_HANDSHAKE_SIZE (1024*1024)
+
+// Bounds of the memory used by the reassembly
+#define FLOW_MAX_OUT_OF_ORDER (256*1024) // bytes of segments received in advance, per flow
+#define MAX_FLOWS 65536                  // flows followed at the same time
+
+/* State of one direction of a TCP connection */
+struct Tcp_flow {
+    bool started;
+    bool done;         // certificates found, or not TLS, or encrypted: the rest is ignored
+    uint32_t next_seq;
+    std::vector<std::pair<uint32_t, OctetString>> out_of_order;
+    size_t out_of_order_size;
+    OctetString records;   // TLS records not parsed yet
+    OctetString handshake; // handshake messages not parsed yet
+    Tcp_flow(): started(false), done(false), next_seq(0), out_of_order_size(0) {}
+    void finish() {
+        done = true;
+        out_of_order.clear();
+        out_of_order.shrink_to_fit();
+        records = OctetString();
+        handshake = OctetString();
+    }
+};
+
+struct Pcap_reader {
+    const char *filename;
+    const Pcap_callback &callback;
+    unsigned long long frame;
+    std::unordered_map<std::string, Tcp_flow> flows;
+    std::unordered_set<std::string> fingerprints; // SHA-256 of the certificates already found
+    bool flows_overflow;
+    int err;
+    Pcap_reader(const char *filename, const Pcap_callback &callback)
+        : filename(filename), callback(callback), frame(0), flows_overflow(false), err(0) {}
+};
+
+static uint16_t get_be16(const unsigned char *p) { return (p[0] << 8) | p[1]; }
+static uint32_t get_be24(const unsigned char *p) { return (p[0] << 16) | (p[1] << 8) | p[2]; }
+static uint32_t get_be32(const unsigned char *p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+static uint32_t get_u32(const unsigned char *p, bool big_endian)
+{
+    if (big_endian) return get_be32(p);
+    return ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+static uint16_t get_u16(const unsigned char *p, bool big_endian)
+{
+    if (big_endian) return get_be16(p);
+    return (p[1] << 8) | p[0];
+}
+
+/**
+ * @brief Tell if a buffer starts with the header of a pcap or pcapng capture
+ */
+bool is_pcap_header(const unsigned char *data, size_t size)
+{
+    if (size < 12) return false;
+    uint32_t magic = get_be32(data);
+    if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS) return true;
+    if (get_u32(data, false) == PCAP_MAGIC_US || get_u32(data, false) == PCAP_MAGIC_NS) return true;
+    if (magic == PCAPNG_SECTION_HEADER) {
+        uint32_t byte_order = get_be32(data + 8);
+        return byte_order == PCAPNG_BYTE_ORDER_MAGIC || get_u32(data + 8, false) == PCAPNG_BYTE_ORDER_MAGIC;
+    }
+    return false;
+}
+
+/**
+ * @brief Handle a TLS 1.2 Certificate handshake message
+ *
+ * Certificates already seen in the capture (identified by their
+ * SHA-256 fingerprint) are not given to the callback.
+ */
+static void handle_certificate_message(Pcap_reader &reader, const unsigned char *message, size_t size)
+{
+    if (size < 3 || get_be24(message) != size - 3) return; // not TLS 1.2 (or malformed)
+    size_t pos = 3;
+    size_t index = 0;
+    while (pos + 3 <= size && !reader.err) {
+        size_t length = get_be24(message + pos);
+        pos += 3;
+        if (length > size - pos) return;
+
+        unsigned char digest[SHA256_DIGEST_LENGTH];
+        SHA256(message + pos, length, digest);
+        if (reader.fingerprints.insert(std::string((char *)digest, sizeof(digest))).second) {
+            OctetString der_bytes(message + pos, length);
+            reader.err = reader.callback(der_bytes, reader.frame, index);
+        }
+        pos += length;
+        index++;
+    }
+}
+
+/**
+ * @brief Parse the TLS records received in order on a flow
+ *
+ * The parsing stops (the flow is done) at the first Certificate message,
+ * or when the data is not TLS, or becomes encrypted.
+ */
+static void parse_tls_records(Pcap_reader &reader, Tcp_flow &flow)
+{
+    size_t pos = 0;
+    while (!flow.done && flow.records.size() - pos >= 5) {
+        const unsigned char *record = flow.records.data() + pos;
+        int type = record[0];
+        size_t length = get_be16(record + 3);
+        if (type < TLS_CHANGE_CIPHER_SPEC || type > TLS_HEARTBEAT || record[1] != 3 || length > TLS_MAX_RECORD_SIZE) {
+            flow.finish(); // not TLS
+            return;
+        }
+        if (type != TLS_HANDSHAKE) {
+            flow.finish(); // the handshake messages that follow are encrypted
+            return;
+        }
+        if (flow.records.size() - pos < 5 + length) break; // wait for the rest of the record
+        flow.handshake.append(record + 5, length);
+        pos += 5 + length;
+
+        // Parse the complete handshake messages
+        size_t hpos = 0;
+        while (flow.handshake.size() - hpos >= 4) {
+            const unsigned char *message = flow.handshake.data() + hpos;
+            size_t message_length = get_be24(message + 1);
+            if (message_length > TLS_MAX_HANDSHAKE_SIZE) {
+                flow.finish();
+                return;
+            }
+            if (flow.handshake.size() - hpos < 4 + message_length) break;
+            if (message[0] == TLS_HANDSHAKE_CERTIFICATE) {
+                handle_certificate_message(reader, message + 4, message_length);
+                flow.finish();
+                return;
+            }
+            hpos += 4 + message_length;
+        }
+        flow.handshake.erase(0, hpos);
+    }
+    if (!flow.done) flow.records.erase(0, pos);
+}
+
+/**
+ * @brief Add in-order data to a flow, and then the segments received in advance that follow it
+ */
+static void append_flow_data(Pcap_reader &reader, Tcp_flow &flow, const unsigned char *data, size_t size)
+{
+    flow.records.append(data, size);
+    flow.next_seq += size;
+
+    bool progress = true;
+    while (progress && !flow.out_of_order.empty()) {
+        progress = false;
+        for (size_t i=0; i<flow.out_of_order.size(); i++) {
+            auto &segment = flow.out_of_order[i];
+            int32_t offset = (int32_t)(flow.next_seq - segment.first);
+            if (offset < 0) continue; // still in advance
+            if ((size_t)offset < segment.second.size()) {
+                flow.records.append(segment.second.data() + offset, segment.second.size() - offset);
+                flow.next_seq += segment.second.size() - offset;
+            }
+            flow.out_of_order_size -= segment.second.size();
+            flow.out_of_order.erase(flow.out_of_order.begin() + i);
+            progress = true;
+            break;
+        }
+    }
+    parse_tls_records(reader, flow);
+}
+
+/**
+ * @brief Handle the payload of a TCP segment
+ *
+ * Segments received in advance are kept (up to a limit), and
+ * retransmitted data is ignored.
+ */
+static void handle_flow_data(Pcap_reader &reader, Tcp_flow &flow, uint32_t seq, const unsigned char *payload, size_t size)
+{
+    if (!flow.started) {
+        // Connection started before the capture
+        flow.started = true;
+        flow.next_seq = seq;
+    }
+
+    int32_t offset = (int32_t)(seq - flow.next_seq);
+    if (offset <= 0) {
+        // In order, or retransmitted
+        size_t skip = -(int64_t)offset;
+        if (skip < size) append_flow_data(reader, flow, payload + skip, size - skip);
+    } else if (flow.out_of_order_size + size <= FLOW_MAX_OUT_OF_ORDER) {
+        flow.out_of_order.push_back(std::make_pair(seq, OctetString(payload, size)));
+        flow.out_of_order_size += size;
+    } else {
+        LOGINFO("%s: frame %llu: too many missing TCP segments (connection ignored)", reader.filename, reader.frame);
+        flow.finish();
+    }
+}
+
+static void handle_tcp_segment(Pcap_reader &reader, const std::string &key, int flags, uint32_t seq,
+                               const unsigned char *payload, size_t size)
+{
+    auto it = reader.flows.find(key);
+    if (it == reader.flows.end()) {
+        if (flags & (TCP_FIN | TCP_RST)) return;
+        if (!(flags & TCP_SYN) && !size) return;
+        if (reader.flows.size() >= MAX_FLOWS) {
+            // Forget the flows that are done, and then refuse new flows
+            for (auto flow = reader.flows.begin(); flow != reader.flows.end(); ) {
+                if (flow->second.done) flow = reader.flows.erase(flow);
+                else flow++;
+            }
+            if (reader.flows.size() >= MAX_FLOWS) {
+                if (!reader.flows_overflow) LOGWARNING("Too many TCP connections in '%s': some are ignored", reader.filename);
+                reader.flows_overflow = true;
+                return;
+            }
+        }
+        it = reader.flows.insert(std::make_pair(key, Tcp_flow())).first;
+    }
+
+    Tcp_flow &flow = it->second;
+    if (flags & TCP_SYN) {
+        flow = Tcp_flow(); // possibly a new connection with the same addresses and ports
+        flow.started = true;
+        flow.next_seq = seq + 1;
+        return;
+    }
+    if (size && !flow.done) {
+        handle_flow_data(reader, flow, seq, payload, size);
+    }
+    if (flags & (TCP_FIN | TCP_RST)) reader.flows.erase(it); // end of the connection
+}
+
+static void handle_tcp(Pcap_reader &reader, const unsigned char *addresses, size_t address_size,
+                       const unsigned char *data, size_t size)
+{
+    if (size < 20) return;
+    size_t header_size = (data[12] >> 4) * 4;
+    if (header_size < 20 || header_size > size) return;
+
+    // Key of the flow: source address and port, destination address and port
+    std::string key((const char *)addresses, address_size * 2);
+    key.append((const char *)data, 4);
+
+    handle_tcp_segment(reader, key, data[13], get_be32(data + 4), data + header_size, size - header_size);
+}
+
+static void handle_ip(Pcap_reader &reader, const unsigned char *data, size_t size)
+{
+    if (size < 1) return;
+    int version = data[0] >> 4;
+    if (version == 4) {
+        if (size < 20) return;
+        size_t header_size = (data[0] & 0x0f) * 4;
+        size_t total_size = get_be16(data + 2);
+        if (header_size < 20 || total_size < header_size || total_size > size) return;
+        if (get_be16(data + 6) & 0x3fff) return; // fragment
+        if (data[9] != IPPROTO_TCP_) return;
+        handle_tcp(reader, data + 12, 4, data + header_size, total_size - header_size);
+    } else if (version == 6) {
+        if (size < 40) return;
+        size_t payload_size = get_be16(data + 4);
+        if (payload_size > size - 40) return;
+        if (data[6] != IPPROTO_TCP_) return; // extension headers are not supported
+        handle_tcp(reader, data + 8, 16, data + 40, payload_size);
+    }
+}
+
+static void handle_ethertype(Pcap_reader &reader, uint16_t ethertype, const unsigned char *data, size_t size)
+{
+    while ((ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ) && size >= 4) {
+        ethertype = get_be16(data + 2);
+        data += 4;
+        size -= 4;
+    }
+    if (ethertype == ETHERTYPE_IPV4 || ethertype == ETHERTYPE_IPV6) handle_ip(reader, data, size);
+}
+
+static void handle_packet(Pcap_reader &reader, uint32_t linktype, const unsigned char *data, size_t size)
+{
+    reader.frame++;
+    switch (linktype) {
+    case LINKTYPE_ETHERNET:
+        if (size >= 14) handle_ethertype(reader, get_be16(data + 12), data + 14, size - 14);
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (size >= 16) handle_ethertype(reader, get_be16(data + 14), data + 16, size - 16);
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        if (size >= 20) handle_ethertype(reader, get_be16(data), data + 20, size - 20);
+        break;
+    case LINKTYPE_NULL:
+        if (size >= 4) handle_ip(reader, data + 4, size - 4);
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        handle_ip(reader, data, size);
+        break;
+    default:
+        break;
+    }
+}
+
+static int read_bytes(std::streambuf *input, unsigned char *data, size_t size)
+{
+    return (size_t)input->sgetn((char *)data, size) == size ? 0 : -1;
+}
+
+static int read_classic_pcap(Pcap_reader &reader, std::streambuf *input)
+{
+    unsigned char header[PCAP_HEADER_SIZE];
+    if (read_bytes(input, header, sizeof(header))) return -1;
+    bool big_endian = (get_be32(header) == PCAP_MAGIC_US || get_be32(header) == PCAP_MAGIC_NS);
+    uint32_t linktype = get_u32(header + 20, big_endian) & 0xffff;
+
+    std::vector<unsigned char> packet;
+    while (!reader.err) {
+        unsigned char record[PCAP_RECORD_HEADER_SIZE];
+        std::streamsize n = input->sgetn((char *)record, sizeof(record));
+        if (n == 0) break;
+        if (n != sizeof(record)) return -1;
+        uint32_t captured_size = get_u32(record + 8, big_endian);
+        if (captured_size > PCAP_MAX_PACKET_SIZE) return -1;
+        packet.resize(captured_size);
+        if (read_bytes(input, packet.data(), captured_size)) return -1;
+        handle_packet(reader, linktype, packet.data(), captured_size);
+    }
+    return 0;
+}
+
+static int read_pcapng(Pcap_reader &reader, std::streambuf *input)
+{
+    bool big_endian = true;
+    std::vector<uint32_t> linktypes; // of the interfaces of the current section
+    std::vector<unsigned char> block;
+    while (!reader.err) {
+        unsigned char header[8];
+        std::streamsize n = input->sgetn((char *)header, sizeof(header));
+        if (n == 0) break;
+        if (n != sizeof(header)) return -1;
+
+        uint32_t type = get_be32(header); // the section header block type is a palindrome
+        if (type == PCAPNG_SECTION_HEADER) {
+            unsigned char byte_order[4];
+            if (read_bytes(input, byte_order, sizeof(byte_order))) return -1;
+            big_endian = (get_be32(byte_order) == PCAPNG_BYTE_ORDER_MAGIC);
+            linktypes.clear();
+            uint32_t total_size = get_u32(header + 4, big_endian);
+            if (total_size < 12 + 16 || total_size % 4 || total_size > PCAP_MAX_PACKET_SIZE) return -1;
+            block.resize(total_size - 12);
+            if (read_bytes(input, block.data(), block.size())) return -1;
+            continue;
+        }
+
+        type = get_u32(header, big_endian);
+        uint32_t total_size = get_u32(header + 4, big_endian);
+        if (total_size < 12 || total_size % 4 || total_size > PCAP_MAX_PACKET_SIZE) return -1;
+        block.resize(total_size - 8); // body and trailing total length
+        if (read_bytes(input, block.data(), block.size())) return -1;
+        const unsigned char *body = block.data();
+        size_t body_size = total_size - 12;
+
+        if (type == PCAPNG_INTERFACE_DESCRIPTION) {
+            if (body_size < 8) return -1;
+            linktypes.push_back(get_u16(body, big_endian));
+        } else if (type == PCAPNG_ENHANCED_PACKET) {
+            if (body_size < 20) return -1;
+            uint32_t interface = get_u32(body, big_endian);
+            uint32_t captured_size = get_u32(body + 12, big_endian);
+            if (interface >= linktypes.size() || captured_size > body_size - 20) return -1;
+            handle_packet(reader, linktypes[interface], body + 20, captured_size);
+        } else if (type == PCAPNG_SIMPLE_PACKET) {
+            if (body_size < 4 || linktypes.empty()) return -1;
+            uint32_t original_size = get_u32(body, big_endian);
+            size_t captured_size = std::min((size_t)original_size, body_size - 4);
+            handle_packet(reader, linktypes[0], body + 4, captured_size);
+        } else if (type == PCAPNG_OBSOLETE_PACKET) {
+            if (body_size < 20) return -1;
+            uint16_t interface = get_u16(body, big_endian);
+            uint32_t captured_size = get_u32(body + 12, big_endian);
+            if (interface >= linktypes.size() || captured_size > body_size - 20) return -1;
+            handle_packet(reader, linktypes[interface], body + 20, captured_size);
+        }
+        // other blocks (statistics, name resolution, ...) are ignored
+    }
+    return 0;
+}
+
+/**
+ * @brief Extract the certificates of the TLS handshakes of a pcap or pcapng capture
+ * @param input     The capture, possibly being decompressed
+ * @param filename  For the messages
+ * @param callback  Called for each certificate not seen before in the capture
+ * @return 0 on success, -1 on error
+ *
+ * TCP streams are reassembled up to the first Certificate message
+ * (TLS 1.2 and before: in TLS 1.3, the certificates are encrypted).
+ * The capture is read as a stream, and the memory used is bounded by
+ * the number of connections followed at the same time, the data
+ * kept per connection, and the number of distinct certificates.
+ */
+int read_pcap(std::istream &input, const char *filename, const Pcap_callback &callback)
+{
+    Pcap_reader reader(filename, callback);
+    std::streambuf *buffer = input.rdbuf();
+    int err;
+    if (buffer->sgetc() == (PCAPNG_SECTION_HEADER >> 24)) err = read_pcapng(reader, buffer);
+    else err = read_classic_pcap(reader, buffer);
+    if (err) {
+        LOGERROR("Truncated or invalid capture: %s: frame %llu", filename, reader.frame + 1);
+        return -1;
+    }
+    LOGINFO("%s: %llu frame(s), %lu certificate(s)", filename, reader.frame, reader.fingerprints.size());
+    return reader.err;
+}
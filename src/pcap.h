@@ -0,0 +1,15 @@
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <functional>
+#include <istream>
+
+#include "util.h"
+
+/* Called for each new certificate. Returns 0 on success, -1 on error. */
+typedef std::function<int(OctetString &der_bytes, unsigned long long frame, size_t index_in_chain)> Pcap_callback;
+
+bool is_pcap_header(const unsigned char *data, size_t size);
+int read_pcap(std::istream &input, const char *filename, const Pcap_callback &callback);
+
+#endif // PCAP_H
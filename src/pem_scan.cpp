@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <ctype.h>
+#include <string.h>
+
+#include "journal.h"
+#include "pem_scan.h"
+
+#define PEM_LINE_START_SIZE 64  // size of the beginning of the lines used to classify them, in Pem_decode_streambuf
+#define PEM_DECODE_CHUNK    4096 // base64 characters decoded at once, in Pem_decode_streambuf
+
+#define PEM_MAX_TYPE 64 // size of the longest type of PEM block (eg: "CERTIFICATE")
+
+static const char PEM_BEGIN_ANY[] = "-----BEGIN ";
+static const char PEM_BEGIN[] = "-----BEGIN CERTIFICATE-----";
+static const char PEM_BEGIN_BASE64[] = "LS0tLS1CRUdJTiBDRVJUSUZJQ0FURS0tLS0t"; // base64 of PEM_BEGIN
+
+static bool is_base64_char(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '+' || c == '/' || c == '=';
+}
+
+/* Count the new lines in [data, end) */
+static size_t count_lines(const unsigned char *data, const unsigned char *end)
+{
+    size_t n = 0;
+    while (data < end) {
+        data = (const unsigned char *)memchr(data, '\n', end - data);
+        if (!data) break;
+        data++;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief Skip the RFC 1421 headers that may follow the BEGIN marker (eg: "Proc-Type: 4,ENCRYPTED")
+ * @param[in]  data       After the BEGIN marker
+ * @param[out] encrypted  Set if a header tells that the block is encrypted
+ * @return The beginning of the base64 body
+ */
+static const unsigned char *skip_pem_headers(const unsigned char *data, const unsigned char *end, bool &encrypted)
+{
+    const unsigned char *p = data;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    if (p == end || *p != '\n') return data; // the body follows on the same line
+    const unsigned char *line = p + 1;
+    while (line < end) {
+        const unsigned char *eol = (const unsigned char *)memchr(line, '\n', end - line);
+        const unsigned char *line_end = eol ? eol : end;
+        if (!memchr(line, ':', line_end - line)) break;
+        if (memmem(line, line_end - line, "ENCRYPTED", 9)) encrypted = true;
+        line = eol ? eol + 1 : end;
+        data = line;
+    }
+    return data;
+}
+
+/**
+ * @brief Get the base64 body of a PEM block, up to the END marker
+ * @param[in]  data        After the BEGIN marker and the headers
+ * @param[in]  end_marker  eg: "-----END CERTIFICATE-----"
+ * @param[out] base64
+ * @return 0 on success, -1 if the body is malformed or has no END marker
+ *
+ * Whitespace (indentation, CR, LF) is ignored, as well as the
+ * escaped new lines of a JSON string ("\n").
+ */
+static int get_pem_body(const unsigned char *data, const unsigned char *end, const std::string &end_marker,
+                        std::string &base64)
+{
+    const unsigned char *p = data;
+    while (p < end) {
+        unsigned char c = *p;
+        if (is_base64_char(c)) {
+            base64 += c;
+            p++;
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            p++;
+        } else if (c == '\\' && p + 1 < end && (p[1] == 'n' || p[1] == 'r')) {
+            p += 2;
+        } else if (c == '-') {
+            if ((size_t)(end - p) < end_marker.size()) return -1;
+            if (memcmp(p, end_marker.data(), end_marker.size())) return -1;
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Get the type of a PEM block, in its BEGIN marker (eg: "EC PRIVATE KEY")
+ * @param[in]  data  After "-----BEGIN "
+ * @return After the BEGIN marker, or NULL if the marker is malformed
+ */
+static const unsigned char *get_pem_type(const unsigned char *data, const unsigned char *end, std::string &type)
+{
+    const unsigned char *p = data;
+    while (p < end && p - data < PEM_MAX_TYPE && *p != '-' && *p != '\n') p++;
+    if (p == data || end - p < 5 || memcmp(p, "-----", 5)) return NULL;
+    type.assign((const char *)data, p - data);
+    return p + 5;
+}
+
+/**
+ * @brief Find the PEM blocks, or the base64 encoded PEM blocks, of a text
+ * @param any_type  Find the blocks of any type, instead of the certificates only
+ *                  (not with base64_wrapped)
+ */
+static void scan_marker(const unsigned char *data, size_t size, bool base64_wrapped, bool any_type, const char *filename,
+                        std::vector<Pem_block> &blocks)
+{
+    const unsigned char *end = data + size;
+    const unsigned char *pos = data;
+    const unsigned char *line_pos = data; // position up to which the lines are counted
+    size_t line = 1;
+    const char *marker = base64_wrapped ? PEM_BEGIN_BASE64 : any_type ? PEM_BEGIN_ANY : PEM_BEGIN;
+    size_t marker_size = strlen(marker);
+
+    while (pos < end) {
+        const unsigned char *begin = (const unsigned char *)memmem(pos, end - pos, marker, marker_size);
+        if (!begin) break;
+        line += count_lines(line_pos, begin);
+        line_pos = begin;
+
+        if (base64_wrapped) {
+            // Decode the whole base64 data, and look for PEM blocks in the result
+            const unsigned char *p = begin;
+            while (p < end && is_base64_char(*p)) p++;
+            OctetString text = base64_decode(std::string(begin, p));
+            std::vector<Pem_block> decoded_blocks;
+            scan_marker(text.data(), text.size(), false, false, filename, decoded_blocks);
+            for (auto &block: decoded_blocks) {
+                block.line = line;
+                blocks.push_back(std::move(block));
+            }
+            pos = p;
+            continue;
+        }
+
+        Pem_block block = { line, "CERTIFICATE", false, OctetString() };
+        const unsigned char *body = begin + marker_size;
+        if (any_type) body = get_pem_type(body, end, block.type);
+        if (body) body = skip_pem_headers(body, end, block.encrypted);
+        std::string base64;
+        if (!body || get_pem_body(body, end, "-----END " + block.type + "-----", base64)) {
+            LOGWARNING("Malformed PEM block: %s:%lu (ignored)", filename, line);
+            pos = begin + marker_size;
+            continue;
+        }
+        block.der_bytes = base64_decode(base64);
+        blocks.push_back(std::move(block));
+        pos = body + base64.size(); // the END marker is after, at least
+    }
+}
+
+/**
+ * @brief Find the PEM certificates in text of any kind (logs, YAML, JSON, configuration files, ...)
+ * @param[in]  data
+ * @param[in]  size
+ * @param[in]  base64_wrapped  Also look for base64 encoded PEM (eg: values of Kubernetes secrets)
+ * @param[in]  filename        For the messages
+ * @param[out] blocks          Ordered by line
+ *
+ * Malformed blocks are reported and ignored.
+ */
+void scan_pem_blocks(const unsigned char *data, size_t size, bool base64_wrapped, const char *filename,
+                     std::vector<Pem_block> &blocks)
+{
+    scan_marker(data, size, false, false, filename, blocks);
+    if (base64_wrapped) {
+        scan_marker(data, size, true, false, filename, blocks);
+        std::stable_sort(blocks.begin(), blocks.end(), [](const Pem_block &a, const Pem_block &b) {
+            return a.line < b.line;
+        });
+    }
+}
+
+/**
+ * @brief Find the PEM blocks of any type (eg: keys, CSRs and certificates) of a text
+ * @param[out] blocks  Ordered by line
+ *
+ * Malformed blocks are reported and ignored.
+ */
+void scan_pem_blocks_of_any_type(const unsigned char *data, size_t size, const char *filename,
+                                 std::vector<Pem_block> &blocks)
+{
+    scan_marker(data, size, false, true, filename, blocks);
+}
+
+/**
+ * @brief Classify the current line, from its beginning
+ *
+ * Lines starting with "-----" are markers, and lines with a ':' in
+ * their beginning are RFC 1421 headers. The other lines of a block are
+ * base64 data.
+ */
+void Pem_decode_streambuf::classify_line()
+{
+    if (0 == line_start.compare(0, 5, "-----")) {
+        in_block = (0 == line_start.compare(0, 11, "-----BEGIN "));
+        pending.clear();
+        line_state = LINE_SKIP;
+    } else if (!in_block || line_start.find(':') != std::string::npos) {
+        line_state = LINE_SKIP;
+    } else {
+        for (char c: line_start) {
+            if (!isspace((unsigned char)c)) pending += c;
+        }
+        line_state = LINE_DATA;
+    }
+    line_start.clear();
+}
+
+/**
+ * @brief Decode the complete groups of 4 characters of the pending base64
+ */
+void Pem_decode_streambuf::decode_pending()
+{
+    size_t n = pending.size();
+    if (pending.find('=') == std::string::npos) n -= n % 4;
+    decoded = base64_decode(pending.substr(0, n));
+    pending.erase(0, n);
+    setg((char *)decoded.data(), (char *)decoded.data(), (char *)decoded.data() + decoded.size());
+}
+
+Pem_decode_streambuf::int_type Pem_decode_streambuf::underflow()
+{
+    while (gptr() == egptr()) {
+        int c = source->sbumpc();
+        if (c == traits_type::eof()) {
+            if (line_state == LINE_START && !line_start.empty()) classify_line();
+            line_state = LINE_START;
+            if (pending.empty()) return traits_type::eof();
+            decode_pending();
+            if (gptr() == egptr()) return traits_type::eof(); // incomplete group at the end
+            break;
+        }
+        if (c == '\n') {
+            if (line_state == LINE_START) classify_line();
+            bool data = (line_state == LINE_DATA);
+            line_state = LINE_START;
+            if (data) decode_pending();
+            continue;
+        }
+        switch (line_state) {
+        case LINE_START:
+            line_start += (char)c;
+            if (line_start.size() == PEM_LINE_START_SIZE) classify_line();
+            break;
+        case LINE_DATA:
+            if (!isspace(c)) pending += (char)c;
+            if (pending.size() >= PEM_DECODE_CHUNK) decode_pending();
+            break;
+        case LINE_SKIP:
+            break;
+        }
+    }
+    return traits_type::to_int_type(*gptr());
+}
@@ -0,0 +1,47 @@
+#ifndef PEM_SCAN_H
+#define PEM_SCAN_H
+
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+struct Pem_block {
+    size_t line;       // line of the BEGIN marker (or of the base64 data containing it), starting at 1
+    std::string type;  // eg: "CERTIFICATE", "EC PRIVATE KEY"
+    bool encrypted;    // RFC 1421 header "Proc-Type: 4,ENCRYPTED"
+    OctetString der_bytes;
+};
+
+void scan_pem_blocks(const unsigned char *data, size_t size, bool base64_wrapped, const char *filename,
+                     std::vector<Pem_block> &blocks);
+void scan_pem_blocks_of_any_type(const unsigned char *data, size_t size, const char *filename,
+                                 std::vector<Pem_block> &blocks);
+
+/* Input stream buffer that decodes the base64 contents of the PEM blocks of another stream buffer
+ *
+ * The base64 is decoded as it is read, so that lines of any length are supported.
+ */
+class Pem_decode_streambuf : public std::streambuf {
+public:
+    Pem_decode_streambuf(std::streambuf *source): source(source), in_block(false), line_state(LINE_START) {}
+protected:
+    int_type underflow() override;
+private:
+    enum Line_state {
+        LINE_START, // reading the beginning of a line, to classify it
+        LINE_DATA,  // base64 data
+        LINE_SKIP   // marker, header, or outside of blocks
+    };
+    void classify_line();
+    void decode_pending();
+    std::streambuf *source;
+    bool in_block;
+    Line_state line_state;
+    std::string line_start; // beginning of the current line, while LINE_START
+    std::string pending;    // base64 characters not decoded yet
+    OctetString decoded;
+};
+
+#endif // PEM_SCAN_H
@@ -0,0 +1,151 @@
+#include <mutex>
+#include <openssl/err.h>
+#include <openssl/pkcs12.h>
+#include <openssl/provider.h>
+#include <openssl/x509.h>
+#include <ctype.h>
+#include <string.h>
+
+#include "journal.h"
+#include "pkcs.h"
+
+// DER of the OBJECT IDENTIFIER of the content of a ContentInfo
+static const unsigned char OID_PKCS7_DATA[] = { 0x06, 0x09, 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x01 };
+static const unsigned char OID_PKCS7_SIGNED_DATA[] = { 0x06, 0x09, 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x07, 0x02 };
+
+static std::string pkcs12_password;
+static bool pkcs12_password_given = false;
+
+void set_pkcs12_password(const std::string &password)
+{
+    pkcs12_password = password;
+    pkcs12_password_given = true;
+}
+
+/* Get the size of the header (tag and length) of the DER SEQUENCE at the beginning of data, or 0 */
+static size_t sequence_header_size(const unsigned char *data, size_t size)
+{
+    if (size < 2 || data[0] != 0x30) return 0;
+    if (!(data[1] & 0x80)) return 2;
+    size_t n_bytes = data[1] & 0x7f;
+    if (n_bytes == 0 || n_bytes > 4 || size < 2 + n_bytes) return 0;
+    return 2 + n_bytes;
+}
+
+/**
+ * @brief Tell if a buffer starts with a DER PKCS#7 SignedData (eg: .p7b file)
+ */
+bool is_pkcs7(const unsigned char *data, size_t size)
+{
+    size_t header = sequence_header_size(data, size);
+    if (!header || size < header + sizeof(OID_PKCS7_SIGNED_DATA)) return false;
+    return 0 == memcmp(data + header, OID_PKCS7_SIGNED_DATA, sizeof(OID_PKCS7_SIGNED_DATA));
+}
+
+static const char PEM_PKCS7_BEGIN[] = "-----BEGIN PKCS7-----";
+static const char PEM_PKCS7_END[] = "-----END PKCS7-----";
+
+bool is_pem_pkcs7(const unsigned char *data, size_t size)
+{
+    return size >= sizeof(PEM_PKCS7_BEGIN) - 1 && 0 == memcmp(data, PEM_PKCS7_BEGIN, sizeof(PEM_PKCS7_BEGIN) - 1);
+}
+
+/**
+ * @brief Get the DER bytes of a PEM PKCS#7 ("-----BEGIN PKCS7-----")
+ * @return The DER bytes, or an empty string on error
+ */
+OctetString pem_pkcs7_to_der(const unsigned char *data, size_t size)
+{
+    const unsigned char *end = (const unsigned char *)memmem(data, size, PEM_PKCS7_END, sizeof(PEM_PKCS7_END) - 1);
+    if (!end) return OctetString();
+    std::string base64;
+    for (const unsigned char *p = data + sizeof(PEM_PKCS7_BEGIN) - 1; p < end; p++) {
+        if (!isspace(*p)) base64 += *p;
+    }
+    return base64_decode(base64);
+}
+
+/**
+ * @brief Tell if a buffer starts with a DER PKCS#12 PFX (eg: .p12 or .pfx file)
+ *
+ * PFX ::= SEQUENCE {
+ *      version     INTEGER {v3(3)}(v3,...),
+ *      authSafe    ContentInfo,
+ *      macData     MacData OPTIONAL }
+ */
+bool is_pkcs12(const unsigned char *data, size_t size)
+{
+    static const unsigned char VERSION_3[] = { 0x02, 0x01, 0x03 };
+    size_t header = sequence_header_size(data, size);
+    if (!header || size < header + sizeof(VERSION_3)) return false;
+    if (memcmp(data + header, VERSION_3, sizeof(VERSION_3))) return false;
+    const unsigned char *auth_safe = data + header + sizeof(VERSION_3);
+    size_t auth_safe_header = sequence_header_size(auth_safe, data + size - auth_safe);
+    if (!auth_safe_header || data + size - auth_safe < (long)(auth_safe_header + sizeof(OID_PKCS7_DATA))) return false;
+    return 0 == memcmp(auth_safe + auth_safe_header, OID_PKCS7_DATA, sizeof(OID_PKCS7_DATA));
+}
+
+/* Load the OpenSSL providers needed by the PKCS#12 files made with older tools (RC2, 3DES) */
+static void load_providers()
+{
+    static std::once_flag once;
+    std::call_once(once, []() {
+        OSSL_PROVIDER_load(NULL, "legacy"); // optional
+        OSSL_PROVIDER_load(NULL, "default");
+        ERR_clear_error();
+    });
+}
+
+/**
+ * @brief Get the certificates of a PKCS#12 file
+ * @param[in]  data
+ * @param[in]  size
+ * @param[in]  filename
+ * @param[out] certificates  DER encoded: the certificate of the private key if any, then the others
+ * @return 0 on success, -1 on error
+ *
+ * The password is the one given by set_pkcs12_password(). If none was given,
+ * the file is expected to be protected by no password, or by an empty one.
+ */
+int pkcs12_get_certificates(const unsigned char *data, size_t size, const char *filename, std::vector<OctetString> &certificates)
+{
+    load_providers();
+
+    const unsigned char *p = data;
+    PKCS12 *p12 = d2i_PKCS12(NULL, &p, size);
+    if (!p12) {
+        LOGERROR("Cannot decode PKCS#12: %s", filename);
+        return -1;
+    }
+
+    const char *password = NULL;
+    if (pkcs12_password_given) {
+        password = pkcs12_password.c_str();
+    } else if (PKCS12_mac_present(p12) && !PKCS12_verify_mac(p12, NULL, 0)) {
+        password = "";
+    }
+
+    EVP_PKEY *pkey = NULL;
+    X509 *cert = NULL;
+    STACK_OF(X509) *ca = NULL;
+    if (!PKCS12_parse(p12, password, &pkey, &cert, &ca)) {
+        LOGERROR("Cannot parse PKCS#12 (wrong password?): %s", filename);
+        PKCS12_free(p12);
+        ERR_clear_error();
+        return -1;
+    }
+    PKCS12_free(p12);
+    EVP_PKEY_free(pkey); // only the certificates are of interest here
+
+    auto add_certificate = [&certificates](X509 *x509) {
+        unsigned char *der = NULL;
+        int length = i2d_X509(x509, &der);
+        if (length > 0) certificates.push_back(OctetString(der, length));
+        OPENSSL_free(der);
+    };
+    if (cert) add_certificate(cert);
+    for (int i=0; i<sk_X509_num(ca); i++) add_certificate(sk_X509_value(ca, i));
+    X509_free(cert);
+    sk_X509_pop_free(ca, X509_free);
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef PKCS_H
+#define PKCS_H
+
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+bool is_pkcs7(const unsigned char *data, size_t size);
+bool is_pem_pkcs7(const unsigned char *data, size_t size);
+OctetString pem_pkcs7_to_der(const unsigned char *data, size_t size);
+bool is_pkcs12(const unsigned char *data, size_t size);
+void set_pkcs12_password(const std::string &password);
+int pkcs12_get_certificates(const unsigned char *data, size_t size, const char *filename, std::vector<OctetString> &certificates);
+
+#endif // PKCS_H
@@ -1,8 +1,11 @@
 
+#include <unordered_set>
+
 #include "hierarchy.h"
 #include "journal.h"
 #include "oid_name.h"
 #include "render_text.h"
+#include "util.h"
 
 std::string to_string(const Name &name)
 {
@@ -61,21 +64,31 @@ std::string to_string(const std::set<std::string> &setstr, const std::string &se
     return result;
 }
 
-static std::string to_string(const GeneralNames &general_names)
+static std::string to_string(const GeneralName &general_name)
 {
-    switch (general_names.type) {
-    case GeneralNames::TYPE_STR:
-        return general_names.stringvalue;
-    case GeneralNames::TYPE_NAME:
-        return to_string(general_names.namevalue);
-    case GeneralNames::TYPE_OTHER:
-        return to_string(general_names.othervalue);
+    switch (general_name.type) {
+    case GeneralName::TYPE_STR:
+        return general_name.stringvalue;
+    case GeneralName::TYPE_NAME:
+        return to_string(general_name.namevalue);
+    case GeneralName::TYPE_OTHER:
+        return to_string(general_name.othervalue);
     default:
-        LOGERROR("Unexpected type of GeneralNames: %d", general_names.type);
+        LOGERROR("Unexpected type of GeneralName: %d", general_name.type);
         return "(error)";
     }
 }
 
+static std::string to_string(const GeneralNames &general_names)
+{
+    std::string result;
+    for (const auto &general_name: general_names.items) {
+        if (!result.empty()) result += ", ";
+        result += to_string(general_name);
+    }
+    return result;
+}
+
 static std::string to_string(const AuthorityKeyIdentifier &akid)
 {
     std::string result;
@@ -93,6 +106,43 @@ static std::string to_string(const AuthorityKeyIdentifier &akid)
     return result;
 }
 
+static std::string to_string(const NameConstraints &constraints)
+{
+    std::string result;
+    if (!constraints.permitted_subtrees.empty()) {
+        result += "permitted:" + to_string(constraints.permitted_subtrees);
+    }
+    if (!constraints.excluded_subtrees.empty()) {
+        if (!result.empty()) result += "; ";
+        result += "excluded:" + to_string(constraints.excluded_subtrees);
+    }
+    return result;
+}
+
+static std::string key_usage_to_string(KeyUsage key_usage)
+{
+    std::string result;
+    for (int bit=0; bit<KEY_USAGE_BITS; bit++) {
+        if (!(key_usage & (1 << bit))) continue;
+        if (!result.empty()) result += "|";
+        result += key_usage_name(bit);
+    }
+    return result;
+}
+
+/**
+ * @brief Render a list of interned OIDs, by their names if known
+ */
+static std::string interned_oids_to_string(const std::vector<uint32_t> &oids)
+{
+    std::string result;
+    for (uint32_t id: oids) {
+        if (!result.empty()) result += ", ";
+        result += oid_get_name(oid_interned(id), true);
+    }
+    return result;
+}
+
 std::string to_string(const Extension &ext)
 {
     std::string result;
@@ -102,7 +152,7 @@ std::string to_string(const Extension &ext)
         return to_string(skid);
     } else if (oid_name == "id-ce-keyUsage") {
         KeyUsage key_usage = std::any_cast<KeyUsage>(ext.extn_value);
-        return to_string(key_usage, "|");
+        return key_usage_to_string(key_usage);
     } else if (oid_name == "id-ce-privateKeyUsagePeriod") {
         OctetString value = std::any_cast<OctetString>(ext.extn_value);
         return to_string(value);
@@ -143,13 +193,19 @@ std::string to_string(const Extension &ext)
         GeneralNames general_names = std::any_cast<GeneralNames>(ext.extn_value);
         return to_string(general_names);
     } else if (oid_name == "id-ce-nameConstraints") {
-        OctetString value = std::any_cast<OctetString>(ext.extn_value);
+        if (const NameConstraints *constraints = std::any_cast<NameConstraints>(&ext.extn_value)) {
+            return to_string(*constraints);
+        }
+        OctetString value = std::any_cast<OctetString>(ext.extn_value); // not decodable
         return to_string(value);
     } else if (oid_name == "id-ce-cRLDistributionPoints") {
         OctetString value = std::any_cast<OctetString>(ext.extn_value);
         return to_string(value);
     } else if (oid_name == "id-ce-certificatePolicies") {
-        OctetString value = std::any_cast<OctetString>(ext.extn_value);
+        if (const CertificatePolicies *policies = std::any_cast<CertificatePolicies>(&ext.extn_value)) {
+            return interned_oids_to_string(policies->policies);
+        }
+        OctetString value = std::any_cast<OctetString>(ext.extn_value); // not decodable
         return to_string(value);
     } else if (oid_name == "id-ce-policyMappings") {
         OctetString value = std::any_cast<OctetString>(ext.extn_value);
@@ -161,7 +217,10 @@ std::string to_string(const Extension &ext)
         OctetString value = std::any_cast<OctetString>(ext.extn_value);
         return to_string(value);
     } else if (oid_name == "id-ce-extKeyUsage") {
-        OctetString value = std::any_cast<OctetString>(ext.extn_value);
+        if (const ExtKeyUsage *eku = std::any_cast<ExtKeyUsage>(&ext.extn_value)) {
+            return interned_oids_to_string(eku->purposes);
+        }
+        OctetString value = std::any_cast<OctetString>(ext.extn_value); // not decodable
         return to_string(value);
     } else {
         OctetString value = std::any_cast<OctetString>(ext.extn_value);
@@ -222,8 +281,16 @@ static std::string to_rich_node(const Certificate_with_links &cert, const Indent
     }
     result += indent_first_line + to_string(cert.tbs_certificate.subject) + "\n";
     if (is_self_signed(cert)) result += indent_second_lines + "self-signed\n";
+    if (cert.revoked) result += indent_second_lines + "revoked\n";
+    if (cert.validation.done) {
+        if (cert.validation.error.empty()) result += indent_second_lines + "valid\n";
+        else result += indent_second_lines + "invalid: " + cert.validation.error + "\n";
+    }
     result += indent_second_lines + cert.tbs_certificate.validity.not_before + " .. " + cert.tbs_certificate.validity.not_after + "\n";
     result += indent_second_lines + cert.get_file_location() + "\n";
+    if (cert.fingerprints.computed) {
+        result += indent_second_lines + "sha256:" + hexlify(cert.fingerprints.sha256, sizeof(cert.fingerprints.sha256)) + "\n";
+    }
     if (!cert.children.empty()) {
         result += indent_last_line + "─┬─────────────────────────────────────────────────────────────────\n";
     } else {
@@ -271,34 +338,37 @@ static std::string to_minimal_node(const Certificate_with_links &cert, const Ind
         // This certificate has no parent
         indent_line = "";
     }
-    result += indent_line + to_string(cert.tbs_certificate.subject) + "(" + cert.get_file_location() + ")\n";
+    result += indent_line + to_string(cert.tbs_certificate.subject) + "(" + cert.get_file_location() + ")";
+    if (cert.revoked) result += " revoked";
+    if (cert.validation.done && !cert.validation.error.empty()) result += " invalid: " + cert.validation.error;
+    result += "\n";
 
     return result;
 }
 
 
-static void print_tree(const Certificate_with_links &cert, IndentationContext indentation_ctx, bool minimal)
+static void print_tree(const Certificate_with_links &cert, IndentationContext indentation_ctx, bool minimal,
+                       const std::unordered_set<const Certificate_with_links*> &visible)
 {
     if (minimal) printf("%s", to_minimal_node(cert, indentation_ctx).c_str());
     else printf("%s", to_rich_node(cert, indentation_ctx).c_str());
 
-    std::set<Certificate_with_links*>::const_iterator child;
-    for (child=cert.children.begin(); child!=cert.children.end(); child++) {
-        std::set<Certificate_with_links*>::const_iterator next_child = child;
-        next_child++;
+    std::vector<const Certificate_with_links*> children;
+    for (const Certificate_with_links *child: cert.children) {
+        if (visible.count(child)) children.push_back(child);
+    }
+    for (size_t i=0; i<children.size(); i++) {
         IndentationContext indentation_ctx_child = indentation_ctx;
-        if (next_child== cert.children.end()) {
-            // Last child
-            indentation_ctx_child.lineage.push_back(false);
-        } else {
-            indentation_ctx_child.lineage.push_back(true);
-        }
-        print_tree(*(*child), indentation_ctx_child, minimal);
+        // The last child has no line below it
+        indentation_ctx_child.lineage.push_back(i + 1 < children.size());
+        print_tree(*children[i], indentation_ctx_child, minimal, visible);
     }
 }
 
 /**
  * @brief Print a hierarchical tree of certificates
+ * @param filter  Usages and policies of the certificates to print (see Usage_bits::covers()).
+ *                Their ancestors are printed too, so that their lineage is shown.
  *
  * For each certificate that has no parent, print its descendance.
  * It is assumed that:
@@ -306,14 +376,26 @@ static void print_tree(const Certificate_with_links &cert, IndentationContext in
  *   (circular dependencies have been broken)
  * - no certificate has 2 or more parents
  */
-void print_tree(const std::vector<Certificate_with_links> &certificates, bool minimal)
+void print_tree(const std::vector<Certificate_with_links> &certificates, bool minimal, const Usage_bits &filter)
 {
     LOGINFO("Printing tree...");
-    std::vector<Certificate_with_links>::const_iterator cert;
+    std::unordered_set<const Certificate_with_links*> visible;
+    std::vector<const Certificate_with_links*> pending;
+    for (const auto &cert: certificates) {
+        if (!cert.tbs_certificate.usage_bits.covers(filter)) continue;
+        pending.push_back(&cert);
+        while (!pending.empty()) {
+            const Certificate_with_links *node = pending.back();
+            pending.pop_back();
+            if (!visible.insert(node).second) continue; // its ancestors are already visible
+            for (const Certificate_with_links *parent: node->parents) pending.push_back(parent);
+        }
+    }
+
     IndentationContext indentation_ctx;
-    for (cert=certificates.begin(); cert!=certificates.end(); cert++) {
-        if (cert->parents.empty()) {
-            print_tree(*cert, indentation_ctx, minimal);
+    for (const auto &cert: certificates) {
+        if (cert.parents.empty() && visible.count(&cert)) {
+            print_tree(cert, indentation_ctx, minimal, visible);
         }
     }
 }
@@ -349,5 +431,9 @@ void print_cert(const Certificate_with_links &certificate, bool single)
     }
     print_property(prefix, "signaturealgo", to_string(certificate.signature_algorithm));
     print_property(prefix, "signaturebytes", to_string(certificate.signature_value));
+    if (certificate.fingerprints.computed) {
+        print_property(prefix, "sha1fingerprint", hexlify(certificate.fingerprints.sha1, sizeof(certificate.fingerprints.sha1)));
+        print_property(prefix, "sha256fingerprint", hexlify(certificate.fingerprints.sha256, sizeof(certificate.fingerprints.sha256)));
+    }
 }
 
@@ -15,7 +15,7 @@ std::string to_string(const Name &name);
 std::string to_string(bool);
 std::string to_string(const BasicConstraints &);
 
-void print_tree(const std::vector<Certificate_with_links> &certificates, bool minimal=false);
+void print_tree(const std::vector<Certificate_with_links> &certificates, bool minimal=false, const Usage_bits &filter=Usage_bits());
 
 void print_cert(const Certificate_with_links &certificate, bool single);
 
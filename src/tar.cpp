@@ -0,0 +1,292 @@
+#include <limits>
+#include <stdlib.h>
+#include <string.h>
+
+#include "journal.h"
+#include "tar.h"
+
+// Offsets of the fields of a ustar header block
+#define TAR_NAME      0
+#define TAR_NAME_SIZE 100
+#define TAR_SIZE      124
+#define TAR_SIZE_SIZE 12
+#define TAR_CHKSUM    148
+#define TAR_CHKSUM_SIZE 8
+#define TAR_TYPEFLAG  156
+#define TAR_MAGIC     257
+#define TAR_PREFIX    345
+#define TAR_PREFIX_SIZE 155
+
+#define TAR_EXTENDED_HEADER_MAX (1024*1024)
+#define TAR_MEMBER_SIZE_MAX (1ULL << 62) // beyond any real archive, and far from overflows
+
+/* Get a string field, that is null-terminated only if shorter than the field */
+static std::string get_field_string(const unsigned char *block, size_t offset, size_t size)
+{
+    const char *field = (const char *)block + offset;
+    return std::string(field, strnlen(field, size));
+}
+
+/**
+ * @brief Get a numeric field, in octal or in base-256 (GNU extension for large values)
+ * @return 0 on success, -1 on error
+ */
+static int get_field_number(const unsigned char *block, size_t offset, size_t size, unsigned long long &value)
+{
+    const unsigned char *field = block + offset;
+    value = 0;
+    if (field[0] & 0x80) {
+        if (field[0] != 0x80) return -1; // negative, or too large
+        for (size_t i=1; i<size; i++) {
+            if (value >> 56) return -1;
+            value = (value << 8) | field[i];
+        }
+        return 0;
+    }
+    size_t i = 0;
+    while (i < size && field[i] == ' ') i++;
+    for (; i < size && field[i] >= '0' && field[i] <= '7'; i++) {
+        if (value >> 61) return -1;
+        value = (value << 3) + (field[i] - '0');
+    }
+    if (i < size && field[i] != ' ' && field[i] != '\0') return -1;
+    return 0;
+}
+
+static bool is_checksum_valid(const unsigned char *block)
+{
+    unsigned long long expected;
+    if (get_field_number(block, TAR_CHKSUM, TAR_CHKSUM_SIZE, expected)) return false;
+    unsigned long long sum = 0;
+    for (size_t i=0; i<TAR_BLOCK_SIZE; i++) {
+        // the checksum field is computed as if filled with spaces
+        if (i >= TAR_CHKSUM && i < TAR_CHKSUM + TAR_CHKSUM_SIZE) sum += ' ';
+        else sum += block[i];
+    }
+    return sum == expected;
+}
+
+/**
+ * @brief Tell if a buffer starts with a ustar header block (POSIX ustar, pax or GNU tar)
+ */
+bool is_tar_header(const unsigned char *block, size_t size)
+{
+    if (size < TAR_BLOCK_SIZE) return false;
+    if (memcmp(block + TAR_MAGIC, "ustar", 5)) return false;
+    return is_checksum_valid(block);
+}
+
+/**
+ * @brief Apply the records of a pax extended header ("<length> <key>=<value>\n")
+ *
+ * Only the path and size are of interest here.
+ */
+static int parse_pax_records(const OctetString &data, std::string &path, unsigned long long &size, bool &has_size)
+{
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t length = 0;
+        size_t i = pos;
+        while (i < data.size() && data[i] >= '0' && data[i] <= '9') {
+            length = length * 10 + (data[i] - '0');
+            if (length > data.size()) return -1;
+            i++;
+        }
+        if (i == pos || i >= data.size() || data[i] != ' ') return -1;
+        if (length == 0 || pos + length > data.size() || data[pos + length - 1] != '\n') return -1;
+
+        std::string record((const char *)data.data() + i + 1, pos + length - i - 2); // without the '\n'
+        size_t equal = record.find('=');
+        if (equal == std::string::npos) return -1;
+        std::string key = record.substr(0, equal);
+        std::string value = record.substr(equal + 1);
+        if (key == "path") {
+            path = value;
+        } else if (key == "size") {
+            char *end;
+            size = strtoull(value.c_str(), &end, 10);
+            if (value.empty() || *end) return -1;
+            has_size = true;
+        }
+        pos += length;
+    }
+    return 0;
+}
+
+Tar_reader::Tar_reader(std::istream &input, const char *archive, const unsigned char *first_block)
+    : input(input), archive(archive), first_block(first_block), remaining(0), padding(0), error(false)
+{
+}
+
+/**
+ * @brief Read a block of the archive
+ * @return 1 if a block was read, 0 at the end of the input, -1 on error
+ */
+int Tar_reader::read_block(unsigned char *block)
+{
+    if (first_block) {
+        memcpy(block, first_block, TAR_BLOCK_SIZE);
+        first_block = 0;
+        return 1;
+    }
+    input.read((char *)block, TAR_BLOCK_SIZE);
+    if (input.gcount() == TAR_BLOCK_SIZE) return 1;
+    if (input.gcount() == 0 && input.eof()) return 0;
+    LOGERROR("Truncated tar archive: '%s'", archive.c_str());
+    return -1;
+}
+
+/**
+ * @brief Skip the rest of the current member
+ * @return 0 on success, -1 on error
+ */
+int Tar_reader::skip_contents()
+{
+    unsigned long long n = remaining + padding;
+    remaining = 0;
+    padding = 0;
+    if (error) return -1;
+    if (!n) return 0;
+    if (n < (unsigned long long)std::numeric_limits<std::streamsize>::max()) input.ignore(n);
+    if ((unsigned long long)input.gcount() != n) {
+        error = true;
+        LOGERROR("Truncated tar archive: '%s'", archive.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int Tar_reader::read_extended_header(unsigned long long size, OctetString &data)
+{
+    if (size > TAR_EXTENDED_HEADER_MAX) {
+        LOGERROR("Tar extended header too large in '%s'", archive.c_str());
+        return -1;
+    }
+    remaining = size;
+    padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    return read_contents(data);
+}
+
+/**
+ * @brief Go to the next regular file of the archive
+ * @param[out] member
+ * @return 1 if a member was found, 0 at the end of the archive, -1 on error
+ *
+ * Directories, links and other special members are skipped.
+ */
+int Tar_reader::next(Tar_member &member)
+{
+    // Attributes given by the extended headers that precede the member
+    std::string long_path;
+    unsigned long long pax_size = 0;
+    bool has_pax_size = false;
+
+    while (1) {
+        if (skip_contents()) return -1;
+
+        unsigned char block[TAR_BLOCK_SIZE];
+        int result = read_block(block);
+        if (result <= 0) return result;
+
+        bool is_zero = true;
+        for (size_t i=0; i<TAR_BLOCK_SIZE && is_zero; i++) is_zero = (block[i] == 0);
+        if (is_zero) return 0; // end-of-archive marker
+
+        if (!is_checksum_valid(block)) {
+            LOGERROR("Invalid tar header in '%s'", archive.c_str());
+            return -1;
+        }
+
+        unsigned long long size;
+        if (get_field_number(block, TAR_SIZE, TAR_SIZE_SIZE, size)) {
+            LOGERROR("Invalid tar member size in '%s'", archive.c_str());
+            return -1;
+        }
+
+        char type = block[TAR_TYPEFLAG];
+        if (type == 'x' || type == 'L') {
+            OctetString data;
+            if (read_extended_header(size, data)) return -1;
+            if (type == 'L') {
+                // GNU long name: null-terminated
+                long_path = std::string((const char *)data.data(), strnlen((const char *)data.data(), data.size()));
+            } else if (parse_pax_records(data, long_path, pax_size, has_pax_size)) {
+                LOGERROR("Invalid pax extended header in '%s'", archive.c_str());
+                return -1;
+            }
+            continue;
+        }
+
+        if (has_pax_size) size = pax_size;
+        if (size > TAR_MEMBER_SIZE_MAX) {
+            LOGERROR("Invalid tar member size in '%s'", archive.c_str());
+            error = true;
+            return -1;
+        }
+        remaining = size;
+        padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+        if (type != '0' && type != '\0' && type != '7') {
+            // 'g' (pax global header), directories, links, ...
+            long_path.clear();
+            has_pax_size = false;
+            continue;
+        }
+
+        if (!long_path.empty()) {
+            member.path = long_path;
+        } else {
+            std::string prefix = get_field_string(block, TAR_PREFIX, TAR_PREFIX_SIZE);
+            member.path = get_field_string(block, TAR_NAME, TAR_NAME_SIZE);
+            if (!prefix.empty()) member.path = prefix + "/" + member.path;
+        }
+        member.size = size;
+        return 1;
+    }
+}
+
+/**
+ * @brief Read a part of the contents of the current member
+ * @return The number of bytes read, 0 at the end of the member, -1 on error
+ */
+std::streamsize Tar_reader::read_some(char *buffer, size_t size)
+{
+    if (error) return -1;
+    if (!remaining) return 0;
+    if (size > remaining) size = remaining;
+    input.read(buffer, size);
+    std::streamsize n = input.gcount();
+    remaining -= n;
+    if (n <= 0) {
+        // The size given by the header goes beyond the end of the archive
+        LOGERROR("Truncated tar archive: '%s'", archive.c_str());
+        error = true;
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * @brief Read the contents of the current member
+ * @return 0 on success, -1 on error
+ *
+ * The contents are read by chunks, so that the memory follows the bytes
+ * actually present in the archive, not the size claimed by the header.
+ */
+int Tar_reader::read_contents(OctetString &data)
+{
+    data.clear();
+    char chunk[65536];
+    std::streamsize n;
+    while ((n = read_some(chunk, sizeof(chunk))) > 0) data.append((unsigned char *)chunk, n);
+    return n < 0 ? -1 : 0;
+}
+
+Tar_member_streambuf::int_type Tar_member_streambuf::underflow()
+{
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    std::streamsize n = reader.read_some(buffer.data(), buffer.size());
+    if (n <= 0) return traits_type::eof();
+    setg(buffer.data(), buffer.data(), buffer.data() + n);
+    return traits_type::to_int_type(*gptr());
+}
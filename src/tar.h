@@ -0,0 +1,58 @@
+#ifndef TAR_H
+#define TAR_H
+
+#include <istream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+#define TAR_BLOCK_SIZE 512
+
+bool is_tar_header(const unsigned char *block, size_t size);
+
+struct Tar_member {
+    std::string path;
+    unsigned long long size;
+};
+
+/**
+ * Sequential reader of the regular files of a tar archive (ustar, pax, GNU long names).
+ *
+ * The archive is read as a stream, so that it may be decompressed on the fly.
+ * The contents of a member that is not read is skipped by the next call to next().
+ */
+class Tar_reader {
+public:
+    Tar_reader(std::istream &input, const char *archive, const unsigned char *first_block);
+    int next(Tar_member &member);
+    int read_contents(OctetString &data);
+    std::streamsize read_some(char *buffer, size_t size);
+    bool failed() const { return error; }
+
+private:
+    int read_block(unsigned char *block);
+    int read_extended_header(unsigned long long size, OctetString &data);
+    int skip_contents();
+
+    std::istream &input;
+    std::string archive;
+    const unsigned char *first_block; // header block already read by the caller, or null
+    unsigned long long remaining;     // bytes of contents of the current member not read yet
+    unsigned long long padding;       // bytes after the contents, up to the end of the block
+    bool error;                       // the archive is truncated
+};
+
+/* Input stream buffer over the contents of the current member of a tar archive */
+class Tar_member_streambuf : public std::streambuf {
+public:
+    Tar_member_streambuf(Tar_reader &reader): reader(reader), buffer(65536) {}
+protected:
+    int_type underflow() override;
+private:
+    Tar_reader &reader;
+    std::vector<char> buffer;
+};
+
+#endif // TAR_H
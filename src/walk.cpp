@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+
+#include "journal.h"
+#include "parallel.h"
+#include "walk.h"
+
+struct Walk_entry {
+    std::string path;
+    dev_t dev;
+    ino_t ino;
+    size_t root_index; // index of the path given by the user that led to this entry
+    bool is_symlink;
+    bool discovered;
+    long long size;
+};
+
+/* File descriptor of a directory, closed once all its sub-directories are opened */
+struct Dir_fd {
+    int fd;
+    Dir_fd(int fd): fd(fd) {}
+    ~Dir_fd() { close(fd); }
+};
+
+struct Walk_dir {
+    std::string path;
+    std::shared_ptr<Dir_fd> parent; // null for the directories given by the user
+    std::string name;               // name in the parent directory
+    bool follow;                    // reached through a symbolic link, that is followed
+    size_t root_index;
+};
+
+/* State shared by the walker threads */
+struct Walker {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Walk_dir> queue; // used as a stack, so that few parent directories are kept open
+    size_t busy; // number of directories being read by the threads
+    std::set<std::pair<dev_t, ino_t>> visited_dirs;
+    std::vector<Walk_entry> entries;
+    size_t errors; // number of paths that could not be read
+    std::vector<std::string> *skipped; // paths in error and why, if they are skipped instead of logged
+    Walker(std::vector<std::string> *skipped): busy(0), errors(0), skipped(skipped) {}
+};
+
+static std::string join_path(const std::string &dir, const char *name)
+{
+    if (!dir.empty() && dir.back() == '/') return dir + name;
+    return dir + "/" + name;
+}
+
+/**
+ * @brief Log an error on a path, or keep it for the caller if the paths in error are skipped
+ *
+ * The walker mutex must be locked, if the walker threads are running.
+ */
+static void add_error(Walker &walker, const std::string &path, const char *action, const std::string &reason)
+{
+    walker.errors++;
+    if (walker.skipped) walker.skipped->push_back(path + ": " + reason);
+    else LOGERROR("Cannot %s '%s': %s", action, path.c_str(), reason.c_str());
+}
+
+/**
+ * @brief Read the entries of a directory
+ *
+ * Regular files are added to the walker entries, and sub-directories
+ * are queued. The entries and the sub-directories are opened and stat'ed
+ * relatively to the directory file descriptor, so that a directory renamed
+ * or replaced by a symbolic link during the walk is not followed.
+ * Symbolic links found in the directory are followed.
+ */
+static void walk_dir(Walker &walker, const Walk_dir &dir)
+{
+    int fd;
+    if (dir.parent) {
+        int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+        if (!dir.follow) flags |= O_NOFOLLOW;
+        fd = openat(dir.parent->fd, dir.name.c_str(), flags);
+    } else {
+        fd = open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        std::string reason = strerror(errno);
+        std::lock_guard<std::mutex> lock(walker.mutex);
+        add_error(walker, dir.path, "open directory", reason);
+        return;
+    }
+    std::shared_ptr<Dir_fd> dir_fd = std::make_shared<Dir_fd>(fd);
+
+    struct stat dir_stat;
+    if (fstat(fd, &dir_stat)) {
+        std::string reason = strerror(errno);
+        std::lock_guard<std::mutex> lock(walker.mutex);
+        add_error(walker, dir.path, "stat directory", reason);
+        return;
+    }
+
+    {
+        // Do not walk twice the same directory (symbolic links may cause loops)
+        std::lock_guard<std::mutex> lock(walker.mutex);
+        if (!walker.visited_dirs.insert(std::make_pair(dir_stat.st_dev, dir_stat.st_ino)).second) {
+            LOGINFO("Directory '%s' already visited", dir.path.c_str());
+            return;
+        }
+    }
+
+    std::vector<Walk_entry> entries;
+    std::vector<Walk_dir> subdirs;
+    alignas(struct dirent64) char buffer[32768];
+    while (1) {
+        ssize_t n = getdents64(fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            std::string reason = strerror(errno);
+            std::lock_guard<std::mutex> lock(walker.mutex);
+            add_error(walker, dir.path, "read directory", reason);
+            break;
+        }
+        if (n == 0) break;
+
+        for (ssize_t pos=0; pos<n; ) {
+            struct dirent64 *dirent = (struct dirent64 *)(buffer + pos);
+            pos += dirent->d_reclen;
+            const char *name = dirent->d_name;
+            if (0 == strcmp(name, ".") || 0 == strcmp(name, "..")) continue;
+
+            std::string path = join_path(dir.path, name);
+            if (dirent->d_type == DT_DIR) {
+                subdirs.push_back({path, dir_fd, name, false, dir.root_index});
+                continue;
+            }
+
+            // Follow symbolic links, so that the target inode is used for deduplication
+            struct stat st;
+            if (fstatat(fd, name, &st, 0)) {
+                LOGWARNING("Cannot stat '%s': %s (ignored)", path.c_str(), strerror(errno));
+                continue;
+            }
+            if (S_ISDIR(st.st_mode)) {
+                subdirs.push_back({path, dir_fd, name, true, dir.root_index});
+            } else if (S_ISREG(st.st_mode)) {
+                bool is_symlink = (dirent->d_type == DT_LNK);
+                entries.push_back({path, st.st_dev, st.st_ino, dir.root_index, is_symlink, true, st.st_size});
+            } else {
+                LOGINFO("Not a regular file: '%s' (ignored)", path.c_str());
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(walker.mutex);
+    walker.entries.insert(walker.entries.end(), entries.begin(), entries.end());
+    walker.queue.insert(walker.queue.end(), subdirs.begin(), subdirs.end());
+    walker.cond.notify_all();
+}
+
+static void walker_thread(Walker &walker)
+{
+    std::unique_lock<std::mutex> lock(walker.mutex);
+    while (1) {
+        walker.cond.wait(lock, [&walker]() { return !walker.queue.empty() || walker.busy == 0; });
+        if (walker.queue.empty()) break; // and no thread may queue more directories
+
+        Walk_dir dir = walker.queue.back();
+        walker.queue.pop_back();
+        walker.busy++;
+        lock.unlock();
+
+        walk_dir(walker, dir);
+
+        lock.lock();
+        walker.busy--;
+        walker.cond.notify_all();
+    }
+}
+
+/**
+ * @brief Expand the paths given by the user into a list of files to load
+ * @param[in]  paths      Files and directories
+ * @param[in]  recursive  Walk directories (if false, directories are refused)
+ * @param[out] files
+ * @param[out] skipped    If not null, the paths in error are skipped and listed there (with the reason,
+ *                        sorted), instead of being logged and failing
+ * @return 0 on success, -1 on error
+ *
+ * Directories are walked by several threads in parallel.
+ *
+ * A file reachable through several paths (eg: the hash symbolic links created
+ * by c_rehash in /etc/ssl/certs) is kept only once, identified by its
+ * device and inode. The path kept is preferably the one given explicitly,
+ * then one that is not a symbolic link.
+ *
+ * The resulting files are ordered as the given paths, and the files found
+ * in a given directory are sorted by path.
+ */
+int walk_paths(const std::list<std::string> &paths, bool recursive, std::vector<Input_file> &files, std::vector<std::string> *skipped)
+{
+    Walker walker(skipped);
+    size_t root_index = 0;
+    for (auto &path: paths) {
+        struct stat st;
+        if (stat(path.c_str(), &st)) {
+            add_error(walker, path, "read from", strerror(errno));
+            if (!skipped) return -1;
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (!recursive) {
+                if (!skipped) {
+                    LOGERROR("'%s' is a directory (use --recursive to walk directories)", path.c_str());
+                    return -1;
+                }
+                add_error(walker, path, "read from", "is a directory (use --recursive to walk directories)");
+                continue;
+            }
+            walker.queue.push_back({path, 0, "", false, root_index});
+        } else {
+            long long size = S_ISREG(st.st_mode) ? st.st_size : -1;
+            walker.entries.push_back({path, st.st_dev, st.st_ino, root_index, false, false, size});
+        }
+        root_index++;
+    }
+
+    if (!walker.queue.empty()) {
+        std::vector<std::thread> threads;
+        for (unsigned int i=1; i<get_parallel_jobs(); i++) {
+            threads.push_back(std::thread(walker_thread, std::ref(walker)));
+        }
+        walker_thread(walker);
+        for (auto &thread: threads) thread.join();
+        if (walker.errors && !skipped) return -1;
+    }
+
+    std::vector<Walk_entry> &entries = walker.entries;
+
+    // Keep one path per inode
+    std::sort(entries.begin(), entries.end(), [](const Walk_entry &a, const Walk_entry &b) {
+        return std::tie(a.dev, a.ino, a.discovered, a.is_symlink, a.root_index, a.path)
+             < std::tie(b.dev, b.ino, b.discovered, b.is_symlink, b.root_index, b.path);
+    });
+    auto last = std::unique(entries.begin(), entries.end(), [](const Walk_entry &a, const Walk_entry &b) {
+        if (a.dev != b.dev || a.ino != b.ino) return false;
+        LOGINFO("Skipping '%s' (same file as '%s')", b.path.c_str(), a.path.c_str());
+        return true;
+    });
+    entries.erase(last, entries.end());
+
+    std::sort(entries.begin(), entries.end(), [](const Walk_entry &a, const Walk_entry &b) {
+        return std::tie(a.root_index, a.path) < std::tie(b.root_index, b.path);
+    });
+
+    for (auto &entry: entries) files.push_back({entry.path, entry.discovered, entry.size});
+    LOGINFO("%lu file(s) to load", files.size());
+    if (skipped) std::sort(skipped->begin(), skipped->end());
+
+    return 0;
+}
+
+/**
+ * @brief Read a list of paths from a file ("-" for stdin)
+ *
+ * Paths are separated by new lines, or by null characters
+ * if null_separated is true (eg: output of find -print0).
+ */
+int read_files_from(const std::string &list_path, bool null_separated, std::list<std::string> &paths)
+{
+    std::ifstream ifs;
+    std::istream *input = &std::cin;
+    if (list_path != "-") {
+        ifs.open(list_path, std::ifstream::in);
+        if (!ifs.good()) {
+            LOGERROR("Cannot read from '%s': %s", list_path.c_str(), strerror(errno));
+            return -1;
+        }
+        input = &ifs;
+    }
+
+    char delimiter = null_separated ? '\0' : '\n';
+    std::string path;
+    while (std::getline(*input, path, delimiter)) {
+        if (path.empty()) continue;
+        paths.push_back(path);
+    }
+    if (input->bad()) {
+        LOGERROR("Cannot read list of files from '%s'", list_path.c_str());
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <list>
+#include <string>
+#include <vector>
+
+struct Input_file {
+    std::string path;
+    bool discovered; // found while walking a directory (as opposed to given explicitly)
+    long long size;  // -1 if not a regular file
+};
+
+int walk_paths(const std::list<std::string> &paths, bool recursive, std::vector<Input_file> &files, std::vector<std::string> *skipped = 0);
+int read_files_from(const std::string &list_path, bool null_separated, std::list<std::string> &paths);
+
+#endif // WALK_H
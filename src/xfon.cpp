@@ -4,7 +4,10 @@
 #include <string.h>
 
 #include "config.h"
+#include "cmd_asn1dump.h"
 #include "cmd_diff.h"
+#include "cmd_find_host.h"
+#include "cmd_match.h"
 #include "cmd_show.h"
 #include "cmd_tree.h"
 
@@ -18,9 +21,12 @@ int usage(int exitcode)
         "Display information about x509 certificates\n"
         "\n"
         "Supported commands:\n"
-        "  diff    Compare two certificates\n"
-        "  show    Show contents of certificates\n"
-        "  tree    Print a tree of certificates\n"
+        "  asn1dump  Print the ASN.1 structure of DER data\n"
+        "  diff      Compare two certificates\n"
+        "  find-host Find the certificates that cover hostnames\n"
+        "  match     Match private keys and CSRs with certificates\n"
+        "  show      Show contents of certificates\n"
+        "  tree      Print a tree of certificates\n"
         "\n"
         "See 'xfon <command> -h' to read about a specific <command>.\n"
         ;
@@ -44,11 +50,14 @@ int main(int argc, char **argv)
     const char *cmd = argv[1];
     argc--;
     argv++;
+    if (0 == strcmp(cmd, "asn1dump")) return cmd_asn1dump(argc, argv);
     //if (0 == strcmp(cmd, "diff")) return cmd_show(argc, argv);
+    if (0 == strcmp(cmd, "find-host")) return cmd_find_host(argc, argv);
+    if (0 == strcmp(cmd, "match")) return cmd_match(argc, argv);
     if (0 == strcmp(cmd, "show")) return cmd_show(argc, argv);
     if (0 == strcmp(cmd, "tree")) return cmd_tree(argc, argv);
 
-    fprintf(stderr, "xfon: unrecognized command '%s' (valid commands are: diff, show, tree)\n", cmd);
+    fprintf(stderr, "xfon: unrecognized command '%s' (valid commands are: asn1dump, diff, find-host, match, show, tree)\n", cmd);
     return EXIT_FAILURE;
 }
 
@@ -0,0 +1,114 @@
+/*
+ * libFuzzer target over the decoding of certificates and the computation
+ * of their hierarchy.
+ *
+ * Build and run (requires clang):
+ *     ./configure --enable-fuzzer CXX=clang++ && make test/fuzz/xfon-fuzz
+ *     test/fuzz/xfon-fuzz -max_len=65536 test/fuzz/corpus
+ *
+ * Each input is a stream of concatenated DER certificates. Besides crashes,
+ * the inputs that exceed the time or allocation budget abort, so that
+ * libFuzzer reports them as failures. Such cases are to be minimized
+ * (-minimize_crash=1), fixed and added to test/fuzz/corpus, which is
+ * replayed by test-fuzz-corpus.
+ *
+ * Built with -DFUZZ_STANDALONE, the target replays the files given on
+ * its command line instead (eg: to debug a case without clang).
+ */
+
+#include <chrono>
+#include <fstream>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "cert_framer.h"
+#include "der_decode_x509.h"
+#include "hierarchy.h"
+#include "journal.h"
+#include "parallel.h"
+
+#define FUZZ_TIME_BUDGET_MS 1000                  // for each input
+#define FUZZ_ALLOCATION_BUDGET (256 * 1024 * 1024) // bytes allocated for each input, even if freed
+
+static size_t allocated; // by the current input
+
+void *operator new(size_t size)
+{
+    allocated += size;
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+static void fuzz_one_input(const uint8_t *data, size_t size)
+{
+    Cert_framer framer(true);
+    std::vector<Framed_cert> frames;
+    framer.feed(data, size, frames);
+    framer.finish(frames);
+
+    std::vector<Certificate_with_links> certificates;
+    for (size_t i=0; i<frames.size(); i++) {
+        if (frames[i].error != FRAME_OK) continue;
+        Certificate cert;
+        if (der_decode_x509_certificate(frames[i].bytes, cert)) continue;
+        certificates.emplace_back(std::move(cert));
+        certificates.back().filename = "fuzz";
+        certificates.back().index_in_file = i;
+    }
+    compute_hierarchy(certificates);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static bool initialized = false;
+    if (!initialized) {
+        journal.set_muted(true);
+        set_parallel_jobs(1); // so that the allocations are those of this input only
+        initialized = true;
+    }
+
+    allocated = 0;
+    auto start = std::chrono::steady_clock::now();
+    fuzz_one_input(data, size);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    if (elapsed.count() > FUZZ_TIME_BUDGET_MS) {
+        fprintf(stderr, "Slow input: %ld ms (budget %d ms)\n", (long)elapsed.count(), FUZZ_TIME_BUDGET_MS);
+        abort();
+    }
+    if (allocated > FUZZ_ALLOCATION_BUDGET) {
+        fprintf(stderr, "Input allocating too much: %lu bytes (budget %d bytes)\n", allocated, FUZZ_ALLOCATION_BUDGET);
+        abort();
+    }
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+int main(int argc, char **argv)
+{
+    for (int i=1; i<argc; i++) {
+        std::ifstream file(argv[i], std::ifstream::in | std::ifstream::binary);
+        std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!file.good() && !file.eof()) {
+            fprintf(stderr, "Cannot read from '%s'\n", argv[i]);
+            return 1;
+        }
+        fprintf(stderr, "Running: %s\n", argv[i]);
+        LLVMFuzzerTestOneInput((const uint8_t *)data.data(), data.size());
+    }
+    return 0;
+}
+#endif